@@ -30,13 +30,23 @@
 
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 
+#include <time.h>
+
 #include <hardware/lights.h>
 
 #define LIGHT_ATTENTION	1
 #define LIGHT_NOTIFY 	2
 
+/* backlight ramps step about once per display frame */
+#define RAMP_FRAME_NS	16666667LL
+#define RAMP_THREAD_NICE	10
+
+#define MAX_LED_STEPS	4
+
 /******************************************************************************/
 
 
@@ -45,48 +55,123 @@ static struct light_state_t *g_attention;
 static pthread_once_t g_init = PTHREAD_ONCE_INIT;
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * sysfs attributes are kept open and only written when the value changes;
+ * all of them are accessed with g_lock held
+ */
+struct sysfs_attr {
+	char const *path;
+	int fd;
+	int len;	/* length of the last value written, -1 for none */
+	char last[20];
+	int warned;
+};
+
+static struct sysfs_attr g_lcd_brightness = {
+	"/sys/class/leds/lcd-backlight/brightness", -1, -1
+};
+static struct sysfs_attr g_notify_brightness = {
+	"/sys/class/leds/notification-led/brightness", -1, -1
+};
+static struct sysfs_attr g_notify_blink = {
+	"/sys/class/leds/notification-led/blink", -1, -1
+};
+
+/**
+ * A backlight ramp is requested with LIGHT_FLASH_TIMED and its length in
+ * flashOnMS, the ramp thread then steps the level towards the target.
+ * Also protected by g_lock.
+ */
+struct backlight_ramp {
+	int active;
+	int from;
+	int to;
+	int64_t start_ns;
+	int64_t duration_ns;
+};
+
+static struct backlight_ramp g_ramp;
+static int g_backlight_level = -1;
+static int g_ramp_thread_started;
+static pthread_t g_ramp_thread;
+static pthread_cond_t g_ramp_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Notification LED pattern run by the sequencer thread off a timerfd. A
+ * single step is held, longer patterns repeat. Also protected by g_lock.
+ */
+struct led_step {
+	int brightness;
+	int blink;		/* hardware blink on time, 0 for steady */
+	int duration_ms;
+};
+
+struct led_pattern {
+	int nsteps;
+	struct led_step steps[MAX_LED_STEPS];
+};
+
+static struct led_pattern g_led_pattern;
+static int g_led_step;
+static int64_t g_led_step_end_ns;	/* 0 while holding a step */
+static int g_led_timer_fd = -1;
+static pthread_t g_led_thread;
+
 /**
  * device methods
  */
 
-static int write_int(char const *path, int value)
+/** Returns 1 if the value went out, 0 if it was already there, or -errno */
+static int write_attr(struct sysfs_attr *attr, char const *buffer, int bytes,
+		int force)
 {
-	int fd;
-	static int already_warned = -1;
-	fd = open(path, O_RDWR);
-	if (fd >= 0) {
-		char buffer[20];
-		int bytes = sprintf(buffer, "%d\n", value);
-		int amt = write(fd, buffer, bytes);
-		close(fd);
-		return amt == -1 ? -errno : 0;
-	} else {
-		if (already_warned == -1) {
-			LOGE("write_int failed to open %s\n", path);
-			already_warned = 1;
+	int err = 0;
+	int tries;
+
+	if (!force && attr->len == bytes && !memcmp(attr->last, buffer, bytes))
+		return 0;
+
+	/* a failed write closes the fd, the node may have been recreated */
+	for (tries = 0; tries < 2; tries++) {
+		if (attr->fd < 0) {
+			attr->fd = open(attr->path, O_RDWR);
+			if (attr->fd < 0) {
+				err = -errno;
+				if (!attr->warned) {
+					LOGE("write_attr failed to open %s\n", attr->path);
+					attr->warned = 1;
+				}
+				break;
+			}
 		}
-		return -errno;
+		if (pwrite(attr->fd, buffer, bytes, 0) >= 0) {
+			memcpy(attr->last, buffer, bytes);
+			attr->len = bytes;
+			return 1;
+		}
+		err = -errno;
+		close(attr->fd);
+		attr->fd = -1;
 	}
+
+	attr->len = -1;
+	return err;
 }
 
-static int write_string(char const *path, char const *value)
+static int write_int(struct sysfs_attr *attr, int value, int force)
 {
-	int fd;
-	static int already_warned = -1;
-	fd = open(path, O_RDWR);
-	if (fd >= 0) {
-		char buffer[20];
-		int bytes = sprintf(buffer, "%s\n", value);
-		int amt = write(fd, buffer, bytes);
-		close(fd);
-		return amt == -1 ? -errno : 0;
-	} else {
-		if (already_warned == -1) {
-			LOGE("write_int failed to open %s\n", path);
-			already_warned = 1;
-		}
-		return -errno;
-	}
+	char buffer[20];
+	int bytes = snprintf(buffer, sizeof(buffer), "%d\n", value);
+	return write_attr(attr, buffer, bytes, force);
+}
+
+static int write_string(struct sysfs_attr *attr, char const *value, int force)
+{
+	char buffer[20];
+	int bytes = snprintf(buffer, sizeof(buffer), "%s\n", value);
+	if (bytes >= (int)sizeof(buffer))
+		return -EINVAL;
+	return write_attr(attr, buffer, bytes, force);
 }
 
 void init_globals(void)
@@ -116,6 +201,66 @@ static int rgb_to_brightness(struct light_state_t const *state)
 	return brightness;
 }
 
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int set_backlight_locked(int level)
+{
+	int err = write_int(&g_lcd_brightness, level, 0);
+	if (err >= 0)
+		g_backlight_level = level;
+	return err < 0 ? err : 0;
+}
+
+static void *ramp_thread(void *arg)
+{
+	struct timespec frame = { 0, RAMP_FRAME_NS };
+	int64_t elapsed;
+	int level;
+
+	/* who == 0 is the calling thread on Linux */
+	setpriority(PRIO_PROCESS, 0, RAMP_THREAD_NICE);
+
+	pthread_mutex_lock(&g_lock);
+	for (;;) {
+		while (!g_ramp.active)
+			pthread_cond_wait(&g_ramp_cond, &g_lock);
+
+		elapsed = now_ns() - g_ramp.start_ns;
+		if (elapsed >= g_ramp.duration_ns) {
+			level = g_ramp.to;
+			g_ramp.active = 0;
+		} else {
+			level = g_ramp.from + (int)((g_ramp.to - g_ramp.from) *
+					elapsed / g_ramp.duration_ns);
+		}
+		set_backlight_locked(level);
+
+		if (g_ramp.active) {
+			pthread_mutex_unlock(&g_lock);
+			nanosleep(&frame, NULL);
+			pthread_mutex_lock(&g_lock);
+		}
+	}
+	return NULL;
+}
+
+static int start_ramp_thread_locked(void)
+{
+	if (!g_ramp_thread_started) {
+		if (pthread_create(&g_ramp_thread, NULL, ramp_thread, NULL)) {
+			LOGE("failed to start the backlight ramp thread\n");
+			return -1;
+		}
+		g_ramp_thread_started = 1;
+	}
+	return 0;
+}
+
 static int
 set_light_backlight(struct light_device_t *dev,
 			struct light_state_t const *state)
@@ -124,23 +269,161 @@ set_light_backlight(struct light_device_t *dev,
 	int brightness = rgb_to_brightness(state);
 
 	pthread_mutex_lock(&g_lock);
-	err = write_int("/sys/class/leds/lcd-backlight/brightness", brightness);
+	if (state->flashMode == LIGHT_FLASH_TIMED && state->flashOnMS > 0 &&
+			g_backlight_level >= 0 && start_ramp_thread_locked() == 0) {
+		g_ramp.from = g_backlight_level;
+		g_ramp.to = brightness;
+		g_ramp.start_ns = now_ns();
+		g_ramp.duration_ns = (int64_t)state->flashOnMS * 1000000LL;
+		g_ramp.active = 1;
+		pthread_cond_signal(&g_ramp_cond);
+	} else {
+		/* a plain set ends any ramp in progress */
+		g_ramp.active = 0;
+		err = set_backlight_locked(brightness);
+	}
 	pthread_mutex_unlock(&g_lock);
 
 	return err;
 }
 
+static void write_led_step_locked(struct led_step const *step)
+{
+	/* a new brightness can restart the LED, so blink goes out again with it */
+	int changed = write_int(&g_notify_brightness, step->brightness, 0);
+	write_int(&g_notify_blink, step->blink, changed != 0);
+}
+
+static void arm_led_timer_locked(int64_t when_ns)
+{
+	struct itimerspec its;
+
+	/* an all zero it_value disarms */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = when_ns / 1000000000LL;
+	its.it_value.tv_nsec = when_ns % 1000000000LL;
+	if (timerfd_settime(g_led_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		LOGE("timerfd_settime failed (%s)\n", strerror(errno));
+}
+
+static void *led_thread(void *arg)
+{
+	uint64_t expirations;
+	int64_t now;
+	struct led_step const *step;
+
+	for (;;) {
+		if (read(g_led_timer_fd, &expirations, sizeof(expirations)) < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("led timer read failed (%s)\n", strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&g_lock);
+		/* the pattern may have been replaced since the timer fired */
+		now = now_ns();
+		if (g_led_step_end_ns && now >= g_led_step_end_ns) {
+			do {
+				g_led_step = (g_led_step + 1) % g_led_pattern.nsteps;
+				step = &g_led_pattern.steps[g_led_step];
+				g_led_step_end_ns += step->duration_ms * 1000000LL;
+			} while (now >= g_led_step_end_ns);
+			write_led_step_locked(step);
+			arm_led_timer_locked(g_led_step_end_ns);
+		}
+		pthread_mutex_unlock(&g_lock);
+	}
+	return NULL;
+}
+
+static int start_led_thread_locked(void)
+{
+	if (g_led_timer_fd >= 0)
+		return 0;
+
+	g_led_timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (g_led_timer_fd < 0) {
+		LOGE("timerfd_create failed (%s)\n", strerror(errno));
+		return -1;
+	}
+	if (pthread_create(&g_led_thread, NULL, led_thread, NULL)) {
+		LOGE("failed to start the led sequencer thread\n");
+		close(g_led_timer_fd);
+		g_led_timer_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Timed flashing with an off time is sequenced here, anything else maps
+ * to a steady level or the hardware blink. Attention flashes as a double
+ * pulse when its off time leaves room for a second flash and a gap of the
+ * same length, so the period the caller asked for is kept.
+ */
+static void build_led_pattern(struct light_state_t const *state,
+		int attention, struct led_pattern *pattern)
+{
+	int brightness = rgb_to_brightness(state);
+	int on = state->flashOnMS;
+	int off = state->flashOffMS;
+
+	memset(pattern, 0, sizeof(*pattern));
+	if (state->flashMode == LIGHT_FLASH_TIMED && on > 0 && off > 0) {
+		pattern->steps[0].brightness = brightness;
+		pattern->steps[0].duration_ms = on;
+		if (attention && off > 2 * on) {
+			pattern->steps[1].duration_ms = on;
+			pattern->steps[2].brightness = brightness;
+			pattern->steps[2].duration_ms = on;
+			pattern->steps[3].duration_ms = off - 2 * on;
+			pattern->nsteps = 4;
+		} else {
+			pattern->steps[1].duration_ms = off;
+			pattern->nsteps = 2;
+		}
+	} else {
+		pattern->steps[0].brightness = brightness;
+		if (state->flashMode != LIGHT_FLASH_NONE)
+			pattern->steps[0].blink = state->flashOnMS;
+		pattern->nsteps = 1;
+	}
+}
+
+static int led_flashing(struct light_state_t const *state)
+{
+	return state->flashMode != LIGHT_FLASH_NONE && state->flashOnMS > 0;
+}
+
 static int
-set_notification_light(struct light_state_t const* state)
+set_notification_light(struct light_state_t const* state, int attention)
 {
-	unsigned int brightness = rgb_to_brightness(state);
-	int blink = state->flashOnMS;
+	struct led_pattern pattern;
 
 	LOGD("set_notification_light colorRGB=%08X, onMS=%d, offMS=%d\n",
 			state->color, state->flashOnMS, state->flashOffMS);
 
-	write_int("/sys/class/leds/notification-led/brightness", brightness);
-	write_int("/sys/class/leds/notification-led/blink", blink);
+	build_led_pattern(state, attention, &pattern);
+	if (pattern.nsteps > 1 && start_led_thread_locked() < 0) {
+		/* no sequencer, fall back to the hardware blink */
+		pattern.steps[0].blink = state->flashOnMS;
+		pattern.nsteps = 1;
+	}
+
+	g_led_pattern = pattern;
+	g_led_step = 0;
+	write_led_step_locked(&g_led_pattern.steps[0]);
+
+	if (g_led_pattern.nsteps > 1) {
+		g_led_step_end_ns = now_ns() +
+				g_led_pattern.steps[0].duration_ms * 1000000LL;
+		arm_led_timer_locked(g_led_step_end_ns);
+	} else {
+		g_led_step_end_ns = 0;
+		if (g_led_timer_fd >= 0)
+			arm_led_timer_locked(0);
+	}
 
 	return 0;
 }
@@ -149,10 +432,7 @@ static void
 handle_notification_light_locked(int type)
 {
 	struct light_state_t *new_state = 0;
-	int attn_mode = 0;
-
-	if (g_attention->flashMode == LIGHT_FLASH_HARDWARE)
-		attn_mode = g_attention->flashOnMS;
+	int attn_mode = led_flashing(g_attention);
 
 	switch (type) {
 		case LIGHT_ATTENTION: {
@@ -179,7 +459,7 @@ handle_notification_light_locked(int type)
 		return;
 	}
 
-	set_notification_light(new_state);
+	set_notification_light(new_state, new_state == g_attention);
 }
 
 static int
@@ -190,6 +470,7 @@ set_light_notifications(struct light_device_t* dev,
 
 	g_notify->color = state->color;
 	if (state->flashMode != LIGHT_FLASH_NONE) {
+		/* the hardware blink keeps going in suspend, the sequencer does not */
 		g_notify->flashMode = LIGHT_FLASH_HARDWARE;
 		g_notify->flashOnMS = state->flashOnMS;
 		g_notify->flashOffMS = state->flashOffMS;
@@ -212,7 +493,7 @@ set_light_attention(struct light_device_t* dev,
 	g_attention->flashMode = state->flashMode;
 	g_attention->flashOnMS = state->flashOnMS;
 	g_attention->color = state->color;
-	g_attention->flashOffMS = 0;
+	g_attention->flashOffMS = state->flashOffMS;
 	handle_notification_light_locked(LIGHT_ATTENTION);
 
 	pthread_mutex_unlock(&g_lock);
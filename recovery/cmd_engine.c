@@ -0,0 +1,494 @@
+ /*
+  * Copyright (C) 2009/2010 Motorola Inc.
+  * All Rights Reserved.
+  * Motorola Confidential Restricted.
+  */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+#include "common.h"
+#include "cmd_engine.h"
+
+/* largest response data accepted before the stream is taken as out of sync */
+#define CMD_ENGINE_MAX_RSP_DATA      0x10000
+
+
+/* @ monotonic time in milliseconds, for the command engine deadlines */
+INT64 CMD_ENGINE_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (INT64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* @ time left until deadline, clipped to 0 */
+int CMD_ENGINE_ms_left(INT64 deadline)
+{
+    INT64 left = deadline - CMD_ENGINE_now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/*=============================================================================================*//**
+@brief Waits for a device node to appear or go away
+
+@param[in]  path     - Device node
+@param[in]  present  - TRUE to wait for the node to exist, FALSE for it to be removed
+@param[in]  deadline - CMD_ENGINE_now_ms() value to give up at
+
+@return 0 once the node is in the wanted state, -1 on timeout
+
+@note
+ - ueventd creates and removes nodes in the parent directory, so inotify on that directory
+   wakes us up; without inotify the node is checked every CMD_ENGINE_NODE_POLL_MS
+*//*==============================================================================================*/
+int CMD_ENGINE_wait_for_node(const char *path, BOOL present, INT64 deadline)
+{
+    char dir[64];
+    char events[512];
+    const char *slash = strrchr(path, '/');
+    struct pollfd pfd;
+    int ifd = -1;
+    int ret = -1;
+    int timeout;
+
+    if (slash != NULL && slash != path && (size_t)(slash - path) < sizeof(dir))
+    {
+        memcpy(dir, path, slash - path);
+        dir[slash - path] = '\0';
+        ifd = inotify_init();
+        if (ifd >= 0 && inotify_add_watch(ifd, dir, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0)
+        {
+            close(ifd);
+            ifd = -1;
+        }
+    }
+
+    for (;;)
+    {
+        /* checked after the watch is set up, so no event is missed in between */
+        if ((access(path, F_OK) == 0) == (present != FALSE))
+        {
+            ret = 0;
+            break;
+        }
+        timeout = CMD_ENGINE_ms_left(deadline);
+        if (timeout == 0)
+        {
+            break;
+        }
+        if (ifd < 0)
+        {
+            poll(NULL, 0, timeout < CMD_ENGINE_NODE_POLL_MS ? timeout : CMD_ENGINE_NODE_POLL_MS);
+            continue;
+        }
+        pfd.fd = ifd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout) > 0)
+        {
+            /* which entry changed does not matter, the node is checked again */
+            read(ifd, events, sizeof(events));
+        }
+    }
+
+    if (ifd >= 0)
+    {
+        close(ifd);
+    }
+    return ret;
+}
+
+/*=============================================================================================*//**
+@brief Opens a session with the bp command engine
+
+@param[out] session  - Session to set up
+@param[in]  device   - tty of the command engine
+@param[in]  deadline - CMD_ENGINE_now_ms() value to give up at
+
+@return Status of initialization
+
+@note
+ - If no command engine is present, CMD_ENGINE_INIT_NOT_PRESENT must be returned
+ - The device node is waited for as the BP enumerates, the open is retried every
+   CMD_ENGINE_OPEN_RETRY_MS while the node is there but not yet usable
+ - The tty is non blocking, every read and write waits in poll() up to its deadline
+*//*==============================================================================================*/
+CMD_ENGINE_INIT_T CMD_ENGINE_open(CMD_ENGINE_SESSION_T *session, const char *device, INT64 deadline)
+{
+    CMD_ENGINE_INIT_T status = CMD_ENGINE_INIT_FAIL;
+    int timeout;
+
+    memset(session, 0, sizeof(*session));
+    session->fd = CMD_ENGINE_FD_NOT_INIT;
+    /* Keep trying to connect to the command engine until we are successful, or we run out of time */
+    while (session->fd < 0)
+    {
+        if (CMD_ENGINE_wait_for_node(device, TRUE, deadline) != 0)
+        {
+            LOGE("%s did not show up, giving up...\n", device);
+            break;
+        }
+        if ( (session->fd = open (device, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 )
+        {
+            timeout = CMD_ENGINE_ms_left(deadline);
+            if (timeout == 0)
+            {
+                LOGE("Failed to open %s (%s), giving up...\n", device, strerror(errno));
+                break;
+            }
+            poll(NULL, 0, timeout < CMD_ENGINE_OPEN_RETRY_MS ? timeout : CMD_ENGINE_OPEN_RETRY_MS);
+        }
+        else
+        {
+            struct termios tio;
+            tcgetattr( session->fd, &tio );
+
+            /* Modify local options */
+            tio.c_lflag &= ~( ECHO | ECHOE | ECHOK | ECHONL ); // None ECHO mode
+            tio.c_lflag &= ~( ICANON | ISIG );    // raw data
+
+            /* Modify input options */
+            tio.c_iflag = IGNBRK | IGNPAR; //work code
+
+            /* Modify output options */
+            tio.c_oflag &= ~( OPOST );     // work code
+
+            /* Modify control options */
+            tio.c_cflag |= ( CLOCAL | CREAD | CRTSCTS );   //enable receiver & hardware flow control
+            tio.c_cflag &= ~( CSIZE );     //disable bit mask for data bits
+            tio.c_cflag |= CS8;            //set 8-bit characters
+            tio.c_cflag &= ~( PARENB );    //disable parity bit*/
+
+            /* Modify the Baud Rate */
+            cfsetispeed( &tio, B115200 );
+            cfsetospeed( &tio, B115200 );
+
+            /* Clear the line and prepare to activate the new settings */
+            tcflush( session->fd, TCIFLUSH );
+
+            /* Set the options */
+            tcsetattr( session->fd, TCSANOW, &tio );
+
+            status = CMD_ENGINE_INIT_SUCCESS;
+        }
+    }
+    return(status);
+}
+
+/* @ closes the session, safe to call on a session that failed to open */
+void CMD_ENGINE_close(CMD_ENGINE_SESSION_T *session)
+{
+    if (session->fd != CMD_ENGINE_FD_NOT_INIT)
+    {
+        close(session->fd);
+        session->fd = CMD_ENGINE_FD_NOT_INIT;
+    }
+    session->rx_head = session->rx_tail = 0;
+}
+
+/* @ drops everything received so far, buffered or still in the tty */
+void CMD_ENGINE_flush(CMD_ENGINE_SESSION_T *session)
+{
+    session->rx_head = session->rx_tail = 0;
+    if (session->fd != CMD_ENGINE_FD_NOT_INIT)
+    {
+        tcflush(session->fd, TCIFLUSH);
+    }
+}
+
+/* @ refills the receive buffer with whatever the tty has, waiting up to the deadline */
+static BOOL CMD_ENGINE_fill(CMD_ENGINE_SESSION_T *session, INT64 deadline)
+{
+    struct pollfd pfd;
+    ssize_t bytes_read;
+
+    session->rx_head = session->rx_tail = 0;
+    pfd.fd = session->fd;
+    pfd.events = POLLIN;
+    for (;;)
+    {
+        bytes_read = read(session->fd, session->rx_buf, sizeof(session->rx_buf));
+        if (bytes_read > 0)
+        {
+            session->rx_tail = bytes_read;
+            return TRUE;
+        }
+        if (bytes_read == 0)
+        {
+            LOGE("Engine device closed.\n");
+            return FALSE;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN)
+        {
+            LOGE("Failed to read engine device (%s).\n", strerror(errno));
+            return FALSE;
+        }
+        if (poll(&pfd, 1, CMD_ENGINE_ms_left(deadline)) <= 0)
+        {
+            return FALSE;
+        }
+    }
+}
+
+/*=========================================================================*//*
+ brief read command response from bp
+@param[in]  session        - Open session
+@param[in]  bytes_to_read  - The number of bytes to read
+@param[out] data           - Data to read, NULL to discard them
+@param[in]  deadline       - CMD_ENGINE_now_ms() value to give up at
+
+@return TRUE = success, FALSE = failure
+*//*=================================================================================*/
+BOOL CMD_ENGINE_read(CMD_ENGINE_SESSION_T *session, UINT32 bytes_to_read, UINT8 *data, INT64 deadline)
+{
+    UINT32 total_bytes_read = 0;
+    UINT32 chunk;
+
+    /* Return error if the aux engine handle is not init'd */
+    if (session->fd == CMD_ENGINE_FD_NOT_INIT)
+    {
+        LOGE(" engine device is not open!\n");
+        return FALSE;
+    }
+
+    while (total_bytes_read != bytes_to_read)
+    {
+        if (session->rx_head == session->rx_tail && !CMD_ENGINE_fill(session, deadline))
+        {
+            LOGE("Timed out reading engine device, %d of %d bytes read.\n", total_bytes_read, bytes_to_read);
+            return FALSE;
+        }
+        chunk = session->rx_tail - session->rx_head;
+        if (chunk > bytes_to_read - total_bytes_read)
+        {
+            chunk = bytes_to_read - total_bytes_read;
+        }
+        if (data != NULL)
+        {
+            memcpy(&data[total_bytes_read], &session->rx_buf[session->rx_head], chunk);
+        }
+        session->rx_head += chunk;
+        total_bytes_read += chunk;
+    }
+    return TRUE;
+}
+
+/*=============================================================================================*//**
+@brief Writes the specified number of bytes to the command engine
+
+@param[in]  session        - Open session
+@param[in]  bytes_to_write - The number of bytes to write
+@param[in]  data           - Data to write
+@param[in]  deadline       - CMD_ENGINE_now_ms() value to give up at
+
+@return TRUE = success, FALSE = failure
+
+@note
+ - Short writes are continued until all bytes are out or the deadline passes
+*//*==============================================================================================*/
+BOOL CMD_ENGINE_write(CMD_ENGINE_SESSION_T *session, UINT32 bytes_to_write, const UINT8 *data, INT64 deadline)
+{
+    UINT32 total_bytes_wrote = 0;
+    ssize_t bytes_wrote;
+    struct pollfd pfd;
+
+    /* Return error if the aux engine handle is not init'd */
+    if (session->fd == CMD_ENGINE_FD_NOT_INIT)
+    {
+        LOGE("engine device is not open!\n");
+        return FALSE;
+    }
+
+    pfd.fd = session->fd;
+    pfd.events = POLLOUT;
+    while (total_bytes_wrote != bytes_to_write)
+    {
+        bytes_wrote = write(session->fd, &data[total_bytes_wrote], bytes_to_write - total_bytes_wrote);
+        if (bytes_wrote > 0)
+        {
+            total_bytes_wrote += bytes_wrote;
+            continue;
+        }
+        if (bytes_wrote < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_wrote < 0 && errno != EAGAIN)
+        {
+            LOGE("Failed to write to engine device (%s).\n", strerror(errno));
+            return FALSE;
+        }
+        if (poll(&pfd, 1, CMD_ENGINE_ms_left(deadline)) <= 0)
+        {
+            LOGE("Timed out writing engine device, %d of %d bytes written.\n", total_bytes_wrote, bytes_to_write);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* @ the header fields wider than a byte go over the wire big endian */
+static UINT16 CMD_ENGINE_UTIL_swap16(UINT16 value)
+{
+    return ((value & 0x00FF) << 8) | ((value & 0xFF00) >> 8);
+}
+
+static UINT32 CMD_ENGINE_UTIL_swap32(UINT32 value)
+{
+    return ((value & 0x000000FF) << 24) |
+        ((value & 0x0000FF00) << 8) |
+        ((value & 0x00FF0000) >> 8) |
+        ((value & 0xFF000000) >> 24);
+}
+
+/*=============================================================================================*//**
+@brief Convert network byte order to host byte order for command request headers
+
+@param[in]  hdr_in  - Network byte order command request header
+@param[out] hdr_out - Host byte order command request header
+*//*==============================================================================================*/
+void CMD_ENGINE_UTIL_hdr_req_ntoh(CMD_DEFS_CMD_REQ_HDR_T* hdr_in,CMD_DEFS_CMD_REQ_HDR_T* hdr_out)
+{
+    memcpy(hdr_out, hdr_in, sizeof(CMD_DEFS_CMD_REQ_HDR_T));
+    hdr_out->opcode = CMD_ENGINE_UTIL_swap16(hdr_in->opcode);
+    hdr_out->length = CMD_ENGINE_UTIL_swap32(hdr_in->length);
+}
+
+/*=============================================================================================*//**
+@brief Convert host byte order to network byte order for command request headers
+
+@param[in]  hdr_in  - Host byte order command request header
+@param[out] hdr_out - Network byte order command request header
+*//*==============================================================================================*/
+void CMD_ENGINE_UTIL_hdr_req_hton(CMD_DEFS_CMD_REQ_HDR_T* hdr_in,CMD_DEFS_CMD_REQ_HDR_T* hdr_out)
+{
+    /* the swap is its own inverse */
+    CMD_ENGINE_UTIL_hdr_req_ntoh(hdr_in, hdr_out);
+}
+
+/*=============================================================================================*//**
+@brief Convert network byte order to host byte order for command response headers
+
+@param[in]  hdr_in  - Network byte order command response header
+@param[out] hdr_out - Host byte order command response header
+*//*==============================================================================================*/
+void CMD_ENGINE_UTIL_hdr_rsp_ntoh(CMD_DEFS_CMD_RSP_HDR_T* hdr_in,CMD_DEFS_CMD_RSP_HDR_T* hdr_out)
+{
+    memcpy(hdr_out, hdr_in, sizeof(CMD_DEFS_CMD_RSP_HDR_T));
+    hdr_out->opcode = CMD_ENGINE_UTIL_swap16(hdr_in->opcode);
+    hdr_out->length = CMD_ENGINE_UTIL_swap32(hdr_in->length);
+}
+
+/*=============================================================================================*//**
+@brief Convert host byte order to network byte order for command response headers
+
+@param[in]  hdr_in  - Host byte order command response header
+@param[out] hdr_out - Network byte order command response header
+*//*==============================================================================================*/
+void CMD_ENGINE_UTIL_hdr_rsp_hton(CMD_DEFS_CMD_RSP_HDR_T* hdr_in,CMD_DEFS_CMD_RSP_HDR_T* hdr_out)
+{
+    CMD_ENGINE_UTIL_hdr_rsp_ntoh(hdr_in, hdr_out);
+}
+
+/*=============================================================================================*//**
+@brief Sends one request and waits for its response, see cmd_engine.h
+
+@note
+ - Unsolicited responses and responses to other opcodes (late answers to an earlier
+   request) are read past, the response data beyond rsp_max is discarded
+*//*==============================================================================================*/
+BOOL CMD_ENGINE_transact(CMD_ENGINE_SESSION_T *session, CMD_DEFS_OPCODE_T opcode,
+                         const UINT8 *req_data, UINT32 req_len,
+                         CMD_DEFS_CMD_RSP_HDR_T *rsp_hdr,
+                         UINT8 *rsp_data, UINT32 rsp_max, UINT32 *rsp_len,
+                         INT64 deadline)
+{
+    UINT8                  req_buff[sizeof(CMD_DEFS_CMD_REQ_HDR_T) + CMD_ENGINE_MAX_REQ_DATA];
+    CMD_DEFS_CMD_REQ_HDR_T cmd_header;
+    CMD_DEFS_CMD_RSP_HDR_T wire_rsp_hdr;
+    UINT32                 keep;
+
+    if (req_len > CMD_ENGINE_MAX_REQ_DATA)
+    {
+        LOGE("Request of %d bytes for opcode 0x%04x is too long.\n", req_len, opcode);
+        return FALSE;
+    }
+
+    /* Build up the CMD request */
+    memset(&cmd_header, 0, sizeof(cmd_header));
+    cmd_header.cmd_rsp_flag     = CMD_DEFS_HDR_FLAG_CMD_RSP_COMMAND;
+    cmd_header.seq_tag          = ++session->seq_tag;
+    cmd_header.opcode           = opcode;
+    cmd_header.no_rsp_reqd_flag = CMD_DEFS_HDR_FLAG_RESPONSE_EXPECTED;
+    cmd_header.length           = req_len;
+
+    CMD_ENGINE_UTIL_hdr_req_hton(&cmd_header, (CMD_DEFS_CMD_REQ_HDR_T *) req_buff);
+    if (req_len > 0)
+    {
+        memcpy(&req_buff[sizeof(CMD_DEFS_CMD_REQ_HDR_T)], req_data, req_len);
+    }
+
+    if (CMD_ENGINE_write(session, sizeof(CMD_DEFS_CMD_REQ_HDR_T) + req_len, req_buff, deadline) != TRUE)
+    {
+        LOGE("Write of CMD opcode = 0x%04x to aux engine failed!\n", opcode);
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        if (CMD_ENGINE_read(session, sizeof(wire_rsp_hdr), (UINT8 *) &wire_rsp_hdr, deadline) != TRUE)
+        {
+            LOGE("Reading header for CMD opcode = 0x%04x failed!\n", opcode);
+            return FALSE;
+        }
+        /* Network byte order to host byte order... */
+        CMD_ENGINE_UTIL_hdr_rsp_ntoh(&wire_rsp_hdr, rsp_hdr);
+
+        if (rsp_hdr->length > CMD_ENGINE_MAX_RSP_DATA)
+        {
+            LOGE("Response length %d is out of range, dropping the stream.\n", rsp_hdr->length);
+            CMD_ENGINE_flush(session);
+            return FALSE;
+        }
+
+        keep = 0;
+        if (rsp_data != NULL)
+        {
+            keep = rsp_hdr->length < rsp_max ? rsp_hdr->length : rsp_max;
+        }
+        if (CMD_ENGINE_read(session, keep, rsp_data, deadline) != TRUE ||
+            CMD_ENGINE_read(session, rsp_hdr->length - keep, NULL, deadline) != TRUE)
+        {
+            LOGE("Reading data for CMD opcode = 0x%04x failed!\n", opcode);
+            return FALSE;
+        }
+
+        if (rsp_hdr->unsol_rsp_flag == CMD_DEFS_HDR_FLAG_RESPONSE_SOLICITED &&
+            rsp_hdr->opcode == opcode && rsp_hdr->seq_tag == cmd_header.seq_tag)
+        {
+            break;
+        }
+        LOGE("Skipping response to opcode 0x%04x tag %d while waiting for 0x%04x tag %d.\n",
+             rsp_hdr->opcode, rsp_hdr->seq_tag, opcode, cmd_header.seq_tag);
+    }
+
+    if (rsp_len != NULL)
+    {
+        *rsp_len = keep;
+    }
+    return TRUE;
+}
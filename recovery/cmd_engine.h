@@ -0,0 +1,178 @@
+ /*
+  * Copyright (C) 2009/2010 Motorola Inc.
+  * All Rights Reserved.
+  * Motorola Confidential Restricted.
+  */
+
+
+#ifndef CMD_ENGINE_H_
+#define CMD_ENGINE_H_
+
+#define CMD_ENGINE_FD_NOT_INIT -1
+/* Delay between aux engine open tries once the node exists, in milliseconds */
+#define CMD_ENGINE_OPEN_RETRY_MS     100
+/* Node check interval when inotify is not available, in milliseconds */
+#define CMD_ENGINE_NODE_POLL_MS      100
+/* Receive buffer of a session, reads are served from it */
+#define CMD_ENGINE_RX_BUF_SIZE       256
+/* Largest request data a transaction sends */
+#define CMD_ENGINE_MAX_REQ_DATA      64
+
+#define CMD_DEFS_RSP_FLAG_FAIL   0x04
+/* CMD header values */
+#define CMD_DEFS_HDR_FLAG_CMD_RSP_COMMAND       0 /**< Header indicates a command */
+#define CMD_DEFS_HDR_FLAG_CMD_RSP_RESPONSE      1 /**< Header indicates a response */
+
+#define CMD_DEFS_HDR_FLAG_RESPONSE_EXPECTED     0 /**< Header indicates a response is expected */
+#define CMD_DEFS_HDR_FLAG_RESPONSE_NOT_EXPECTED 1 /**< Header indicates a response is not expected */
+
+#define CMD_DEFS_HDR_FLAG_RESPONSE_SOLICITED    0 /**< Header indicates a solicited response */
+#define CMD_DEFS_HDR_FLAG_RESPONSE_UNSOLICITED  1 /**< Header indicates a unsolicited response */
+
+#define CMD_DEFS_HDR_FLAG_DATA_NOT_PRESENT      0 /**< Header indicates response data present */
+#define CMD_DEFS_HDR_FLAG_DATA_PRESENT          1 /**< Header indicates no response data present */
+
+#define CMD_DEFS_HDR_FLAG_CMD_NOT_FAILED        0 /**< Header indicates command did not fail */
+#define CMD_DEFS_HDR_FLAG_CMD_FAILED            1 /**< Header indicates command failed */
+
+#define CMD_DEFS_OPCODE_T UINT16
+
+#ifndef TRUE
+    #define TRUE   1
+    #define FALSE  0
+#endif
+
+
+typedef unsigned char        UINT8;      /**< Unsigned 8 bit integer */
+typedef signed char          INT8;       /**< Signed 8 bit integer */
+typedef unsigned short int   UINT16;     /**< Unsigned 16 bit integer */
+typedef signed short int     INT16;      /**< Signed 16 bit integer */
+typedef unsigned  int        UINT32;     /**< Unsigned 32 bit integer */
+typedef signed int           INT32;      /**< Signed 32 bit integer */
+typedef signed long long     INT64;      /**< Signed 64 bit integer */
+typedef unsigned long long   UINT64;     /**< Unsigned 64 bit integer */
+typedef unsigned char        BOOLEAN;    /**< Boolean type */
+typedef BOOLEAN              BOOL;       /**< Boolean type */
+typedef unsigned short       W_CHAR;     /**< Wide char */
+
+typedef enum
+{
+    CMD_RSP_CODE_PAR_ERR_LENGTH       = 0x00,     /**< Parser length error        */
+    CMD_RSP_CODE_PAR_ERR_SECUR        = 0x01,     /**< Parser security error      */
+    CMD_RSP_CODE_PAR_ERR_PROT         = 0x02,     /**< Parser protocol error      */
+    CMD_RSP_CODE_PAR_ERR_MODE         = 0x03,     /**< Parser mode error          */
+    CMD_RSP_CODE_PAR_ERR_OPCODE       = 0x04,     /**< Parser opcode error        */
+    CMD_RSP_CODE_PAR_ERR_PARM         = 0x05,     /**< Parser parameter error     */
+    CMD_RSP_CODE_CMD_RSP_GENERIC      = 0x06,     /**< Generic Response           */
+    CMD_RSP_CODE_CMD_RSP_GEN_FAIL     = 0x07,     /**< General failure            */
+    CMD_RSP_CODE_CMD_MALLOC_FAIL      = 0x0A,     /**< Error allocating memory    */
+    CMD_RSP_CODE_CMD_INTL_ERR         = 0x0B,     /**< Tcmd internal error        */
+    CMD_RSP_CODE_CMD_RSP_TIMEOUT      = 0x0C,     /**< Timeout error              */
+    CMD_RSP_CODE_CMD_PAR_ERR_SUBMODE  = 0x0D,     /**< Parser submode error       */
+    CMD_RSP_CODE_CMD_TRANS_LEN_ERR    = 0x0E,     /**< Transport length error     */
+    CMD_RSP_CODE_CMD_RSP_IRRE_ERR     = 0x0F,     /**< Irrecoverable error        */
+    CMD_RSP_CODE_CMD_RSP_MUX_ERR      = 0x11,     /**< Open mux channel error     */
+
+    CMD_RSP_CODE_ASCII_ERR_LENGTH     = 0x80,     /**< ASCII length error         */
+    CMD_RSP_CODE_ASCII_ERR_MODE       = 0x83,     /**< ASCII mode error           */
+    CMD_RSP_CODE_ASCII_ERR_OPCODE     = 0x84,     /**< ASCII opcode error         */
+    CMD_RSP_CODE_ASCII_ERR_PARM       = 0x85,     /**< ASCII parameter error      */
+    CMD_RSP_CODE_ASCII_RSP_GEN_FAIL   = 0x87,     /**< ASCII Generic Failure      */
+    CMD_RSP_CODE_ASCII_MALLOC_FAIL    = 0x8A,     /**< ASCII allocating memory error */
+    CMD_RSP_CODE_ASCII_RSP_TIMEOUT    = 0x8C,     /**< ASCII timeout error        */
+    CMD_RSP_CODE_ASCII_RSP_MUX_ERR    = 0x91,     /**< ASCII mux channel error    */
+
+    /** Add all new standard response codes before CMD_RSP_CODE_NOT_SET */
+    CMD_RSP_CODE_NOT_SET
+} CMD_RSP_CODE_T;
+
+typedef enum
+{
+    CMD_ENGINE_INIT_SUCCESS     = 0,
+    CMD_ENGINE_INIT_FAIL        = 1,
+    CMD_ENGINE_INIT_NOT_PRESENT = 2
+} CMD_ENGINE_INIT_T;
+/** The Command Protocol Header (Bulk Endpoint/12 byte) - Request Header */
+typedef struct
+{
+    UINT8             reserved1         : 7;  /**< Reserved */
+    UINT8             cmd_rsp_flag      : 1;  /**< Command/Response Flag */
+    UINT8             seq_tag;                /**< Sequence Tag */
+    CMD_DEFS_OPCODE_T  opcode;                 /**< Opcode */
+    UINT8             reserved2;              /**< Reserved */
+    UINT8             no_rsp_reqd_flag  : 1;  /**< No Response Required Flag */
+    UINT8             reserved3         : 7;  /**< Reserved */
+    UINT16            reserved4;              /**< Reserved */
+    UINT32            length;                 /**< Data Length of Request */
+} CMD_DEFS_CMD_REQ_HDR_T;
+
+/** The  Command Protocol Header (Bulk Endpoint/12 byte) - Response Header */
+typedef struct
+{
+    UINT8             unsol_rsp_flag  : 1;    /**< Unsolicited Response Flag */
+    UINT8             data_flag       : 1;    /**< Response Data Flag */
+    UINT8             fail_flag       : 1;    /**< Fail Flag */
+    UINT8             cmd_version    : 4;    /**< CMD Version Number */
+    UINT8             cmd_rsp_flag    : 1;    /**< Command/Response Flag */
+    UINT8             seq_tag;                /**< Sequence Tag */
+    CMD_DEFS_OPCODE_T  opcode;                 /**< Opcode */
+    UINT8             reserved1;              /**< Reserved */
+    UINT8             rsp_code;               /**< Response Code.  For real */
+    UINT16            reserved2;              /**< Reserved */
+    UINT32            length;                 /**< Data Length of Response */
+
+} CMD_DEFS_CMD_RSP_HDR_T;
+
+/** An open connection to the command engine */
+typedef struct
+{
+    int               fd;                         /**< tty of the engine, CMD_ENGINE_FD_NOT_INIT when closed */
+    UINT8             seq_tag;                    /**< Tag of the last request sent */
+    UINT32            rx_head;                    /**< Next unread byte in rx_buf */
+    UINT32            rx_tail;                    /**< End of the valid bytes in rx_buf */
+    UINT8             rx_buf[CMD_ENGINE_RX_BUF_SIZE];
+} CMD_ENGINE_SESSION_T;
+
+/*
+ * Deadlines are CMD_ENGINE_now_ms() values, every call that waits
+ * gives up at its deadline.
+ */
+INT64 CMD_ENGINE_now_ms(void);
+int CMD_ENGINE_ms_left(INT64 deadline);
+int CMD_ENGINE_wait_for_node(const char *path, BOOL present, INT64 deadline);
+
+CMD_ENGINE_INIT_T CMD_ENGINE_open(CMD_ENGINE_SESSION_T *session, const char *device, INT64 deadline);
+void CMD_ENGINE_close(CMD_ENGINE_SESSION_T *session);
+BOOL CMD_ENGINE_read(CMD_ENGINE_SESSION_T *session, UINT32 bytes_to_read, UINT8 *data, INT64 deadline);
+BOOL CMD_ENGINE_write(CMD_ENGINE_SESSION_T *session, UINT32 bytes_to_write, const UINT8 *data, INT64 deadline);
+void CMD_ENGINE_flush(CMD_ENGINE_SESSION_T *session);
+
+void CMD_ENGINE_UTIL_hdr_req_ntoh(CMD_DEFS_CMD_REQ_HDR_T* hdr_in,CMD_DEFS_CMD_REQ_HDR_T* hdr_out);
+void CMD_ENGINE_UTIL_hdr_req_hton(CMD_DEFS_CMD_REQ_HDR_T* hdr_in,CMD_DEFS_CMD_REQ_HDR_T* hdr_out);
+void CMD_ENGINE_UTIL_hdr_rsp_ntoh(CMD_DEFS_CMD_RSP_HDR_T* hdr_in,CMD_DEFS_CMD_RSP_HDR_T* hdr_out);
+void CMD_ENGINE_UTIL_hdr_rsp_hton(CMD_DEFS_CMD_RSP_HDR_T* hdr_in,CMD_DEFS_CMD_RSP_HDR_T* hdr_out);
+
+/*
+ * Sends one request and waits for its response
+ * Parameters:
+ *    session  - open session
+ *    opcode   - request opcode
+ *    req_data - request data, req_len bytes (at most CMD_ENGINE_MAX_REQ_DATA)
+ *    rsp_hdr  - response header, in host byte order
+ *    rsp_data - buffer for up to rsp_max bytes of response data, may be NULL
+ *    rsp_len  - number of response data bytes stored, may be NULL
+ *    deadline - time to give up at
+ * Only the solicited response carrying the request's opcode and sequence
+ * tag completes it; anything else, such as a late answer to an earlier
+ * request, is read and skipped.
+ * Return code:
+ *    TRUE  - a matching response was received
+ *    FALSE - the request could not be sent or no response came in time
+ */
+BOOL CMD_ENGINE_transact(CMD_ENGINE_SESSION_T *session, CMD_DEFS_OPCODE_T opcode,
+                         const UINT8 *req_data, UINT32 req_len,
+                         CMD_DEFS_CMD_RSP_HDR_T *rsp_hdr,
+                         UINT8 *rsp_data, UINT32 rsp_max, UINT32 *rsp_len,
+                         INT64 deadline);
+
+#endif
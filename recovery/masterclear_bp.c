@@ -7,11 +7,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <fcntl.h>
-#include <termios.h>
 
 #include "common.h"
 #include "masterclear_bp.h"
@@ -74,182 +74,14 @@ void CMD_DBG_data_dump(void* databuff, int len)
 #endif
 }
 
-/*=============================================================================================*//**
-@brief Initializes the communcation interface with the bp command engine
-
-@return Status of initialization
-
-@note
- - If no command engine is present, CMD_ENGINE_INIT_NOT_PRESENT must be returned
-*//*==============================================================================================*/
-CMD_ENGINE_INIT_T CMD_ENGINE_init(void)
-{
-    UINT8 try_count = 1;
-    CMD_ENGINE_INIT_T status = CMD_ENGINE_INIT_FAIL;
-    cmd_engine_fd = -1;
-    /* Keep trying to connect to the command engine until we are successful, or we hit the retry max */
-    usleep(4000000);
-    while (cmd_engine_fd < 0)
-    {
-    LOGE("open dev\n");
-        if ( (cmd_engine_fd = open (CMD_ENGINE_DEVICE, O_RDWR)) < 0 )
-        {
-            if (try_count == CMD_ENGINE_CONNECT_MAX_TRY)
-            {
-                LOGE("Reached max number of retries, giving up...\n");
-                break;
-            }
-            else
-            {
-                /* Try to connect again, wait a bit before retry */
-                try_count++;
-                usleep(CMD_ENGINE_CONNECT_TRY_DELAY);
-            }
-        }
-        else
-        {
-            struct termios tio;
-            tcgetattr( cmd_engine_fd, &tio );
-
-            /* Modify local options */
-            tio.c_lflag &= ~( ECHO | ECHOE | ECHOK | ECHONL ); // None ECHO mode
-            tio.c_lflag &= ~( ICANON | ISIG );    // raw data
-
-            /* Modify input options */
-            tio.c_iflag = IGNBRK | IGNPAR; //work code
-
-            /* Modify output options */
-            tio.c_oflag &= ~( OPOST );     // work code
-
-            /* Modify control options */
-            tio.c_cflag |= ( CLOCAL | CREAD | CRTSCTS );   //enable receiver & hardware flow control
-            tio.c_cflag &= ~( CSIZE );     //disable bit mask for data bits
-            tio.c_cflag |= CS8;            //set 8-bit characters
-            tio.c_cflag &= ~( PARENB );    //disable parity bit*/
-
-            /* Modify the Baud Rate */
-            cfsetispeed( &tio, B115200 );
-            cfsetospeed( &tio, B115200 );
-
-            /* Clear the line and prepare to activate the new settings */
-            tcflush( cmd_engine_fd, TCIFLUSH );
-
-            /* Set the options */
-            tcsetattr( cmd_engine_fd, TCSANOW, &tio );
-
-            status = CMD_ENGINE_INIT_SUCCESS;
-        }
-    }
-    return(status);
-}
-
-/*=========================================================================*//*
- brief read command response from bp
-@param[in]  bytes_to_write - The number of bytes to read
-@param[out] data           - Data to read
-
-@return TRUE = success, FALSE = failure
-*//*=================================================================================*/
-
-BOOL CMD_ENGINE_read(UINT32 bytes_to_read, UINT8 *data)
-{
-    BOOL   is_success = FALSE;
-    UINT32 total_bytes_read = 0;
-    UINT32 bytes_read = 0;
-
-    /* Return error if the aux engine handle is not init'd */
-    if (cmd_engine_fd == CMD_ENGINE_FD_NOT_INIT)
-    {
-        LOGE(" engine device is not open!\n");
-    }
-    else
-    {
-        while( total_bytes_read != bytes_to_read )
-        {
-            bytes_read = read(cmd_engine_fd, &data[total_bytes_read], bytes_to_read - total_bytes_read);
-            LOGE("Attempted to read %d bytes and read %d bytes.\n", bytes_to_read - total_bytes_read, bytes_read);
-
-            if( bytes_read <= 0 )
-            {
-                LOGE("Failed to read  engine device.\n");
-                break;
-            }
-            total_bytes_read += bytes_read;
-        }
-        if( total_bytes_read == bytes_to_read )
-        {
-            LOGE("Successfully read %d bytes.\n", total_bytes_read);
-            is_success = TRUE;
-        }
-    }
-
-    return (is_success);
-}
-
-/*=============================================================================================*//**
-@brief Writes the specified number of bytes to the command engine
-
-@param[in]  bytes_to_write - The number of bytes to write
-@param[out] data           - Data to write
-
-@return TRUE = success, FALSE = failure
-
-@note
- - The write is synchronous, the function will block until the requested number of bytes are written
-*//*==============================================================================================*/
-BOOL CMD_ENGINE_write(UINT32 bytes_to_write, UINT8 *data)
-{
-    BOOL   is_success  = FALSE;
-    UINT32 bytes_wrote = 0;
-
-    /* Return error if the aux engine handle is not init'd */
-    if (cmd_engine_fd == CMD_ENGINE_FD_NOT_INIT)
-    {
-        LOGE("engine device is not open!\n");
-    }
-    else
-    {
-        bytes_wrote = write(cmd_engine_fd, data, bytes_to_write);
-        if (bytes_wrote != bytes_to_write)
-        {
-            LOGE("Failed to write to engine device, attempted to write %d bytes, but wrote %d.\n",bytes_to_write, bytes_wrote);
-        }
-        else
-        {
-            LOGE("Successfully wrote %d bytes.\n", bytes_wrote);
-            is_success = TRUE;
-        }
-    }
-
-    return (is_success);
-}
-
-
-
-/*=============================================================================================*//**
-@brief Convert network byte order to host byte order for command request headers
-
-@param[in]  hdr_in  - Network byte order command request header
-@param[out] hdr_out - Host byte order command request header
-*//*==============================================================================================*/
-void CMD_ENGINE_UTIL_hdr_req_ntoh(CMD_DEFS_CMD_REQ_HDR_T* hdr_in,CMD_DEFS_CMD_REQ_HDR_T* hdr_out)
-{
-    memcpy(hdr_out, hdr_in, sizeof(CMD_DEFS_CMD_REQ_HDR_T));
-    hdr_out->opcode = ((hdr_in->opcode & 0x00FF) << 8) | ((hdr_in->opcode & 0xFF00) >> 8);
-    hdr_out->length = ((hdr_in->length & 0x000000FF) << 24) |
-        ((hdr_in->length & 0x0000FF00) << 8) |
-        ((hdr_in->length & 0x00FF0000) >> 8) |
-        ((hdr_in->length & 0xFF000000) >> 24);
-
-}
-
 /*================================================================*//**
 @ brief change bp from flash mode to normal mode
 *//*=================================================================*/
-int bp_flashmode_to_normalmode(void)
+int bp_flashmode_to_normalmode(INT64 deadline)
 {
     int fd;
     ssize_t result;
+    INT64 shutdown_deadline;
     fd = open(MDM_CTRL_DEVICE, O_WRONLY);
     if (fd < 0)
     {
@@ -264,9 +96,19 @@ int bp_flashmode_to_normalmode(void)
     if (result < (ssize_t)(sizeof(MDM_CMD_SHUTDONW)-1))
     {
         LOGE("Failed to shutdown BP\n");
+        close(fd);
         return -1;
     }
-    usleep(1000000);
+    /* the BP is down once its USB interfaces are gone */
+    shutdown_deadline = CMD_ENGINE_now_ms() + BP_SHUTDOWN_WAIT_MS;
+    if (shutdown_deadline > deadline)
+    {
+        shutdown_deadline = deadline;
+    }
+    if (CMD_ENGINE_wait_for_node(CMD_ENGINE_DEVICE, FALSE, shutdown_deadline) != 0)
+    {
+        LOGE("%s still present after shutdown\n", CMD_ENGINE_DEVICE);
+    }
 
     //set BP power up mode
     // echo bootmode_normal > /sys/class/radio/mdm6600/command
@@ -274,6 +116,7 @@ int bp_flashmode_to_normalmode(void)
     if (result < (ssize_t)(sizeof(MDM_CMD_NORMAL_MODE)-1))
     {
         LOGE("Failed to set BP boot mode\n");
+        close(fd);
         return -1;
     }
 
@@ -283,9 +126,10 @@ int bp_flashmode_to_normalmode(void)
     if (result < (ssize_t)(sizeof(MDM_CMD_POWERUP)-1))
     {
         LOGE("Failed to powerup BP\n");
+        close(fd);
         return -1;
     }
-    usleep(2000000);
+    /* CMD_ENGINE_open() waits for the BP to enumerate */
     close(fd);
 
     LOGE("Finished boot BP to normal mode\n");
@@ -299,23 +143,17 @@ int bp_flashmode_to_normalmode(void)
 
 int bp_master_clear(void)
 {
-    UINT8                  bp_ver_len;
-    const UINT8            *bp_rsp_data_ptr;
-    int                    write_len  = 0;
-    int                    read_len = 0;
-    UINT8                  *write_buff = NULL;
-    UINT8                  *read_buff = NULL;
-
-    CMD_ENGINE_INIT_T  aux_status;
-    CMD_DEFS_CMD_REQ_HDR_T cmd_header = {0};
-    CMD_DEFS_CMD_RSP_HDR_T  c_rsp_hdr;
-
-    write_len = sizeof(CMD_DEFS_CMD_REQ_HDR_T);
-    /* Build up the CMD request */
-    cmd_header.cmd_rsp_flag     = CMD_DEFS_HDR_FLAG_CMD_RSP_COMMAND;
-    cmd_header.opcode           = CMD_CMN_DRV_BP_MASTERCLEAR_OPCODE;
-    cmd_header.no_rsp_reqd_flag = CMD_DEFS_HDR_FLAG_RESPONSE_EXPECTED;
-    cmd_header.length           = CMD_BP_MASTER_RESET_DATALENTH;
+    INT64                  start = CMD_ENGINE_now_ms();
+    INT64                  deadline = start + BP_MASTER_CLEAR_BUDGET_MS;
+    INT64                  rsp_deadline;
+    BOOL                   got_rsp = FALSE;
+    int                    tries = 0;
+    int                    result = 1;
+    UINT8                  clear = CMD_BP_MASTER_CLEAR;
+
+    CMD_ENGINE_INIT_T      aux_status;
+    CMD_ENGINE_SESSION_T   session;
+    CMD_DEFS_CMD_RSP_HDR_T c_rsp_hdr;
 
     /* cancel the usb suspend mode so that usb devices can be detected when bp power up */
     if(set_usb_unsuspend()!=0)
@@ -326,63 +164,69 @@ int bp_master_clear(void)
     LOGE("finished unsuspend\n");
 
     /* change bp from flash mode to normal mode*/
-    bp_flashmode_to_normalmode();
+    ui_print("Restarting BP...\n");
+    bp_flashmode_to_normalmode(deadline);
     LOGE("from flash to normal mode\n");
     /* Send the command and receive the response */
-    aux_status = CMD_ENGINE_init();
+    ui_print("Waiting for BP command engine...\n");
+    aux_status = CMD_ENGINE_open(&session, CMD_ENGINE_DEVICE, deadline);
     if (aux_status == CMD_ENGINE_INIT_NOT_PRESENT)
     {
         LOGE("Aux engine is not present, skipping  engine setup.\n");
-        return 1;
+        goto out;
     }
     else if (aux_status != CMD_ENGINE_INIT_SUCCESS)
     {
         LOGE("Failed to init the engine! aux_status = %d.\n", aux_status);
-        return 1;
+        ui_print("BP command engine not found after %lld ms.\n", CMD_ENGINE_now_ms() - start);
+        goto out;
     }
     LOGE("engine init finished\n");
-    write_len = sizeof(CMD_DEFS_CMD_REQ_HDR_T)+cmd_header.length;
-    if ( (write_buff = (UINT8 *)malloc(write_len)) == NULL)
-    {
-        LOGE("Out of memory - malloc failed on write_buff, length = %d.\n", write_len);
-        return 1;
+    ui_print("BP command engine up after %lld ms.\n", CMD_ENGINE_now_ms() - start);
+
+    /* The engine may not be listening yet right after enumeration, so a
+       request unanswered after CMD_ENGINE_RSP_TIMEOUT_MS is sent once more.
+       A slow BP may be clearing already by then: the last request gets the
+       rest of the budget rather than being repeated, and an answer to an
+       earlier one is never taken for it. */
+    while (!got_rsp && tries < BP_MASTER_CLEAR_MAX_SENDS && CMD_ENGINE_ms_left(deadline) > 0)
+    {
+        tries++;
+        rsp_deadline = deadline;
+        if (tries < BP_MASTER_CLEAR_MAX_SENDS &&
+            CMD_ENGINE_now_ms() + CMD_ENGINE_RSP_TIMEOUT_MS < deadline)
+        {
+            rsp_deadline = CMD_ENGINE_now_ms() + CMD_ENGINE_RSP_TIMEOUT_MS;
+        }
+        got_rsp = CMD_ENGINE_transact(&session, CMD_CMN_DRV_BP_MASTERCLEAR_OPCODE,
+                                      &clear, CMD_BP_MASTER_RESET_DATALENTH,
+                                      &c_rsp_hdr, NULL, 0, NULL, rsp_deadline);
+        if (!got_rsp)
+        {
+            /* drop any partial response before trying again */
+            CMD_ENGINE_flush(&session);
+        }
     }
 
-    CMD_ENGINE_UTIL_hdr_req_ntoh(&cmd_header, (CMD_DEFS_CMD_REQ_HDR_T *) write_buff);
-    write_buff[write_len-1] = CMD_BP_MASTER_CLEAR;
-
-    CMD_DBG_data_dump(write_buff, write_len);
-
-    if (CMD_ENGINE_write(write_len, write_buff) != TRUE)
-    {
-           LOGE("Write data to aux engine failed!\n");
-           return 1;
-    }
-    else
+    if (!got_rsp)
     {
-       LOGE("Transferred %d byte(s) CMD opcode = 0x%04x to aux engine succeeded.\n",write_len, cmd_header.opcode);
-    }
-    LOGE("write finished\n");
-    free(write_buff);
-    /* Verify BP response was not a failure */
-    if (CMD_ENGINE_read(sizeof(c_rsp_hdr), (UINT8 *) &c_rsp_hdr) != TRUE)
-    {
-            LOGE("Reading header failed!\n");
-            return 1;
-    }
-    else
-    {
-            /* Network byte order to host byte order... */
-           CMD_DBG_data_dump(&c_rsp_hdr, sizeof(c_rsp_hdr));
+        ui_print("No BP response after %d request(s), %lld ms.\n", tries, CMD_ENGINE_now_ms() - start);
+        goto out;
     }
+    CMD_DBG_data_dump(&c_rsp_hdr, sizeof(c_rsp_hdr));
 
     if ( (c_rsp_hdr.fail_flag & CMD_DEFS_RSP_FLAG_FAIL) ||
     ( (c_rsp_hdr.rsp_code != CMD_RSP_CODE_CMD_RSP_GENERIC) &&
          (c_rsp_hdr.rsp_code != CMD_RSP_CODE_NOT_SET) ) )
     {
-         return 1;
+         LOGE("BP master clear failed, rsp_code = 0x%02x.\n", c_rsp_hdr.rsp_code);
+         goto out;
     }
 
-    close(cmd_engine_fd);
-    return 0;
+    ui_print("BP answered after %lld ms.\n", CMD_ENGINE_now_ms() - start);
+    result = 0;
+
+out:
+    CMD_ENGINE_close(&session);
+    return result;
 }
@@ -30,27 +30,32 @@
 
 /*****************************************************************************/
 
+static const DecoderChannel sChannels[] = {
+    { EVENT_TYPE_ACCEL_X, 0, DecoderChannel::AXIS_X, CONVERT_A_X },
+    { EVENT_TYPE_ACCEL_Y, 0, DecoderChannel::AXIS_Y, CONVERT_A_Y },
+    { EVENT_TYPE_ACCEL_Z, 0, DecoderChannel::AXIS_Z, CONVERT_A_Z },
+};
+
 AccelerationSensor::AccelerationSensor()
     : SensorBase(ACCELEROMETER_DEVICE_NAME, "accelerometer"),
-      mEnabled(0),
-      mOrientationEnabled(0),
-      mInputReader(32)
+      mInputReader(InputEventCircularReader::sizeForRate(
+              MIN_DELAY_A * 1000LL, frameEvents)),
+      mDecoder(sChannels),
+      mPowered(0)
 {
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_A;
-    mPendingEvent.type = SENSOR_TYPE_ACCELEROMETER;
-    mPendingEvent.acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-    memset(mPendingEvent.data, 0x00, sizeof(mPendingEvent.data));
+    memset(&mPendingValue, 0, sizeof(mPendingValue));
+    mPendingValue.status = SENSOR_STATUS_ACCURACY_HIGH;
 
     open_device();
 
     int flags = 0;
     if (!ioctl(dev_fd, KXTF9_IOCTL_GET_ENABLE, &flags)) {
         if (flags)  {
-            mEnabled = 1;
+            mPowered |= 1<<ID_A;
+            mRates.acquire(ID_A);
         }
     }
-    if (!mEnabled) {
+    if (!isRunning()) {
         close_device();
     }
 }
@@ -58,74 +63,74 @@ AccelerationSensor::AccelerationSensor()
 AccelerationSensor::~AccelerationSensor() {
 }
 
-int AccelerationSensor::enable(int32_t, int en)
+bool AccelerationSensor::isRunning() const
 {
-    int flags = en ? 1 : 0;
-    int err = 0;
-    if (flags != mEnabled) {
-        // don't turn the accelerometer off, if the orientation
-        // sensor is enabled
-        if (mOrientationEnabled && !en) {
-            mEnabled = flags;
-            return 0;
-        }
-        if (flags) {
-            open_device();
-        }
-        err = ioctl(dev_fd, KXTF9_IOCTL_SET_ENABLE, &flags);
-        err = err<0 ? -errno : 0;
-        LOGE_IF(err, "KXTF9_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = flags;
-        }
-        if (!flags) {
-            close_device();
-        }
-    }
-    return err;
+    return mPowered;
 }
 
-int AccelerationSensor::enableOrientation(int en)
+/*
+ * The KXTF9 is shared by ID_A and by akmd, which needs it for the
+ * orientation sensor. The device is switched on for the first of them
+ * and off after the last, and runs at the fastest period any of them or
+ * an in-HAL client holds in mRates. The power state is mPowered and not
+ * mRates, as a held disable releases a rate without switching anything.
+ */
+int AccelerationSensor::setConsumer(int32_t handle, int en)
 {
-    int flags = en ? 1 : 0;
     int err = 0;
-    if (flags != mOrientationEnabled) {
-        // don't turn the accelerometer off, if the user has requested it
-        if (mEnabled && !en) {
-            mOrientationEnabled = flags;
+    if (en) {
+        if (mPowered & (1<<handle))
             return 0;
-        }
-
-        if (flags) {
+        if (!isRunning()) {
             open_device();
+            int flags = 1;
+            err = ioctl(dev_fd, KXTF9_IOCTL_SET_ENABLE, &flags);
+            err = err<0 ? -errno : 0;
+            LOGE_IF(err, "KXTF9_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
+            if (err) {
+                close_device();
+                return err;
+            }
         }
+        mPowered |= 1<<handle;
+        mRates.acquire(handle);
+        // the KXTF9 drops rate changes made while it is disabled
+        applyDelay(true);
+    } else {
+        if (!(mPowered & (1<<handle)))
+            return 0;
+        mPowered &= ~(1<<handle);
+        mRates.release(handle);
+        if (isRunning())
+            return applyDelay();
+        int flags = 0;
         err = ioctl(dev_fd, KXTF9_IOCTL_SET_ENABLE, &flags);
         err = err<0 ? -errno : 0;
         LOGE_IF(err, "KXTF9_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mOrientationEnabled = flags;
-        }
-        if (!flags) {
-            close_device();
-        }
+        close_device();
     }
     return err;
 }
 
-int AccelerationSensor::setDelay(int32_t handle, int64_t ns)
+int AccelerationSensor::setHardwareDelay(int64_t ns)
 {
-    if (ns < 0)
-        return -EINVAL;
-
-    if (mEnabled || mOrientationEnabled) {
-        int delay = ns / 1000000;
-        if (ioctl(dev_fd, KXTF9_IOCTL_SET_DELAY, &delay)) {
-            return -errno;
-        }
+    int delay = ns / 1000000;
+    if (ioctl(dev_fd, KXTF9_IOCTL_SET_DELAY, &delay)) {
+        return -errno;
     }
     return 0;
 }
 
+int AccelerationSensor::enable(int32_t, int en)
+{
+    return setConsumer(ID_A, en);
+}
+
+int AccelerationSensor::enableOrientation(int en)
+{
+    return setConsumer(ID_O, en);
+}
+
 int AccelerationSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
@@ -142,13 +147,11 @@ int AccelerationSensor::readEvents(sensors_event_t* data, int count)
         if (type == EV_REL) {
             processEvent(event->code, event->value);
         } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            mPendingEvent.timestamp = time;
-            if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-            }
+            int64_t time = eventTimestamp(event->time);
+            mDecoder.convert(0, &mPendingValue);
+            Event::stamp(data++, time)->acceleration = mPendingValue;
+            count--;
+            numEventReceived++;
         // accelerometer sends valid ABS events for
         // userspace using EVIOCGABS
         } else if (type != EV_ABS) { 
@@ -163,15 +166,5 @@ int AccelerationSensor::readEvents(sensors_event_t* data, int count)
 
 void AccelerationSensor::processEvent(int code, int value)
 {
-    switch (code) {
-        case EVENT_TYPE_ACCEL_X:
-            mPendingEvent.acceleration.x = value * CONVERT_A_X;
-            break;
-        case EVENT_TYPE_ACCEL_Y:
-            mPendingEvent.acceleration.y = value * CONVERT_A_Y;
-            break;
-        case EVENT_TYPE_ACCEL_Z:
-            mPendingEvent.acceleration.z = value * CONVERT_A_Z;
-            break;
-    }
+    mDecoder.process(code, value);
 }
@@ -26,26 +26,43 @@
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "EventDecoder.h"
 
 /*****************************************************************************/
 
 struct input_event;
 
 class AccelerationSensor : public SensorBase {
-    int mEnabled;
-    int mOrientationEnabled;
+    typedef SensorEvent<ID_A, SENSOR_TYPE_ACCELEROMETER> Event;
+
+    // input events per sample, at most
+    enum { frameEvents = 4 };
     InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+    EventDecoder<1> mDecoder;
+    sensors_vec_t mPendingValue;
+    // the consumers (ID_A, ID_O) the chip is switched on for; a handle
+    // lingering in the poll context's hold has its rate released already
+    uint32_t mPowered;
 
 public:
             AccelerationSensor();
     virtual ~AccelerationSensor();
 
     virtual int readEvents(sensors_event_t* data, int count);
-    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual InputEventCircularReader* getInputReader() {
+        return &mInputReader;
+    }
+    virtual size_t getFrameEvents() const { return frameEvents; }
     virtual int enable(int32_t handle, int enabled);
     int enableOrientation(int enabled);
     void processEvent(int code, int value);
+
+protected:
+    virtual int setHardwareDelay(int64_t ns);
+
+private:
+    bool isRunning() const;
+    int setConsumer(int32_t handle, int enabled);
 };
 
 /*****************************************************************************/
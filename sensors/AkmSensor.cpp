@@ -30,31 +30,50 @@
 
 /*****************************************************************************/
 
+// a calibration is saved again once its offset moved this far, in uT, at
+// most every kSaveInterval unless its accuracy went up
+static const float kSaveDistance = 2.0f;
+static const int64_t kSaveInterval = 60000000000LL;
+
+// No accelerometer codes: ID_A and akmd both get their data from the one
+// KXTF9 stream in AccelerationSensor, so akmd is never asked to relay it.
+static const DecoderChannel sChannels[] = {
+    { EVENT_TYPE_MAGV_X,    AkmSensor::MagneticField, DecoderChannel::AXIS_X, CONVERT_M_X },
+    { EVENT_TYPE_MAGV_Y,    AkmSensor::MagneticField, DecoderChannel::AXIS_Y, CONVERT_M_Y },
+    { EVENT_TYPE_MAGV_Z,    AkmSensor::MagneticField, DecoderChannel::AXIS_Z, CONVERT_M_Z },
+    { EVENT_TYPE_YAW,       AkmSensor::Orientation,   DecoderChannel::AXIS_X, CONVERT_O_Y },
+    { EVENT_TYPE_PITCH,     AkmSensor::Orientation,   DecoderChannel::AXIS_Y, CONVERT_O_P },
+    { EVENT_TYPE_ROLL,      AkmSensor::Orientation,   DecoderChannel::AXIS_Z, CONVERT_O_R },
+    { EVENT_TYPE_ORIENT_STATUS, AkmSensor::Orientation, DecoderChannel::AXIS_STATUS, 0 },
+};
+
 AkmSensor::AkmSensor()
     : SensorBase(AKM_DEVICE_NAME, "compass"),
       mEnabled(0),
-      mPendingMask(0),
-      mInputReader(32)
+      mInputReader(InputEventCircularReader::sizeForRate(
+              MIN_DELAY_M * 1000LL, frameEvents)),
+      mDecoder(sChannels),
+      mFrameHeld(false),
+      mSavedAccuracy(SENSOR_STATUS_UNRELIABLE),
+      mLastSave(0)
 {
-    memset(mPendingEvents, 0, sizeof(mPendingEvents));
-
-    mPendingEvents[Accelerometer].version = sizeof(sensors_event_t);
-    mPendingEvents[Accelerometer].sensor = ID_A;
-    mPendingEvents[Accelerometer].type = SENSOR_TYPE_ACCELEROMETER;
-    mPendingEvents[Accelerometer].acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+    memset(mPendingValues, 0, sizeof(mPendingValues));
+    memset(mSavedOffset, 0, sizeof(mSavedOffset));
 
-    mPendingEvents[MagneticField].version = sizeof(sensors_event_t);
-    mPendingEvents[MagneticField].sensor = ID_M;
-    mPendingEvents[MagneticField].type = SENSOR_TYPE_MAGNETIC_FIELD;
-    mPendingEvents[MagneticField].magnetic.status = SENSOR_STATUS_ACCURACY_HIGH;
-
-    mPendingEvents[Orientation  ].version = sizeof(sensors_event_t);
-    mPendingEvents[Orientation  ].sensor = ID_O;
-    mPendingEvents[Orientation  ].type = SENSOR_TYPE_ORIENTATION;
-    mPendingEvents[Orientation  ].orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
+    property_get("ro.sensors.mag_cal", mCalibrationFile,
+            "/data/system/sensors_mag.cal");
+    if (mCalibrationFile[0] && mCalibration.load(mCalibrationFile)) {
+        memcpy(mSavedOffset, mCalibration.getOffset(), sizeof(mSavedOffset));
+        mSavedAccuracy = mCalibration.getAccuracy();
+    }
+    mPendingValues[Accelerometer].status = SENSOR_STATUS_ACCURACY_HIGH;
+    mPendingValues[Orientation  ].status = SENSOR_STATUS_ACCURACY_HIGH;
+    mPendingValues[MagneticField].status = mCalibration.getAccuracy();
 
-    for (int i=0 ; i<numSensors ; i++)
-        mDelays[i] = 200000000; // 200 ms by default
+    // 200 ms by default
+    mRates.setPeriod(ID_M, 200000000);
+    mRates.setPeriod(ID_O, 200000000);
+    mRates.setPeriod(ID_MU, 200000000);
 
     // read the actual value of all sensors if they're enabled already
     struct input_absinfo absinfo;
@@ -64,7 +83,9 @@ AkmSensor::AkmSensor()
 
     if (!ioctl(dev_fd, ECS_IOCTL_APP_GET_AFLAG, &flags)) {
         if (flags)  {
-            mEnabled |= 1<<Accelerometer;
+            // left over from an older HAL, the KXTF9 driver serves ID_A
+            flags = 0;
+            ioctl(dev_fd, ECS_IOCTL_APP_SET_AFLAG, &flags);
         }
     }
     if (!ioctl(dev_fd, ECS_IOCTL_APP_GET_MVFLAG, &flags)) {
@@ -89,9 +110,9 @@ int AkmSensor::enable(int32_t handle, int en)
 {
     int what = -1;
     switch (handle) {
-        case ID_A: what = Accelerometer; break;
-        case ID_M: what = MagneticField; break;
-        case ID_O: what = Orientation;   break;
+        case ID_M:  what = MagneticField; break;
+        case ID_O:  what = Orientation;   break;
+        case ID_MU: what = MagneticFieldUncalibrated; break;
     }
 
     if (uint32_t(what) >= numSensors)
@@ -104,20 +125,27 @@ int AkmSensor::enable(int32_t handle, int en)
         if (!mEnabled) {
             open_device();
         }
-        int cmd;
+        // both magnetic field sensors come from akmd's one MV stream
+        const uint32_t mv = (1<<MagneticField) | (1<<MagneticFieldUncalibrated);
+        uint32_t enabled = (mEnabled & ~(1<<what)) | (uint32_t(newState)<<what);
+        int cmd = -1;
         switch (what) {
             case Accelerometer: cmd = ECS_IOCTL_APP_SET_AFLAG;  break;
-            case MagneticField: cmd = ECS_IOCTL_APP_SET_MVFLAG; break;
+            case MagneticField:
+            case MagneticFieldUncalibrated:
+                if (!(enabled & mv) != !(mEnabled & mv))
+                    cmd = ECS_IOCTL_APP_SET_MVFLAG;
+                break;
             case Orientation:   cmd = ECS_IOCTL_APP_SET_MFLAG;  break;
         }
-        short flags = newState;
-        err = ioctl(dev_fd, cmd, &flags);
-        err = err<0 ? -errno : 0;
-        LOGE_IF(err, "ECS_IOCTL_APP_SET_XXX failed (%s)", strerror(-err));
+        if (cmd != -1) {
+            short flags = newState;
+            err = ioctl(dev_fd, cmd, &flags);
+            err = err<0 ? -errno : 0;
+            LOGE_IF(err, "ECS_IOCTL_APP_SET_XXX failed (%s)", strerror(-err));
+        }
         if (!err) {
-            mEnabled &= ~(1<<what);
-            mEnabled |= (uint32_t(flags)<<what);
-            update_delay();
+            mEnabled = enabled;
         }
         if (!mEnabled) {
             close_device();
@@ -126,51 +154,29 @@ int AkmSensor::enable(int32_t handle, int en)
     return err;
 }
 
-int AkmSensor::setDelay(int32_t handle, int64_t ns)
+int AkmSensor::setHardwareDelay(int64_t ns)
 {
 #ifdef ECS_IOCTL_APP_SET_DELAY
-    int what = -1;
-    switch (handle) {
-        case ID_A: what = Accelerometer; break;
-        case ID_M: what = MagneticField; break;
-        case ID_O: what = Orientation;   break;
+    short delay = ns / 1000000;
+    if (ioctl(dev_fd, ECS_IOCTL_APP_SET_DELAY, &delay)) {
+        return -errno;
     }
-
-    if (uint32_t(what) >= numSensors)
-        return -EINVAL;
-
-    if (ns < 0)
-        return -EINVAL;
-
-    mDelays[what] = ns;
-    return update_delay();
+    return 0;
 #else
     return -1;
 #endif
 }
 
-int AkmSensor::update_delay()
-{
-    if (mEnabled) {
-        uint64_t wanted = -1LLU;
-        for (int i=0 ; i<numSensors ; i++) {
-            if (mEnabled & (1<<i)) {
-                uint64_t ns = mDelays[i];
-                wanted = wanted < ns ? wanted : ns;
-            }
-        }
-        short delay = int64_t(wanted) / 1000000;
-        if (ioctl(dev_fd, ECS_IOCTL_APP_SET_DELAY, &delay)) {
-            return -errno;
-        }
-    }
-    return 0;
+// see GyroSensor::hasPendingEvents()
+bool AkmSensor::hasPendingEvents() const {
+    return mFrameHeld;
 }
 
 int AkmSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
         return -EINVAL;
+    mFrameHeld = false;
 
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
@@ -178,26 +184,74 @@ int AkmSensor::readEvents(sensors_event_t* data, int count)
 
     int numEventReceived = 0;
     input_event const* event;
+    bool full = false;
 
-    while (count && mInputReader.readEvent(&event)) {
+    while (count && !full && mInputReader.readEvent(&event)) {
         int type = event->type;
         if (type == EV_REL) {
             processEvent(event->code, event->value);
             mInputReader.next();
         } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            for (int j=0 ; count && mPendingMask && j<numSensors ; j++) {
-                if (mPendingMask & (1<<j)) {
-                    mPendingMask &= ~(1<<j);
-                    mPendingEvents[j].timestamp = time;
-                    if (mEnabled & (1<<j)) {
-                        *data++ = mPendingEvents[j];
+            int64_t time = eventTimestamp(event->time);
+            for (int j=0 ; count && mDecoder.pendingMask() && j<numSensors ; j++) {
+                if (!(mDecoder.pendingMask() & (1<<j)))
+                    continue;
+                if (j == MagneticField) {
+                    // one MV frame feeds the calibration and both sensors
+                    const uint32_t mv = mEnabled &
+                            ((1<<MagneticField) | (1<<MagneticFieldUncalibrated));
+                    const int outputs = ((mv >> MagneticField) & 1) +
+                            ((mv >> MagneticFieldUncalibrated) & 1);
+                    if (count < outputs) {
+                        // come back to this frame with more room
+                        full = true;
+                        mFrameHeld = true;
+                        break;
+                    }
+                    mDecoder.clearPending(j);
+                    if (!mv)
+                        continue;
+                    sensors_vec_t raw;
+                    mDecoder.convert(j, &raw);
+                    updateCalibration(raw.v, time);
+                    if (mv & (1<<MagneticField)) {
+                        sensors_vec_t& cal(mPendingValues[MagneticField]);
+                        mCalibration.apply(raw.v, cal.v);
+                        cal.status = mCalibration.getAccuracy();
+                        MagneticFieldEvent::stamp(data++, time)->magnetic = cal;
+                        count--;
+                        numEventReceived++;
+                    }
+                    if (mv & (1<<MagneticFieldUncalibrated)) {
+                        // uncalibrated field, then the estimated hard iron
+                        sensors_event_t* ev = data++;
+                        MagneticFieldUncalibratedEvent::stamp(ev, time);
+                        memcpy(ev->data, raw.v, sizeof(raw.v));
+                        memcpy(ev->data + 3, mCalibration.getOffset(), 3 * sizeof(float));
                         count--;
                         numEventReceived++;
                     }
+                    continue;
+                }
+                mDecoder.clearPending(j);
+                if (mEnabled & (1<<j)) {
+                    mDecoder.convert(j, &mPendingValues[j]);
+                    sensors_event_t* ev = data++;
+                    switch (j) {
+                        case Accelerometer:
+                            AccelerometerEvent::stamp(ev, time)->acceleration =
+                                    mPendingValues[j];
+                            break;
+                        case Orientation:
+                            OrientationEvent::stamp(ev, time)->orientation =
+                                    mPendingValues[j];
+                            break;
+                    }
+                    count--;
+                    numEventReceived++;
                 }
             }
-            if (!mPendingMask) {
+            if (!mDecoder.pendingMask()) {
                 mInputReader.next();
             }
         } else {
@@ -212,49 +266,30 @@ int AkmSensor::readEvents(sensors_event_t* data, int count)
 
 void AkmSensor::processEvent(int code, int value)
 {
-    switch (code) {
-        case EVENT_TYPE_ACCEL_X:
-            mPendingMask |= 1<<Accelerometer;
-            mPendingEvents[Accelerometer].acceleration.x = value * CONVERT_A_X;
-            break;
-        case EVENT_TYPE_ACCEL_Y:
-            mPendingMask |= 1<<Accelerometer;
-            mPendingEvents[Accelerometer].acceleration.y = value * CONVERT_A_Y;
-            break;
-        case EVENT_TYPE_ACCEL_Z:
-            mPendingMask |= 1<<Accelerometer;
-            mPendingEvents[Accelerometer].acceleration.z = value * CONVERT_A_Z;
-            break;
-
-        case EVENT_TYPE_MAGV_X:
-            mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.x = value * CONVERT_M_X;
-            break;
-        case EVENT_TYPE_MAGV_Y:
-            mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.y = value * CONVERT_M_Y;
-            break;
-        case EVENT_TYPE_MAGV_Z:
-            mPendingMask |= 1<<MagneticField;
-            mPendingEvents[MagneticField].magnetic.z = value * CONVERT_M_Z;
-            break;
+    mDecoder.process(code, value);
+}
 
-        case EVENT_TYPE_YAW:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.azimuth = value * CONVERT_O_Y;
-            break;
-        case EVENT_TYPE_PITCH:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.pitch = value * CONVERT_O_P;
-            break;
-        case EVENT_TYPE_ROLL:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.roll = value * CONVERT_O_R;
-            break;
-        case EVENT_TYPE_ORIENT_STATUS:
-            mPendingMask |= 1<<Orientation;
-            mPendingEvents[Orientation].orientation.status =
-                    uint8_t(value & SENSOR_STATE_MASK);
-            break;
-    }
+/*
+ * Feed the fit, and write a new calibration out when it got better or
+ * moved, which after the first minutes of use is rare. Near steel the
+ * offset keeps moving, hence the interval: the save is an fsync on the
+ * thread delivering the events.
+ */
+void AkmSensor::updateCalibration(float const* raw, int64_t timestamp)
+{
+    if (!mCalibration.handleSample(raw) || !mCalibrationFile[0])
+        return;
+    float const* offset = mCalibration.getOffset();
+    const float dx = offset[0] - mSavedOffset[0];
+    const float dy = offset[1] - mSavedOffset[1];
+    const float dz = offset[2] - mSavedOffset[2];
+    if (mCalibration.getAccuracy() <= mSavedAccuracy &&
+            (dx*dx + dy*dy + dz*dz < kSaveDistance * kSaveDistance ||
+             timestamp - mLastSave < kSaveInterval))
+        return;
+    int err = mCalibration.save(mCalibrationFile);
+    LOGW_IF(err, "couldn't write %s (%s)", mCalibrationFile, strerror(-err));
+    memcpy(mSavedOffset, offset, sizeof(mSavedOffset));
+    mSavedAccuracy = mCalibration.getAccuracy();
+    mLastSave = timestamp;
 }
@@ -22,10 +22,13 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <cutils/properties.h>
 
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "EventDecoder.h"
+#include "MagCalibration.h"
 
 /*****************************************************************************/
 
@@ -40,21 +43,47 @@ public:
         Accelerometer   = 0,
         MagneticField   = 1,
         Orientation     = 2,
+        MagneticFieldUncalibrated = 3,
         numSensors
     };
 
-    virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual InputEventCircularReader* getInputReader() {
+        return &mInputReader;
+    }
+    virtual size_t getFrameEvents() const { return frameEvents; }
     void processEvent(int code, int value);
 
+protected:
+    virtual int setHardwareDelay(int64_t ns);
+
 private:
-    int update_delay();
+    typedef SensorEvent<ID_A, SENSOR_TYPE_ACCELEROMETER> AccelerometerEvent;
+    typedef SensorEvent<ID_M, SENSOR_TYPE_MAGNETIC_FIELD> MagneticFieldEvent;
+    typedef SensorEvent<ID_O, SENSOR_TYPE_ORIENTATION> OrientationEvent;
+    typedef SensorEvent<ID_MU, SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED>
+            MagneticFieldUncalibratedEvent;
+
     uint32_t mEnabled;
-    uint32_t mPendingMask;
+    // input events per sample, at most
+    enum { frameEvents = 11 };
     InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvents[numSensors];
-    uint64_t mDelays[numSensors];
+    EventDecoder<numSensors> mDecoder;
+    sensors_vec_t mPendingValues[numSensors];
+    // a SYN frame left in mInputReader for lack of room, see readEvents()
+    bool mFrameHeld;
+
+    // ID_M is calibrated here, ID_MU is what akmd reports; the
+    // calibration is kept in ro.sensors.mag_cal across reboots
+    MagCalibration mCalibration;
+    char mCalibrationFile[PROPERTY_VALUE_MAX];
+    float mSavedOffset[3];
+    int mSavedAccuracy;
+    int64_t mLastSave;
+
+    void updateCalibration(float const* raw, int64_t timestamp);
 };
 
 /*****************************************************************************/
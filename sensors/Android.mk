@@ -22,7 +22,7 @@ include $(CLEAR_VARS)
 
 LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\"
 
-LOCAL_SRC_FILES := 						\
+sensors_src_files := 						\
 				sensors.c 			\
 				nusensors.cpp 			\
 				InputEventReader.cpp		\
@@ -30,15 +30,58 @@ LOCAL_SRC_FILES := 						\
 				AccelerationSensor.cpp		\
 				LightSensor.cpp			\
 				AkmSensor.cpp			\
+				MagCalibration.cpp		\
 				PressureSensor.cpp		\
-				GyroSensor.cpp
+				GyroSensor.cpp			\
+				GyroCalibration.cpp		\
+				BatchBuffer.cpp			\
+				SensorFusion.cpp		\
+				FusionSensor.cpp		\
+				MotionDetector.cpp		\
+				MotionSensor.cpp		\
+				DirectChannel.cpp		\
+				SharedSource.cpp		\
+				InputDeviceIndex.cpp		\
+				SensorTrace.cpp		\
+				DebugFile.cpp			\
+				InputRecorder.cpp		\
+				PowerManager.cpp		\
+				SensorReader.cpp
+
+LOCAL_SRC_FILES := $(sensors_src_files)
 
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
+LOCAL_C_INCLUDES := hardware/libhardware_legacy/include
+
 LOCAL_MODULE_TAGS := optional
-LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_SHARED_LIBRARIES := liblog libcutils libhardware_legacy
 
 LOCAL_MODULE := sensors.stingray
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host benchmark of the poll path, fed with input streams recorded on the
+# device (debug.sensors.record) or synthesized. Not built by default:
+#   mmm device/moto/stingray/sensors sensors_bench
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -DLOG_TAG=\"Sensors\" -Dioctl=sensors_replay_ioctl
+
+LOCAL_SRC_FILES := $(sensors_src_files)			\
+				bench/ReplayShim.cpp		\
+				bench/SensorsBench.cpp
+
+# the chip headers (linux/kxtf9.h...) come with the target kernel headers
+LOCAL_C_INCLUDES := $(LOCAL_PATH) bionic/libc/kernel/common \
+				hardware/libhardware_legacy/include
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+LOCAL_LDFLAGS := -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := sensors_bench
+
+include $(BUILD_HOST_EXECUTABLE)
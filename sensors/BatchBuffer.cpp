@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/sensors.h>
+
+#include "BatchBuffer.h"
+
+/*****************************************************************************/
+
+BatchBuffer::BatchBuffer(size_t numEvents)
+    : mBuffer(new sensors_event_t[numEvents]),
+      mCapacity(numEvents),
+      mHead(0),
+      mSize(0),
+      mQueuedSince(0)
+{
+}
+
+BatchBuffer::~BatchBuffer()
+{
+    delete [] mBuffer;
+}
+
+size_t BatchBuffer::writable(sensors_event_t** slot) const
+{
+    size_t tail = mHead + mSize;
+    if (tail >= mCapacity) {
+        tail -= mCapacity;
+        *slot = mBuffer + tail;
+        return mHead - tail;
+    }
+    *slot = mBuffer + tail;
+    return mCapacity - tail;
+}
+
+void BatchBuffer::commit(size_t numEvents, int64_t now)
+{
+    if (!mSize && numEvents)
+        mQueuedSince = now;
+    mSize += numEvents;
+}
+
+size_t BatchBuffer::drain(sensors_event_t* data, size_t count)
+{
+    size_t n = count < mSize ? count : mSize;
+    size_t first = mCapacity - mHead;
+    if (first > n)
+        first = n;
+    memcpy(data, mBuffer + mHead, first * sizeof(sensors_event_t));
+    memcpy(data + first, mBuffer, (n - first) * sizeof(sensors_event_t));
+    mHead += n;
+    if (mHead >= mCapacity)
+        mHead -= mCapacity;
+    mSize -= n;
+    return n;
+}
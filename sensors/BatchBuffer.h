@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BATCH_BUFFER_H
+#define ANDROID_BATCH_BUFFER_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+struct sensors_event_t;
+
+/*
+ * Bounded ring of decoded events held back from the framework until the
+ * driver's max report latency expires (or the ring fills up). Events are
+ * decoded straight into the ring by the driver's readEvents(), so holding
+ * them costs no extra copy.
+ */
+class BatchBuffer
+{
+    sensors_event_t* const mBuffer;
+    const size_t mCapacity;
+    size_t mHead;
+    size_t mSize;
+    int64_t mQueuedSince;
+
+public:
+    BatchBuffer(size_t numEvents);
+    ~BatchBuffer();
+
+    // contiguous free slots starting at *slot, fill them then commit()
+    size_t writable(sensors_event_t** slot) const;
+    void commit(size_t numEvents, int64_t now);
+
+    // move up to count of the oldest events out to data
+    size_t drain(sensors_event_t* data, size_t count);
+
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    bool full() const { return mSize == mCapacity; }
+    bool empty() const { return mSize == 0; }
+    // CLOCK_MONOTONIC time at which the oldest held event was queued
+    int64_t queuedSince() const { return mQueuedSince; }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_BATCH_BUFFER_H
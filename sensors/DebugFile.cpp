@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cutils/properties.h>
+
+#include "DebugFile.h"
+
+/*****************************************************************************/
+
+bool debugCapturesAllowed()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.build.type", value, "user");
+    return strcmp(value, "user") != 0;
+}
+
+int openDebugFile(const char* name, const char* suffix)
+{
+    if (mkdir(SENSORS_DEBUG_DIR, 0770) < 0 && errno != EEXIST)
+        return -errno;
+    const long now = long(time(NULL));
+    for (int n=0 ; n<16 ; n++) {
+        char path[128];
+        if (n)
+            snprintf(path, sizeof(path), SENSORS_DEBUG_DIR "/%s-%ld-%d.%s",
+                    name, now, n, suffix);
+        else
+            snprintf(path, sizeof(path), SENSORS_DEBUG_DIR "/%s-%ld.%s",
+                    name, now, suffix);
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+        if (fd >= 0)
+            return fd;
+        if (errno != EEXIST)
+            return -errno;
+    }
+    return -EEXIST;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSORS_DEBUG_FILE_H
+#define ANDROID_SENSORS_DEBUG_FILE_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Where the debug.sensors.* captures go. The HAL runs inside
+ * system_server and the properties can be set from the shell, so the
+ * property only switches a capture on: the directory is fixed, the name
+ * is made up here, and an existing file (or a link) is never opened.
+ */
+
+#define SENSORS_DEBUG_DIR       "/data/misc/sensors"
+
+// false on user builds, which ignore the debug.sensors.* captures
+bool debugCapturesAllowed();
+
+// a new SENSORS_DEBUG_DIR/<name>-<seconds>[-n].<suffix>, or -errno
+int openDebugFile(const char* name, const char* suffix);
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSORS_DEBUG_FILE_H
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "nusensors.h"
+#include "DirectChannel.h"
+
+/*****************************************************************************/
+
+// ~1.2s at the fastest rate level
+static const size_t kChannelEvents = 1024;
+
+// only system services get to map raw sensor data
+#define AID_APP_START   10000
+
+static int64_t rateLevelToPeriod(int rateLevel)
+{
+    switch (rateLevel) {
+        case DIRECT_RATE_NORMAL:    return 20000000LL;
+        case DIRECT_RATE_FAST:      return 5000000LL;
+        case DIRECT_RATE_VERY_FAST: return 1250000LL;
+    }
+    return 0;
+}
+
+DirectChannel::DirectChannel(int32_t handle, int rateLevel)
+    : mFd(-1), mSize(0), mHeader(0), mEvents(0),
+      mHandle(handle), mPeriod(rateLevelToPeriod(rateLevel)),
+      mLastTimestamp(0), mClosed(0)
+{
+    if (!mPeriod)
+        return;
+    mSize = sizeof(direct_report_header_t) + kChannelEvents * sizeof(sensors_event_t);
+    mFd = ashmem_create_region("sensors-direct", mSize);
+    if (mFd < 0) {
+        LOGE("couldn't create direct channel region (%s)", strerror(errno));
+        return;
+    }
+    void* base = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        LOGE("couldn't map direct channel region (%s)", strerror(errno));
+        ::close(mFd);
+        mFd = -1;
+        return;
+    }
+    mHeader = static_cast<direct_report_header_t*>(base);
+    mEvents = reinterpret_cast<sensors_event_t*>(mHeader + 1);
+    memset(mHeader, 0, sizeof(*mHeader));
+    mHeader->magic = DIRECT_REPORT_MAGIC;
+    mHeader->version = DIRECT_REPORT_VERSION;
+    mHeader->capacity = kChannelEvents;
+    mHeader->eventSize = sizeof(sensors_event_t);
+    mHeader->handle = handle;
+    mHeader->rateLevel = rateLevel;
+}
+
+DirectChannel::~DirectChannel()
+{
+    if (mHeader)
+        munmap(mHeader, mSize);
+    if (mFd >= 0)
+        ::close(mFd);
+}
+
+void DirectChannel::write(sensors_event_t const& event)
+{
+    // the hardware runs at the fastest rate anyone asked for, thin it out
+    // to what this channel was configured with (with some slack for jitter)
+    if (mLastTimestamp && event.timestamp - mLastTimestamp < mPeriod - mPeriod / 8)
+        return;
+    mLastTimestamp = event.timestamp;
+
+    const int32_t n = mHeader->writeCount + 1;
+    sensors_event_t* slot = mEvents + (uint32_t(n - 1) % kChannelEvents);
+    // invalidate the slot (store + barrier), fill it in, then publish it
+    android_atomic_acquire_store(0, &slot->reserved0);
+    *slot = event;
+    android_atomic_release_store(n, &slot->reserved0);
+    android_atomic_release_store(n, &mHeader->writeCount);
+}
+
+void DirectChannel::close()
+{
+    android_atomic_release_store(1, &mClosed);
+}
+
+bool DirectChannel::isClosed() const
+{
+    return android_atomic_acquire_load(&mClosed);
+}
+
+/*****************************************************************************/
+
+DirectChannelServer::DirectChannelServer()
+    : mSocket(-1), mWakeFd(-1), mNumPending(0), mNumLive(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+}
+
+DirectChannelServer::~DirectChannelServer()
+{
+    // like the screen state thread, the server lives as long as the process
+    pthread_mutex_destroy(&mLock);
+}
+
+int DirectChannelServer::start(int wakeFd)
+{
+    mWakeFd = wakeFd;
+    mSocket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (mSocket < 0)
+        return -errno;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    // abstract namespace: leading NUL, no file system entry to manage
+    strncpy(addr.sun_path + 1, DIRECT_REPORT_SOCKET, sizeof(addr.sun_path) - 2);
+    socklen_t len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(DIRECT_REPORT_SOCKET);
+    if (bind(mSocket, (struct sockaddr*)&addr, len) < 0 || listen(mSocket, 4) < 0) {
+        int err = -errno;
+        LOGE("couldn't listen on @%s (%s)", DIRECT_REPORT_SOCKET, strerror(-err));
+        ::close(mSocket);
+        mSocket = -1;
+        return err;
+    }
+
+    if (pthread_create(&mThread, NULL, threadLoop, this)) {
+        ::close(mSocket);
+        mSocket = -1;
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+size_t DirectChannelServer::collect(DirectChannel** channels, size_t max)
+{
+    pthread_mutex_lock(&mLock);
+    size_t n = mNumPending < max ? mNumPending : max;
+    for (size_t i=0 ; i<n ; i++)
+        channels[i] = mPending[i];
+    memmove(mPending, mPending + n, (mNumPending - n) * sizeof(mPending[0]));
+    mNumPending -= n;
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
+
+void DirectChannelServer::wake()
+{
+    eventfd_write(mWakeFd, 1);
+}
+
+bool DirectChannelServer::waitForRequest(int client)
+{
+    struct pollfd fds;
+    fds.fd = client;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int n;
+    do {
+        n = poll(&fds, 1, kRequestTimeoutMs);
+    } while (n < 0 && errno == EINTR);
+    return n == 1 && (fds.revents & POLLIN);
+}
+
+void DirectChannelServer::handleRequest(int client)
+{
+    int32_t status = 0;
+    direct_report_request_t req;
+    DirectChannel* channel = 0;
+
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0 ||
+            cred.uid >= AID_APP_START) {
+        status = -EPERM;
+    } else if (!waitForRequest(client)) {
+        status = -ETIMEDOUT;
+    } else if (recv(client, &req, sizeof(req), MSG_DONTWAIT) != sizeof(req)) {
+        status = -EINVAL;
+    } else if (req.handle != ID_A && req.handle != ID_G) {
+        status = -EINVAL;
+    } else if (mNumLive >= maxChannels) {
+        status = -EBUSY;
+    } else {
+        channel = new DirectChannel(req.handle, req.rateLevel);
+        if (!channel->initCheck()) {
+            delete channel;
+            channel = 0;
+            status = -ENOMEM;
+        }
+    }
+
+    struct iovec iov;
+    iov.iov_base = &status;
+    iov.iov_len = sizeof(status);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int))];
+    if (channel) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        const int fd = channel->getFd();
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    if (sendmsg(client, &msg, MSG_DONTWAIT) < 0 || !channel) {
+        delete channel;
+        ::close(client);
+        return;
+    }
+
+    mLive[mNumLive] = channel;
+    mClients[mNumLive] = client;
+    mNumLive++;
+    pthread_mutex_lock(&mLock);
+    mPending[mNumPending++] = channel;
+    pthread_mutex_unlock(&mLock);
+    wake();
+}
+
+void* DirectChannelServer::threadLoop(void* arg)
+{
+    DirectChannelServer* server = static_cast<DirectChannelServer*>(arg);
+    pthread_detach(pthread_self());
+    while (true) {
+        struct pollfd fds[1 + maxChannels];
+        fds[0].fd = server->mSocket;
+        fds[0].events = POLLIN;
+        for (size_t i=0 ; i<server->mNumLive ; i++) {
+            fds[1+i].fd = server->mClients[i];
+            fds[1+i].events = POLLIN;
+        }
+        int n = poll(fds, 1 + server->mNumLive, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("direct channel server poll failed (%s)", strerror(errno));
+            return NULL;
+        }
+
+        // a client closing (or writing anything) ends its channel
+        for (size_t i=server->mNumLive ; i>0 ; i--) {
+            if (!fds[i].revents)
+                continue;
+            const size_t slot = i - 1;
+            server->mLive[slot]->close();
+            ::close(server->mClients[slot]);
+            server->mNumLive--;
+            server->mLive[slot] = server->mLive[server->mNumLive];
+            server->mClients[slot] = server->mClients[server->mNumLive];
+            server->wake();
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = accept(server->mSocket, NULL, NULL);
+            if (client >= 0)
+                server->handleRequest(client);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DIRECT_CHANNEL_H
+#define ANDROID_DIRECT_CHANNEL_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <hardware/sensors.h>
+
+/*****************************************************************************/
+
+/*
+ * Direct report channels let a high rate consumer read gyro/accel events
+ * from shared memory instead of going through poll(), SensorService and
+ * binder. A client connects to the abstract socket DIRECT_REPORT_SOCKET,
+ * sends a direct_report_request_t and gets back an int32 status followed
+ * (on success) by an ashmem fd carrying SCM_RIGHTS. The channel lives as
+ * long as the client keeps that connection open.
+ *
+ * The mapping starts with a direct_report_header_t, followed by
+ * header.capacity sensors_event_t slots. Event n (counting from 1) goes to
+ * slot (n-1) % capacity and, once complete, its reserved0 holds n. A
+ * reader polls header.writeCount, copies a slot and checks reserved0
+ * before and after the copy; a mismatch means the writer lapped it.
+ */
+
+#define DIRECT_REPORT_SOCKET        "sensors.direct"
+#define DIRECT_REPORT_MAGIC         (0x44525354)    // 'DRST'
+#define DIRECT_REPORT_VERSION       (1)
+
+enum {
+    DIRECT_RATE_STOP                = 0,
+    DIRECT_RATE_NORMAL              = 1,    // ~50 Hz
+    DIRECT_RATE_FAST                = 2,    // ~200 Hz
+    DIRECT_RATE_VERY_FAST           = 3,    // ~800 Hz
+};
+
+struct direct_report_request_t {
+    int32_t handle;
+    int32_t rateLevel;
+};
+
+struct direct_report_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t eventSize;
+    int32_t handle;
+    int32_t rateLevel;
+    volatile int32_t writeCount;
+    uint32_t reserved[9];
+};
+
+/*****************************************************************************/
+
+class DirectChannel
+{
+    int mFd;
+    size_t mSize;
+    direct_report_header_t* mHeader;
+    sensors_event_t* mEvents;
+    int32_t mHandle;
+    int64_t mPeriod;
+    int64_t mLastTimestamp;
+    volatile int32_t mClosed;
+
+public:
+    DirectChannel(int32_t handle, int rateLevel);
+    ~DirectChannel();
+
+    bool initCheck() const { return mHeader != 0; }
+    int getFd() const { return mFd; }
+    int32_t getHandle() const { return mHandle; }
+    int64_t getPeriod() const { return mPeriod; }
+
+    // producer side, poll thread only
+    void write(sensors_event_t const& event);
+
+    // set by the server once the client went away
+    void close();
+    bool isClosed() const;
+};
+
+/*
+ * Accepts channel requests on DIRECT_REPORT_SOCKET on its own thread and
+ * hands the channels over to the poll thread, which adopts them on its
+ * next wakeup, so the poll thread is the only one touching live channels.
+ */
+class DirectChannelServer
+{
+public:
+    enum { maxChannels = 4 };
+    // how long a client gets to send its request after connecting, the
+    // server thread answers nobody else meanwhile
+    static const int kRequestTimeoutMs = 100;
+
+    DirectChannelServer();
+    ~DirectChannelServer();
+
+    // wakeFd is an eventfd written whenever channels come or go
+    int start(int wakeFd);
+
+    // new channels since the last call
+    size_t collect(DirectChannel** channels, size_t max);
+
+private:
+    int mSocket;
+    int mWakeFd;
+    pthread_t mThread;
+    pthread_mutex_t mLock;
+    DirectChannel* mPending[maxChannels];
+    size_t mNumPending;
+    // channels handed out, and the client connection keeping each alive
+    DirectChannel* mLive[maxChannels];
+    int mClients[maxChannels];
+    size_t mNumLive;
+
+    static void* threadLoop(void* arg);
+    bool waitForRequest(int client);
+    void handleRequest(int client);
+    void wake();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_DIRECT_CHANNEL_H
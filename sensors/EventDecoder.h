@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EVENT_DECODER_H
+#define ANDROID_EVENT_DECODER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <linux/input.h>
+
+#include <hardware/sensors.h>
+
+#include "nusensors.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/*****************************************************************************/
+
+/*
+ * One entry of a driver's decode table: the input code, which of the
+ * driver's payloads it belongs to, the axis within it and the scale to SI
+ * units. AXIS_STATUS takes the raw value masked with SENSOR_STATE_MASK.
+ */
+struct DecoderChannel {
+    enum { AXIS_X = 0, AXIS_Y = 1, AXIS_Z = 2, AXIS_STATUS = 3 };
+    int     code;
+    uint8_t payload;
+    uint8_t axis;
+    float   scale;
+};
+
+/*
+ * Table-driven replacement for the per-driver processEvent() switches.
+ * process() is a table lookup and a store of the raw value; the scaling
+ * is deferred to EV_SYN where convert() does a whole triple at once.
+ */
+template <size_t NUM_PAYLOADS>
+class EventDecoder
+{
+    enum { numCodes = ABS_CNT };
+
+    DecoderChannel const* mChannels;
+    int8_t  mLookup[numCodes];
+    int32_t mRaw[NUM_PAYLOADS][4];
+    float   mScale[NUM_PAYLOADS][4];
+    uint32_t mStatusMask;
+    uint32_t mPendingMask;
+
+    void init(DecoderChannel const* channels, size_t numChannels) {
+        memset(mLookup, -1, sizeof(mLookup));
+        memset(mRaw, 0, sizeof(mRaw));
+        memset(mScale, 0, sizeof(mScale));
+        mStatusMask = 0;
+        mPendingMask = 0;
+        for (size_t i=0 ; i<numChannels ; i++) {
+            DecoderChannel const& c(channels[i]);
+            mLookup[c.code] = int8_t(i);
+            mScale[c.payload][c.axis] = c.scale;
+            if (c.axis == DecoderChannel::AXIS_STATUS)
+                mStatusMask |= 1<<c.payload;
+        }
+        mChannels = channels;
+    }
+
+public:
+    template <size_t N>
+    EventDecoder(DecoderChannel const (&channels)[N]) {
+        init(channels, N);
+    }
+
+    inline void process(int code, int value) {
+        if (uint32_t(code) >= numCodes)
+            return;
+        const int index = mLookup[code];
+        if (index < 0)
+            return;
+        DecoderChannel const& c(mChannels[index]);
+        mRaw[c.payload][c.axis] = value;
+        mPendingMask |= 1<<c.payload;
+    }
+
+    uint32_t pendingMask() const { return mPendingMask; }
+    void clearPending(size_t payload) { mPendingMask &= ~(1<<payload); }
+
+    // scalar payloads (pressure) only use AXIS_X
+    float value(size_t payload) const {
+        return mRaw[payload][0] * mScale[payload][0];
+    }
+
+    void convert(size_t payload, sensors_vec_t* out) const {
+#if defined(__ARM_NEON__)
+        const float32x4_t v = vmulq_f32(
+                vcvtq_f32_s32(vld1q_s32(mRaw[payload])),
+                vld1q_f32(mScale[payload]));
+        // lane 3 is the status slot, leave it alone
+        vst1_f32(out->v, vget_low_f32(v));
+        vst1q_lane_f32(out->v + 2, v, 2);
+#else
+        out->v[0] = mRaw[payload][0] * mScale[payload][0];
+        out->v[1] = mRaw[payload][1] * mScale[payload][1];
+        out->v[2] = mRaw[payload][2] * mScale[payload][2];
+#endif
+        if (mStatusMask & (1<<payload))
+            out->status = int8_t(mRaw[payload][3] & SENSOR_STATE_MASK);
+    }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_EVENT_DECODER_H
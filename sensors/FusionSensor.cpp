@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "FusionSensor.h"
+
+/*****************************************************************************/
+
+// a few gyro samples worth of results between two poll() calls
+static const size_t kOutputEvents = 3 * 32;
+
+FusionSensor::FusionSensor()
+    : SensorBase(NULL, NULL),
+      mEnabled(0),
+      mOutput(kOutputEvents)
+{
+}
+
+FusionSensor::~FusionSensor() {
+}
+
+int FusionSensor::enable(int32_t handle, int en)
+{
+    int what = -1;
+    switch (handle) {
+        case ID_RV: what = RotationVector;     break;
+        case ID_GR: what = Gravity;            break;
+        case ID_LA: what = LinearAcceleration; break;
+    }
+
+    if (uint32_t(what) >= numSensors)
+        return -EINVAL;
+
+    const uint32_t wasEnabled = mEnabled;
+    if (en)
+        mEnabled |= 1<<what;
+    else
+        mEnabled &= ~(1<<what);
+    if (!wasEnabled && mEnabled) {
+        // start over, the inputs were off while we were
+        mFusion.reset();
+    }
+    return 0;
+}
+
+bool FusionSensor::hasPendingEvents() const {
+    return !mOutput.empty();
+}
+
+int FusionSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+    return mOutput.drain(data, count);
+}
+
+void FusionSensor::process(sensors_event_t const* events, int count)
+{
+    if (!mEnabled)
+        return;
+    for (int i=0 ; i<count ; i++) {
+        sensors_event_t const& ev(events[i]);
+        switch (ev.type) {
+            case SENSOR_TYPE_ACCELEROMETER:
+                mFusion.handleAccel(ev.acceleration.v);
+                break;
+            case SENSOR_TYPE_MAGNETIC_FIELD:
+                mFusion.handleMag(ev.magnetic.v);
+                break;
+            case SENSOR_TYPE_GYROSCOPE:
+                if (mFusion.handleGyro(ev.gyro.v, ev.timestamp))
+                    emit(ev.timestamp);
+                break;
+        }
+    }
+}
+
+void FusionSensor::emit(int64_t timestamp)
+{
+    for (int j=0 ; j<numSensors ; j++) {
+        if (!(mEnabled & (1<<j)))
+            continue;
+        sensors_event_t* ev;
+        if (!mOutput.writable(&ev)) {
+            // nobody is reading, drop this sample
+            return;
+        }
+        switch (j) {
+            case RotationVector:
+                RotationVectorEvent::stamp(ev, timestamp);
+                mFusion.getRotationVector(ev->data);
+                break;
+            case Gravity:
+                GravityEvent::stamp(ev, timestamp);
+                mFusion.getGravity(ev->acceleration.v);
+                ev->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+                break;
+            case LinearAcceleration:
+                LinearAccelerationEvent::stamp(ev, timestamp);
+                mFusion.getLinearAcceleration(ev->acceleration.v);
+                ev->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+                break;
+        }
+        mOutput.commit(1, timestamp);
+    }
+}
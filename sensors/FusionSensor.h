@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FUSION_SENSOR_H
+#define ANDROID_FUSION_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "SensorFusion.h"
+#include "BatchBuffer.h"
+
+/*****************************************************************************/
+
+/*
+ * Virtual driver for the rotation vector, gravity and linear acceleration
+ * sensors. It has no fd of its own; the poll context feeds it the events
+ * of the physical gyroscope, accelerometer and magnetometer and it emits
+ * its results once per gyro sample.
+ */
+class FusionSensor : public SensorBase {
+public:
+            FusionSensor();
+    virtual ~FusionSensor();
+
+    enum {
+        RotationVector      = 0,
+        Gravity             = 1,
+        LinearAcceleration  = 2,
+        numSensors
+    };
+
+    virtual int enable(int32_t handle, int enabled);
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+
+    bool isEnabled() const { return mEnabled != 0; }
+    void process(sensors_event_t const* events, int count);
+
+private:
+    typedef SensorEvent<ID_RV, SENSOR_TYPE_ROTATION_VECTOR> RotationVectorEvent;
+    typedef SensorEvent<ID_GR, SENSOR_TYPE_GRAVITY> GravityEvent;
+    typedef SensorEvent<ID_LA, SENSOR_TYPE_LINEAR_ACCELERATION> LinearAccelerationEvent;
+
+    uint32_t mEnabled;
+    SensorFusion mFusion;
+    BatchBuffer mOutput;
+
+    void emit(int64_t timestamp);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_FUSION_SENSOR_H
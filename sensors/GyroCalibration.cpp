@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/sensors.h>
+
+#include <cutils/log.h>
+
+#include "GyroCalibration.h"
+
+/*****************************************************************************/
+
+// how long the device has to be still for a bias update
+static const int64_t kStillWindow = 1000000000LL;
+// gaps longer than this (the gyro was off) start a new window
+static const int64_t kMaxGap = 100000000LL;
+// per-axis standard deviation of a still device, in rad/s (about 0.6 dps,
+// a few LSB of the L3G4200D at 2000 dps full scale)
+static const float kStillDeviation = 0.01f;
+// the L3G4200D zero-rate level is within +-75 dps at full scale
+static const float kMaxBias = 1.5f;
+// weight of a still window against the current estimate
+static const float kBiasWeight = 0.25f;
+static const uint32_t kMinSamples = 10;
+
+static const int kFileVersion = 1;
+
+GyroCalibration::GyroCalibration()
+{
+    reset();
+}
+
+void GyroCalibration::reset()
+{
+    restart(0);
+    mLastTime = 0;
+    mBias[0] = mBias[1] = mBias[2] = 0;
+    mHasBias = false;
+    mAccuracy = SENSOR_STATUS_UNRELIABLE;
+}
+
+void GyroCalibration::restart(int64_t timestamp)
+{
+    mWindowStart = timestamp;
+    mCount = 0;
+    memset(mMean, 0, sizeof(mMean));
+    memset(mM2, 0, sizeof(mM2));
+}
+
+bool GyroCalibration::handleSample(float const* v, int64_t timestamp)
+{
+    const int64_t dt = timestamp - mLastTime;
+    mLastTime = timestamp;
+    if (!mCount || dt <= 0 || dt > kMaxGap)
+        restart(timestamp);
+
+    // Welford's running mean and variance; a window is short enough for
+    // floats to be plenty
+    mCount++;
+    const float weight = 1.0f / mCount;
+    for (int i=0 ; i<3 ; i++) {
+        const float delta = v[i] - mMean[i];
+        mMean[i] += delta * weight;
+        mM2[i] += delta * (v[i] - mMean[i]);
+    }
+    const float limit = kStillDeviation * kStillDeviation * (mCount - 1);
+    for (int i=0 ; i<3 ; i++) {
+        if (mM2[i] > limit) {
+            // moving, the next window starts with this sample
+            restart(timestamp);
+            mCount = 1;
+            for (int j=0 ; j<3 ; j++)
+                mMean[j] = v[j];
+            return false;
+        }
+    }
+    if (timestamp - mWindowStart < kStillWindow || mCount < kMinSamples)
+        return false;
+
+    for (int i=0 ; i<3 ; i++) {
+        if (fabsf(mMean[i]) > kMaxBias) {
+            restart(timestamp);
+            return false;
+        }
+    }
+    for (int i=0 ; i<3 ; i++) {
+        mBias[i] = mHasBias ? mBias[i] + (mMean[i] - mBias[i]) * kBiasWeight : mMean[i];
+    }
+    mHasBias = true;
+    mAccuracy = SENSOR_STATUS_ACCURACY_HIGH;
+    restart(timestamp);
+    return true;
+}
+
+/*
+ * Saved biases are what the gyro did last time it was still, possibly at
+ * another temperature: good enough to start with at medium accuracy, and
+ * replaced gradually by this session's.
+ */
+bool GyroCalibration::load(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    int version = 0;
+    float bias[3];
+    bool valid = fscanf(f, "%d %f %f %f", &version,
+            &bias[0], &bias[1], &bias[2]) == 4 && version == kFileVersion;
+    fclose(f);
+    for (int i=0 ; valid && i<3 ; i++)
+        valid = fabsf(bias[i]) <= kMaxBias;
+    if (!valid) {
+        LOGW("ignoring bad gyroscope calibration in %s", path);
+        return false;
+    }
+    memcpy(mBias, bias, sizeof(mBias));
+    mHasBias = true;
+    mAccuracy = SENSOR_STATUS_ACCURACY_MEDIUM;
+    return true;
+}
+
+int GyroCalibration::save(const char* path) const
+{
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* f = fopen(temp, "w");
+    if (!f)
+        return -errno;
+    fprintf(f, "%d %f %f %f\n", kFileVersion, mBias[0], mBias[1], mBias[2]);
+    // rename() so a crash never leaves a truncated file behind, once the
+    // data is on disk: otherwise a power cut can leave it empty
+    bool ok = !fflush(f) && !fsync(fileno(f));
+    ok = !fclose(f) && ok;
+    if (!ok || rename(temp, path)) {
+        const int err = -errno;
+        unlink(temp);
+        return err;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GYRO_CALIBRATION_H
+#define ANDROID_GYRO_CALIBRATION_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Zero-rate offset of the gyroscope, estimated whenever the device lies
+ * still: samples are accumulated (running mean and variance, per axis)
+ * over windows of kStillWindow, and a window in which every axis stayed
+ * within the noise floor pulls the bias towards its mean. Nothing is
+ * kept per sample but the sums, so the cost is the same at any rate.
+ */
+class GyroCalibration
+{
+public:
+    GyroCalibration();
+
+    void reset();
+    // one sample in rad/s, returns true if it completed a still window
+    bool handleSample(float const* v, int64_t timestamp);
+    void apply(float const* in, float* out) const {
+        out[0] = in[0] - mBias[0];
+        out[1] = in[1] - mBias[1];
+        out[2] = in[2] - mBias[2];
+    }
+
+    int getAccuracy() const { return mAccuracy; }
+    float const* getBias() const { return mBias; }
+
+    // warm start across reboots
+    bool load(const char* path);
+    int save(const char* path) const;
+
+private:
+    int64_t mWindowStart;
+    int64_t mLastTime;
+    uint32_t mCount;
+    float mMean[3];
+    float mM2[3];
+
+    float mBias[3];
+    bool mHasBias;
+    int mAccuracy;
+
+    void restart(int64_t timestamp);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_GYRO_CALIBRATION_H
@@ -31,23 +31,44 @@
 
 /*****************************************************************************/
 
+// a bias is saved again once it moved this far (rad/s), at most every
+// kSaveInterval unless its accuracy went up
+static const float kSaveDistance = 0.002f;
+static const int64_t kSaveInterval = 60000000000LL;
+
+static const DecoderChannel sChannels[] = {
+    { EVENT_TYPE_GYRO_P, 0, DecoderChannel::AXIS_X, CONVERT_G_P },
+    { EVENT_TYPE_GYRO_R, 0, DecoderChannel::AXIS_Y, CONVERT_G_R },
+    { EVENT_TYPE_GYRO_Y, 0, DecoderChannel::AXIS_Z, CONVERT_G_Y },
+};
+
 GyroSensor::GyroSensor()
     : SensorBase(GYROSCOPE_DEVICE_NAME, "gyroscope"),
       mEnabled(0),
-      mInputReader(32)
+      mInputReader(InputEventCircularReader::sizeForRate(
+              MIN_DELAY_G * 1000LL, frameEvents)),
+      mDecoder(sChannels),
+      mFrameHeld(false),
+      mSavedAccuracy(SENSOR_STATUS_UNRELIABLE),
+      mLastSave(0)
 {
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_G;
-    mPendingEvent.type = SENSOR_TYPE_GYROSCOPE;
-    mPendingEvent.gyro.status = SENSOR_STATUS_ACCURACY_HIGH;
-    memset(mPendingEvent.data, 0x00, sizeof(mPendingEvent.data));
+    memset(&mPendingValue, 0, sizeof(mPendingValue));
+    memset(mSavedBias, 0, sizeof(mSavedBias));
+
+    property_get("ro.sensors.gyro_cal", mCalibrationFile,
+            "/data/system/sensors_gyro.cal");
+    if (mCalibrationFile[0] && mCalibration.load(mCalibrationFile)) {
+        memcpy(mSavedBias, mCalibration.getBias(), sizeof(mSavedBias));
+        mSavedAccuracy = mCalibration.getAccuracy();
+    }
+    mPendingValue.status = mCalibration.getAccuracy();
 
     open_device();
 
     int flags = 0;
     if (!ioctl(dev_fd, L3G4200D_IOCTL_GET_ENABLE, &flags)) {
         if (flags)  {
-            mEnabled = 1;
+            mEnabled = 1<<Gyroscope;
         }
     }
 
@@ -59,32 +80,43 @@ GyroSensor::GyroSensor()
 GyroSensor::~GyroSensor() {
 }
 
-int GyroSensor::enable(int32_t, int en)
+int GyroSensor::enable(int32_t handle, int en)
 {
-    int flags = en ? 1 : 0;
+    int what = -1;
+    switch (handle) {
+        case ID_G:  what = Gyroscope;    break;
+        case ID_GU: what = Uncalibrated; break;
+    }
+
+    if (uint32_t(what) >= numSensors)
+        return -EINVAL;
+
+    uint32_t enabled = mEnabled;
+    if (en)
+        enabled |= 1<<what;
+    else
+        enabled &= ~(1<<what);
     int err = 0;
-    if (flags != mEnabled) {
+    if (!enabled != !mEnabled) {
+        int flags = enabled ? 1 : 0;
         if (flags) {
             open_device();
         }
         err = ioctl(dev_fd, L3G4200D_IOCTL_SET_ENABLE, &flags);
         err = err<0 ? -errno : 0;
         LOGE_IF(err, "L3G4200D_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = flags;
-        }
         if (!flags) {
             close_device();
         }
     }
+    if (!err) {
+        mEnabled = enabled;
+    }
     return err;
 }
 
-int GyroSensor::setDelay(int32_t handle, int64_t ns)
+int GyroSensor::setHardwareDelay(int64_t ns)
 {
-    if (ns < 0)
-        return -EINVAL;
-
     int delay = ns / 1000000;
     if (ioctl(dev_fd, L3G4200D_IOCTL_SET_DELAY, &delay)) {
         return -errno;
@@ -92,10 +124,19 @@ int GyroSensor::setDelay(int32_t handle, int64_t ns)
     return 0;
 }
 
+/*
+ * The poll loop drops a driver that returned less than it was given room
+ * for, and the fd won't wake it up again for a frame already read.
+ */
+bool GyroSensor::hasPendingEvents() const {
+    return mFrameHeld;
+}
+
 int GyroSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
         return -EINVAL;
+    mFrameHeld = false;
 
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
@@ -108,12 +149,33 @@ int GyroSensor::readEvents(sensors_event_t* data, int count)
         if (type == EV_REL) {
             processEvent(event->code, event->value);
         } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            mPendingEvent.timestamp = time;
+            // one slot per output, we come back to this frame otherwise
+            const int outputs = ((mEnabled >> Gyroscope) & 1) +
+                    ((mEnabled >> Uncalibrated) & 1);
+            if (count < outputs) {
+                mFrameHeld = true;
+                break;
+            }
+            int64_t time = eventTimestamp(event->time);
             if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
+                sensors_vec_t raw;
+                mDecoder.convert(0, &raw);
+                updateCalibration(raw.v, time);
+                if (mEnabled & (1<<Gyroscope)) {
+                    mCalibration.apply(raw.v, mPendingValue.v);
+                    mPendingValue.status = mCalibration.getAccuracy();
+                    Event::stamp(data++, time)->gyro = mPendingValue;
+                    count--;
+                    numEventReceived++;
+                }
+                if (mEnabled & (1<<Uncalibrated)) {
+                    // uncalibrated rates, then the estimated bias
+                    sensors_event_t* ev = UncalibratedEvent::stamp(data++, time);
+                    memcpy(ev->data, raw.v, sizeof(raw.v));
+                    memcpy(ev->data + 3, mCalibration.getBias(), 3 * sizeof(float));
+                    count--;
+                    numEventReceived++;
+                }
             }
         } else {
             LOGE("GyroSensor: unknown event (type=%d, code=%d)",
@@ -127,15 +189,24 @@ int GyroSensor::readEvents(sensors_event_t* data, int count)
 
 void GyroSensor::processEvent(int code, int value)
 {
-    switch (code) {
-        case EVENT_TYPE_GYRO_P:
-            mPendingEvent.gyro.x = value * CONVERT_G_P;
-            break;
-        case EVENT_TYPE_GYRO_R:
-            mPendingEvent.gyro.y = value * CONVERT_G_R;
-            break;
-        case EVENT_TYPE_GYRO_Y:
-            mPendingEvent.gyro.z = value * CONVERT_G_Y;
-            break;
-    }
+    mDecoder.process(code, value);
+}
+
+void GyroSensor::updateCalibration(float const* raw, int64_t timestamp)
+{
+    if (!mCalibration.handleSample(raw, timestamp) || !mCalibrationFile[0])
+        return;
+    float const* bias = mCalibration.getBias();
+    const float dx = bias[0] - mSavedBias[0];
+    const float dy = bias[1] - mSavedBias[1];
+    const float dz = bias[2] - mSavedBias[2];
+    if (mCalibration.getAccuracy() <= mSavedAccuracy &&
+            (dx*dx + dy*dy + dz*dz < kSaveDistance * kSaveDistance ||
+             timestamp - mLastSave < kSaveInterval))
+        return;
+    int err = mCalibration.save(mCalibrationFile);
+    LOGW_IF(err, "couldn't write %s (%s)", mCalibrationFile, strerror(-err));
+    memcpy(mSavedBias, bias, sizeof(mSavedBias));
+    mSavedAccuracy = mCalibration.getAccuracy();
+    mLastSave = timestamp;
 }
@@ -23,19 +23,50 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <cutils/properties.h>
+
 
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "EventDecoder.h"
+#include "GyroCalibration.h"
 
 /*****************************************************************************/
 
 struct input_event;
 
+/*
+ * L3G4200D gyroscope. ID_G has the zero-rate offset estimated while the
+ * device is still taken out, ID_GU reports the raw rates next to that
+ * estimate. The estimate is kept in ro.sensors.gyro_cal across reboots.
+ */
 class GyroSensor : public SensorBase {
-    int mEnabled;
+    typedef SensorEvent<ID_G, SENSOR_TYPE_GYROSCOPE> Event;
+    typedef SensorEvent<ID_GU, SENSOR_TYPE_GYROSCOPE_UNCALIBRATED> UncalibratedEvent;
+
+    enum {
+        Gyroscope       = 0,
+        Uncalibrated    = 1,
+        numSensors
+    };
+
+    uint32_t mEnabled;
+    // input events per sample, at most
+    enum { frameEvents = 4 };
     InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+    EventDecoder<1> mDecoder;
+    sensors_vec_t mPendingValue;
+    // a SYN frame left in mInputReader for lack of room, see readEvents()
+    bool mFrameHeld;
+
+    GyroCalibration mCalibration;
+    char mCalibrationFile[PROPERTY_VALUE_MAX];
+    float mSavedBias[3];
+    int mSavedAccuracy;
+    int64_t mLastSave;
+
+    void updateCalibration(float const* raw, int64_t timestamp);
 
 public:
             GyroSensor();
@@ -43,9 +74,16 @@ public:
 
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
-    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual bool hasPendingEvents() const;
+    virtual InputEventCircularReader* getInputReader() {
+        return &mInputReader;
+    }
+    virtual size_t getFrameEvents() const { return frameEvents; }
 
     void processEvent(int code, int value);
+
+protected:
+    virtual int setHardwareDelay(int64_t ns);
 };
 
 /*****************************************************************************/
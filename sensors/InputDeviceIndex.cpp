@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "InputDeviceIndex.h"
+
+/*****************************************************************************/
+
+static const char* const kBootIdFile = "/proc/sys/kernel/random/boot_id";
+
+pthread_mutex_t InputDeviceIndex::sLock = PTHREAD_MUTEX_INITIALIZER;
+const char* InputDeviceIndex::sDirectory = "/dev/input";
+InputDeviceIndex::Entry InputDeviceIndex::sEntries[maxDevices];
+int InputDeviceIndex::sNumEntries;
+bool InputDeviceIndex::sValid;
+bool InputDeviceIndex::sCached;
+
+int InputDeviceIndex::open(const char* name)
+{
+    pthread_mutex_lock(&sLock);
+    if (!sValid)
+        load(true);
+    int fd = openEntry(find(name), name);
+    if (fd < 0 && sCached) {
+        // the cache may be stale, e.g. written before a node was renumbered
+        load(false);
+        fd = openEntry(find(name), name);
+    }
+    pthread_mutex_unlock(&sLock);
+    LOGE_IF(fd<0, "couldn't find '%s' input device", name);
+    return fd;
+}
+
+void InputDeviceIndex::invalidate()
+{
+    pthread_mutex_lock(&sLock);
+    sValid = false;
+    pthread_mutex_unlock(&sLock);
+}
+
+void InputDeviceIndex::setDirectory(const char* dir)
+{
+    pthread_mutex_lock(&sLock);
+    sDirectory = dir;
+    sValid = false;
+    pthread_mutex_unlock(&sLock);
+}
+
+const InputDeviceIndex::Entry* InputDeviceIndex::find(const char* name)
+{
+    for (int i=0 ; i<sNumEntries ; i++) {
+        if (!strcmp(sEntries[i].name, name))
+            return &sEntries[i];
+    }
+    return NULL;
+}
+
+int InputDeviceIndex::openEntry(const Entry* entry, const char* name)
+{
+    if (!entry)
+        return -1;
+    int fd = ::open(entry->path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+    char actual[maxNameLength];
+    if (ioctl(fd, EVIOCGNAME(sizeof(actual) - 1), &actual) < 1)
+        actual[0] = '\0';
+    actual[sizeof(actual) - 1] = '\0';
+    if (strcmp(actual, name)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void InputDeviceIndex::load(bool useCache)
+{
+    char file[PROPERTY_VALUE_MAX];
+    char bootId[64];
+    property_get("ro.sensors.input_cache", file, "");
+    const bool persist = file[0] && readBootId(bootId, sizeof(bootId));
+    if (persist && useCache && loadCache(file, bootId)) {
+        sValid = sCached = true;
+        return;
+    }
+    scan();
+    if (persist)
+        saveCache(file, bootId);
+}
+
+void InputDeviceIndex::scan()
+{
+    sNumEntries = 0;
+    sValid = true;
+    sCached = false;
+    DIR* dir = opendir(sDirectory);
+    if (dir == NULL)
+        return;
+    struct dirent* de;
+    while ((de = readdir(dir)) && sNumEntries < maxDevices) {
+        if (de->d_name[0] == '.')
+            continue;
+        Entry* const entry(&sEntries[sNumEntries]);
+        snprintf(entry->path, sizeof(entry->path), "%s/%s", sDirectory, de->d_name);
+        int fd = ::open(entry->path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0)
+            continue;
+        if (ioctl(fd, EVIOCGNAME(sizeof(entry->name) - 1), entry->name) >= 1) {
+            entry->name[sizeof(entry->name) - 1] = '\0';
+            sNumEntries++;
+        }
+        close(fd);
+    }
+    closedir(dir);
+}
+
+bool InputDeviceIndex::readBootId(char* id, size_t size)
+{
+    int fd = ::open(kBootIdFile, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, id, size - 1);
+    close(fd);
+    if (n <= 0)
+        return false;
+    id[n] = '\0';
+    id[strcspn(id, "\n")] = '\0';
+    return true;
+}
+
+/*
+ * One "<boot id>" line, then one "<path> <name>" line per node. Entries
+ * from another boot are useless, the kernel may have probed the devices
+ * in a different order.
+ */
+bool InputDeviceIndex::loadCache(const char* file, const char* bootId)
+{
+    FILE* f = fopen(file, "r");
+    if (!f)
+        return false;
+    char line[PATH_MAX + maxNameLength + 2];
+    bool valid = fgets(line, sizeof(line), f) &&
+            !strncmp(line, bootId, strlen(bootId)) &&
+            line[strlen(bootId)] == '\n';
+    sNumEntries = 0;
+    while (valid && sNumEntries < maxDevices && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char* const name = strchr(line, ' ');
+        if (!name)
+            continue;
+        *name = '\0';
+        Entry* const entry(&sEntries[sNumEntries++]);
+        snprintf(entry->path, sizeof(entry->path), "%s", line);
+        snprintf(entry->name, sizeof(entry->name), "%s", name + 1);
+    }
+    fclose(f);
+    return valid;
+}
+
+void InputDeviceIndex::saveCache(const char* file, const char* bootId)
+{
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", file);
+    FILE* f = fopen(temp, "w");
+    if (!f) {
+        LOGW("couldn't write %s (%s)", temp, strerror(errno));
+        return;
+    }
+    fprintf(f, "%s\n", bootId);
+    for (int i=0 ; i<sNumEntries ; i++)
+        fprintf(f, "%s %s\n", sEntries[i].path, sEntries[i].name);
+    // rename() so a crash never leaves a truncated index behind
+    if (fclose(f) || rename(temp, file)) {
+        LOGW("couldn't write %s (%s)", file, strerror(errno));
+        unlink(temp);
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_DEVICE_INDEX_H
+#define ANDROID_INPUT_DEVICE_INDEX_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Name -> node index of /dev/input, shared by all the drivers. The
+ * directory is scanned (every node opened for EVIOCGNAME) once per
+ * process instead of once per driver, and if ro.sensors.input_cache names
+ * a file the index is persisted there, keyed by the kernel boot id, so a
+ * restarted HAL doesn't scan at all. Cached entries are checked against
+ * EVIOCGNAME when opened, a stale one just triggers a rescan.
+ */
+class InputDeviceIndex
+{
+public:
+    enum { maxDevices = 32, maxNameLength = 80 };
+
+    // open the input device with this name non-blocking, -1 if not found
+    static int open(const char* name);
+
+    // forget the index, the next open() rescans
+    static void invalidate();
+
+    // look somewhere else than /dev/input, for the replay benchmark
+    static void setDirectory(const char* dir);
+
+private:
+    struct Entry {
+        char name[maxNameLength];
+        char path[PATH_MAX];
+    };
+
+    static pthread_mutex_t sLock;
+    static const char* sDirectory;
+    static Entry sEntries[maxDevices];
+    static int sNumEntries;
+    static bool sValid;
+    static bool sCached;
+
+    static const Entry* find(const char* name);
+    static int openEntry(const Entry* entry, const char* name);
+    static void load(bool useCache);
+    static void scan();
+    static bool readBootId(char* id, size_t size);
+    static bool loadCache(const char* file, const char* bootId);
+    static void saveCache(const char* file, const char* bootId);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_DEVICE_INDEX_H
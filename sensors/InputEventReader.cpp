@@ -21,52 +21,116 @@
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <linux/input.h>
 
 #include <cutils/log.h>
 
 #include "InputEventReader.h"
+#include "InputRecorder.h"
 
 /*****************************************************************************/
 
 struct input_event;
 
+// the kernel input queue itself is only a few dozen events deep
+static const size_t kMinEvents = 32;
+static const int64_t kRingSpanNs = 100000000LL;
+
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
 InputEventCircularReader::InputEventCircularReader(size_t numEvents)
-    : mBuffer(new input_event[numEvents * 2]),
+    : mBuffer(new input_event[numEvents]),
       mBufferEnd(mBuffer + numEvents),
       mHead(mBuffer),
       mCurr(mBuffer),
-      mFreeSpace(numEvents)
+      mFreeSpace(numEvents),
+      mNumReads(0),
+      mNumEvents(0),
+      mNumOverruns(0),
+      mNumDropped(0),
+      mRecorder(0)
 {
 }
 
 InputEventCircularReader::~InputEventCircularReader()
 {
+    delete mRecorder;
     delete [] mBuffer;
 }
 
+void InputEventCircularReader::setRecorder(InputRecorder* recorder)
+{
+    delete mRecorder;
+    mRecorder = recorder;
+}
+
+size_t InputEventCircularReader::sizeForRate(int64_t minDelayNs,
+        size_t eventsPerSample)
+{
+    size_t samples = minDelayNs > 0 ? size_t(kRingSpanNs / minDelayNs) : 1;
+    size_t numEvents = kMinEvents;
+    while (numEvents < samples * eventsPerSample)
+        numEvents <<= 1;
+    return numEvents;
+}
+
+/*
+ * Drain the fd in as few syscalls as possible: the free space is handed
+ * to readv() as (at most) two segments around the wrap point, and we keep
+ * going until the kernel comes up short or has nothing (EAGAIN), or the
+ * ring is full.
+ */
 ssize_t InputEventCircularReader::fill(int fd)
 {
     size_t numEventsRead = 0;
-    if (mFreeSpace) {
-        const ssize_t nread = read(fd, mHead, mFreeSpace * sizeof(input_event));
+    while (mFreeSpace) {
+        struct iovec iov[2];
+        int iovcnt = 1;
+        const size_t wanted = mFreeSpace;
+        size_t first = mBufferEnd - mHead;
+        if (first > size_t(mFreeSpace))
+            first = mFreeSpace;
+        iov[0].iov_base = mHead;
+        iov[0].iov_len = first * sizeof(input_event);
+        if (first < size_t(mFreeSpace)) {
+            iov[1].iov_base = mBuffer;
+            iov[1].iov_len = (mFreeSpace - first) * sizeof(input_event);
+            iovcnt = 2;
+        }
+
+        const ssize_t nread = readv(fd, iov, iovcnt);
+        mNumReads++;
+        if (nread<0 && errno == EAGAIN) {
+            // data_fd is non-blocking, nothing queued in the kernel
+            break;
+        }
         if (nread<0 || nread % sizeof(input_event)) {
             // we got a partial event!!
             return nread<0 ? -errno : -EINVAL;
         }
 
-        numEventsRead = nread / sizeof(input_event);
-        if (numEventsRead) {
-            mHead += numEventsRead;
-            mFreeSpace -= numEventsRead;
-            if (mHead > mBufferEnd) {
-                size_t s = mHead - mBufferEnd;
-                memcpy(mBuffer, mBufferEnd, s * sizeof(input_event));
-                mHead = mBuffer + s;
-            }
+        const size_t n = nread / sizeof(input_event);
+        if (mRecorder) {
+            mRecorder->write(mHead, n < first ? n : first);
+            if (n > first)
+                mRecorder->write(mBuffer, n - first);
+        }
+        numEventsRead += n;
+        mFreeSpace -= n;
+        mHead += n;
+        if (mHead >= mBufferEnd)
+            mHead -= mBufferEnd - mBuffer;
+        if (n < wanted) {
+            // short read, the kernel queue is empty
+            break;
         }
     }
+    if (!mFreeSpace)
+        mNumOverruns++;
 
     return numEventsRead;
 }
@@ -80,8 +144,11 @@ ssize_t InputEventCircularReader::readEvent(input_event const** events)
 
 void InputEventCircularReader::next()
 {
+    if (mCurr->type == EV_SYN && mCurr->code == SYN_DROPPED)
+        mNumDropped++;
     mCurr++;
     mFreeSpace++;
+    mNumEvents++;
     if (mCurr >= mBufferEnd) {
         mCurr = mBuffer;
     }
@@ -25,6 +25,7 @@
 /*****************************************************************************/
 
 struct input_event;
+class InputRecorder;
 
 class InputEventCircularReader
 {
@@ -33,6 +34,11 @@ class InputEventCircularReader
     struct input_event* mHead;
     struct input_event* mCurr;
     ssize_t mFreeSpace;
+    uint32_t mNumReads;
+    uint32_t mNumEvents;
+    uint32_t mNumOverruns;
+    uint32_t mNumDropped;
+    InputRecorder* mRecorder;
 
 public:
     InputEventCircularReader(size_t numEvents);
@@ -40,6 +46,20 @@ public:
     ssize_t fill(int fd);
     ssize_t readEvent(input_event const** events);
     void next();
+
+    // copy everything read from now on to the recorder, which we then own
+    void setRecorder(InputRecorder* recorder);
+
+    // ring size holding ~100ms of a device sampling at its fastest rate
+    static size_t sizeForRate(int64_t minDelayNs, size_t eventsPerSample);
+
+    // read() syscalls issued and input_events consumed since construction
+    uint32_t getNumReads() const { return mNumReads; }
+    uint32_t getNumEvents() const { return mNumEvents; }
+    // fill()s that stopped on a full ring, leaving data in the kernel
+    uint32_t getNumOverruns() const { return mNumOverruns; }
+    // SYN_DROPPED seen, i.e. the kernel queue overflowed and lost events
+    uint32_t getNumDropped() const { return mNumDropped; }
 };
 
 /*****************************************************************************/
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+
+#include <cutils/log.h>
+
+#include "DebugFile.h"
+#include "InputRecorder.h"
+
+/*****************************************************************************/
+
+static int64_t eventTime(input_event const& e)
+{
+    return int64_t(e.time.tv_sec)*1000000LL + e.time.tv_usec;
+}
+
+InputRecorder::InputRecorder(const char* name)
+    : mFd(-1), mLast(0), mNumRecords(0)
+{
+    snprintf(mName, sizeof(mName), "%s", name);
+    mFd = openDebugFile(name, "rec");
+    if (mFd < 0) {
+        LOGE("couldn't record %s in %s (%s)", name, SENSORS_DEBUG_DIR,
+                strerror(-mFd));
+        mFd = -1;
+    }
+}
+
+InputRecorder::~InputRecorder()
+{
+    if (mFd >= 0) {
+        flush();
+        close(mFd);
+    }
+}
+
+void InputRecorder::write(input_event const* events, size_t count)
+{
+    if (mFd < 0 || !count)
+        return;
+    if (!mLast) {
+        // the header goes out with the first event, it holds its time
+        input_record_header_t header;
+        memset(&header, 0, sizeof(header));
+        header.magic = INPUT_RECORD_MAGIC;
+        header.version = INPUT_RECORD_VERSION;
+        header.start = eventTime(events[0]);
+        memcpy(header.name, mName, sizeof(header.name));
+        ::write(mFd, &header, sizeof(header));
+        mLast = header.start;
+    }
+    for (size_t i=0 ; i<count ; i++) {
+        const int64_t t = eventTime(events[i]);
+        input_record_t* const r(&mRecords[mNumRecords++]);
+        r->delta = t > mLast ? uint32_t(t - mLast) : 0;
+        r->type = events[i].type;
+        r->code = events[i].code;
+        r->value = events[i].value;
+        mLast = t > mLast ? t : mLast;
+        if (mNumRecords == bufferedRecords)
+            flush();
+    }
+}
+
+void InputRecorder::flush()
+{
+    if (!mNumRecords)
+        return;
+    const ssize_t size = mNumRecords * sizeof(input_record_t);
+    if (::write(mFd, mRecords, size) != size) {
+        LOGW("%s recording truncated (%s)", mName, strerror(errno));
+        close(mFd);
+        mFd = -1;
+    }
+    mNumRecords = 0;
+}
+
+/*****************************************************************************/
+
+InputPlayback::InputPlayback()
+    : mFd(-1), mTime(0), mNumRecords(0), mCurrent(0)
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+InputPlayback::~InputPlayback()
+{
+    if (mFd >= 0)
+        close(mFd);
+}
+
+int InputPlayback::open(const char* path)
+{
+    mFd = ::open(path, O_RDONLY);
+    if (mFd < 0)
+        return -errno;
+    if (read(mFd, &mHeader, sizeof(mHeader)) != sizeof(mHeader) ||
+            mHeader.magic != INPUT_RECORD_MAGIC ||
+            mHeader.version != INPUT_RECORD_VERSION) {
+        close(mFd);
+        mFd = -1;
+        return -EINVAL;
+    }
+    mHeader.name[sizeof(mHeader.name) - 1] = '\0';
+    mTime = 0;
+    mNumRecords = mCurrent = 0;
+    return 0;
+}
+
+bool InputPlayback::next(input_event* event, int64_t base)
+{
+    if (mCurrent == mNumRecords) {
+        const ssize_t n = mFd < 0 ? 0 : read(mFd, mRecords, sizeof(mRecords));
+        if (n < ssize_t(sizeof(input_record_t)))
+            return false;
+        mNumRecords = n / sizeof(input_record_t);
+        mCurrent = 0;
+    }
+    input_record_t const& r(mRecords[mCurrent++]);
+    mTime += r.delta;
+    const int64_t t = base + mTime;
+    event->time.tv_sec = t / 1000000LL;
+    event->time.tv_usec = t % 1000000LL;
+    event->type = r.type;
+    event->code = r.code;
+    event->value = r.value;
+    return true;
+}
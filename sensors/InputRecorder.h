@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_INPUT_RECORDER_H
+#define ANDROID_INPUT_RECORDER_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+struct input_event;
+
+/*
+ * Raw input_event streams, one file per driver: a header, then one
+ * 12-byte record per event with its time as a delta from the previous
+ * one. The benchmark replays them through the real readers and decoders,
+ * matching them to devices by the name in the header.
+ */
+
+#define INPUT_RECORD_MAGIC      0x53524543  // 'SREC'
+#define INPUT_RECORD_VERSION    1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t start;          // time of the first event, in us
+    char name[32];          // input device name, as EVIOCGNAME reports it
+} input_record_header_t;
+
+typedef struct {
+    uint32_t delta;         // us since the previous event
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+} input_record_t;
+
+class InputRecorder
+{
+public:
+    // records to a new <name>-*.rec in SENSORS_DEBUG_DIR
+    InputRecorder(const char* name);
+    ~InputRecorder();
+
+    bool isOpen() const { return mFd >= 0; }
+    void write(input_event const* events, size_t count);
+
+private:
+    enum { bufferedRecords = 256 };
+
+    int mFd;
+    char mName[32];
+    int64_t mLast;
+    input_record_t mRecords[bufferedRecords];
+    size_t mNumRecords;
+
+    void flush();
+};
+
+class InputPlayback
+{
+public:
+    InputPlayback();
+    ~InputPlayback();
+
+    int open(const char* path);
+    const char* getName() const { return mHeader.name; }
+
+    // the next event, with times shifted so the recording starts at base
+    // (in us); false at the end of the file
+    bool next(input_event* event, int64_t base);
+
+private:
+    enum { bufferedRecords = 256 };
+
+    int mFd;
+    input_record_header_t mHeader;
+    int64_t mTime;
+    input_record_t mRecords[bufferedRecords];
+    size_t mNumRecords;
+    size_t mCurrent;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_INPUT_RECORDER_H
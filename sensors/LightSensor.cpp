@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <math.h>
 #include <poll.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/select.h>
@@ -25,28 +26,71 @@
 #include <linux/max9635.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "LightSensor.h"
 
 /*****************************************************************************/
 
+// a change is perceptible once it is this fraction of the current level,
+// or this many lux in the dark
+static const float kHysteresis = 0.10f;
+static const float kHysteresisFloor = 2.0f;
+// jumps this many thresholds away skip the smoothing
+static const float kStepFactor = 4.0f;
+
 LightSensor::LightSensor()
     : SensorBase(LIGHTING_DEVICE_NAME, "max9635_als"),
       mEnabled(0),
       mInputReader(4),
-      mHasPendingEvent(false)
+      mPendingValue(0),
+      mHasPendingEvent(false),
+      mNumLuxPoints(0),
+      mFiltered(0),
+      mReported(-1)
+{
+    loadLuxTable();
+}
+
+/*
+ * Without a table the counts are taken as lux, which is what the driver
+ * reports after its own scaling.
+ */
+void LightSensor::loadLuxTable()
 {
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_L;
-    mPendingEvent.type = SENSOR_TYPE_LIGHT;
-    memset(mPendingEvent.data, 0, sizeof(mPendingEvent.data));
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.lux_table", value, "");
+    char* p = value;
+    while (*p && mNumLuxPoints < maxLuxPoints) {
+        char* end;
+        const float raw = strtof(p, &end);
+        if (end == p || *end != ':')
+            break;
+        p = end + 1;
+        const float lux = strtof(p, &end);
+        if (end == p)
+            break;
+        // points have to come in increasing order of counts
+        if (mNumLuxPoints && raw <= mLuxTable[mNumLuxPoints-1].raw)
+            break;
+        mLuxTable[mNumLuxPoints].raw = raw;
+        mLuxTable[mNumLuxPoints].lux = lux;
+        mNumLuxPoints++;
+        p = end;
+        if (*p == ',')
+            p++;
+    }
+    if (*p) {
+        LOGE("bad ro.sensors.lux_table \"%s\", not using it", value);
+        mNumLuxPoints = 0;
+    }
 }
 
 LightSensor::~LightSensor() {
 }
 
 int LightSensor::enable(int32_t, int en) {
-    int err;
+    int err = 0;
     en = en ? 1 : 0;
     if(mEnabled != en) {
         if (en) {
@@ -57,18 +101,31 @@ int LightSensor::enable(int32_t, int en) {
         LOGE_IF(err, "MAX9635_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
         if (!err) {
             mEnabled = en;
+            // the first sample after enabling is always reported
+            mReported = -1;
         }
         if (!en) {
             close_device();
         }
     }
-    return 0;
+    return err;
 }
 
 bool LightSensor::hasPendingEvents() const {
     return mHasPendingEvent;
 }
 
+/*
+ * The chip only interrupts on a threshold crossing, in steady light the
+ * new listener would wait for a change: give it the last level read.
+ */
+void LightSensor::resume(int32_t) {
+    if (mReported < 0)
+        return;
+    mFiltered = mReported = mPendingValue;
+    mHasPendingEvent = true;
+}
+
 int LightSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
@@ -76,8 +133,7 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
 
     if (mHasPendingEvent) {
         mHasPendingEvent = false;
-        mPendingEvent.timestamp = getTimestamp();
-        *data = mPendingEvent;
+        Event::stamp(data, getTimestamp())->light = mPendingValue;
         return mEnabled ? 1 : 0;
     }
 
@@ -91,23 +147,19 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
     while (count && mInputReader.readEvent(&event)) {
         int type = event->type;
         if (type == EV_MSC) {
+            // the input core adds MSC events of its own, they carry nothing
             if (event->code == EVENT_TYPE_LIGHT) {
-                mPendingEvent.light = indexToValue(event->value);
+                mPendingValue = indexToValue(event->value);
             }
         } else if (type == EV_SYN) {
-            mPendingEvent.timestamp = timevalToNano(event->time);
-            if (mEnabled) {
-                *data++ = mPendingEvent;
+            if (mEnabled && filter(mPendingValue)) {
+                Event::stamp(data++, eventTimestamp(event->time))->light = mReported;
                 count--;
                 numEventReceived++;
             }
         } else {
-            if (type == 4 && event->code == 3) {
-                // weird, not sure why we're getting this all the time
-            } else {
-                LOGE("LightSensor: unknown event (type=%d, code=%d)",
-                        type, event->code);
-            }
+            LOGE("LightSensor: unknown event (type=%d, code=%d)",
+                    type, event->code);
         }
         mInputReader.next();
     }
@@ -117,5 +169,38 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
 
 float LightSensor::indexToValue(size_t index) const
 {
-    return float(index);
+    const float raw = float(index);
+    if (!mNumLuxPoints)
+        return raw;
+    LuxPoint const* const t(mLuxTable);
+    if (mNumLuxPoints == 1 || raw <= t[0].raw)
+        return raw * (t[0].lux / (t[0].raw > 0 ? t[0].raw : 1));
+    size_t i = 1;
+    while (i < mNumLuxPoints-1 && raw > t[i].raw)
+        i++;
+    // the last segment also extrapolates above the table
+    const float lux = t[i-1].lux +
+            (raw - t[i-1].raw) * (t[i].lux - t[i-1].lux) / (t[i].raw - t[i-1].raw);
+    return lux > 0 ? lux : 0;
+}
+
+/*
+ * Returns true if lux makes a new report, which is then in mReported.
+ */
+bool LightSensor::filter(float lux)
+{
+    if (mReported < 0) {
+        mFiltered = mReported = lux;
+        return true;
+    }
+    const float threshold = mReported * kHysteresis > kHysteresisFloor ?
+            mReported * kHysteresis : kHysteresisFloor;
+    if (fabsf(lux - mFiltered) > kStepFactor * threshold)
+        mFiltered = lux;
+    else
+        mFiltered += (lux - mFiltered) * 0.25f;
+    if (fabsf(mFiltered - mReported) < threshold)
+        return false;
+    mReported = mFiltered;
+    return true;
 }
@@ -30,19 +30,49 @@
 
 struct input_event;
 
+/*
+ * The MAX9635 reports every conversion whether the light changed or not,
+ * and the framework re-runs the backlight curve for each of them. Reports
+ * are on-change instead: samples are smoothed (steps, like a lamp being
+ * switched, go straight through) and only forwarded once they are a
+ * perceptible step away from the last value reported. Raw counts are
+ * mapped to lux through a piecewise linear table that can be set with
+ * ro.sensors.lux_table="raw:lux,raw:lux,...", e.g. for the cover glass.
+ */
 class LightSensor : public SensorBase {
+    typedef SensorEvent<ID_L, SENSOR_TYPE_LIGHT> Event;
+
+    enum { maxLuxPoints = 16 };
+
+    struct LuxPoint {
+        float raw;
+        float lux;
+    };
+
     int mEnabled;
     InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+    float mPendingValue;
     bool mHasPendingEvent;
 
+    LuxPoint mLuxTable[maxLuxPoints];
+    size_t mNumLuxPoints;
+    // smoothed lux, and the last value reported (< 0 if none since enable)
+    float mFiltered;
+    float mReported;
+
+    void loadLuxTable();
     float indexToValue(size_t index) const;
+    bool filter(float lux);
 
 public:
             LightSensor();
     virtual ~LightSensor();
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual InputEventCircularReader* getInputReader() {
+        return &mInputReader;
+    }
     virtual bool hasPendingEvents() const;
+    virtual void resume(int32_t handle);
     virtual int enable(int32_t handle, int enabled);
 };
 
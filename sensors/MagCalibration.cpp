@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/sensors.h>
+
+#include <cutils/log.h>
+
+#include "MagCalibration.h"
+
+/*****************************************************************************/
+
+// samples closer than this to the last one taken add nothing, in uT
+static const float kMinSeparation = 3.0f;
+// window fill before the first fit, and samples between two fits
+static const int kMinSamples = 24;
+static const int kFitInterval = 8;
+// what the earth's field can look like from in here, in uT
+static const float kMinRadius = 15.0f;
+static const float kMaxRadius = 100.0f;
+static const float kMaxScale = 1.5f;
+// hard iron beyond this is a broken file, the AK8975 reads +-1229 uT full scale
+static const float kMaxOffset = 1200.0f;
+// rms distance to the sphere relative to its radius, per accuracy level
+static const float kHighResidual = 0.03f;
+static const float kMediumResidual = 0.06f;
+static const float kMaxResidual = 0.10f;
+
+static const int kFileVersion = 1;
+
+MagCalibration::MagCalibration()
+{
+    reset();
+}
+
+void MagCalibration::reset()
+{
+    memset(mSamples, 0, sizeof(mSamples));
+    mHead = 0;
+    mCount = 0;
+    mSinceFit = 0;
+    memset(mAtA, 0, sizeof(mAtA));
+    memset(mAtb, 0, sizeof(mAtb));
+    mOffset[0] = mOffset[1] = mOffset[2] = 0;
+    mScale[0] = mScale[1] = mScale[2] = 1;
+    mRadius = 0;
+    mAccuracy = SENSOR_STATUS_UNRELIABLE;
+}
+
+void MagCalibration::accumulate(float const* v, double sign)
+{
+    const double phi[numTerms] = {
+        double(v[0])*v[0], double(v[1])*v[1], double(v[2])*v[2], v[0], v[1], v[2]
+    };
+    for (int i=0 ; i<numTerms ; i++) {
+        for (int j=i ; j<numTerms ; j++)
+            mAtA[i][j] += sign * phi[i] * phi[j];
+        mAtb[i] += sign * phi[i];
+    }
+}
+
+bool MagCalibration::handleSample(float const* v)
+{
+    if (mCount) {
+        float const* last = mSamples[(mHead + maxSamples - 1) % maxSamples];
+        const float dx = v[0] - last[0], dy = v[1] - last[1], dz = v[2] - last[2];
+        if (dx*dx + dy*dy + dz*dz < kMinSeparation * kMinSeparation)
+            return false;
+    }
+    if (mCount == maxSamples)
+        accumulate(mSamples[mHead], -1);
+    else
+        mCount++;
+    memcpy(mSamples[mHead], v, sizeof(mSamples[mHead]));
+    accumulate(v, 1);
+    mHead = (mHead + 1) % maxSamples;
+
+    if (mCount < kMinSamples || ++mSinceFit < kFitInterval)
+        return false;
+    mSinceFit = 0;
+    return fit();
+}
+
+bool MagCalibration::fit()
+{
+    // solve the normal equations, gaussian elimination + partial pivoting
+    double m[numTerms][numTerms + 1];
+    for (int i=0 ; i<numTerms ; i++) {
+        for (int j=0 ; j<numTerms ; j++)
+            m[i][j] = j >= i ? mAtA[i][j] : mAtA[j][i];
+        m[i][numTerms] = mAtb[i];
+    }
+    for (int c=0 ; c<numTerms ; c++) {
+        int pivot = c;
+        for (int r=c+1 ; r<numTerms ; r++) {
+            if (fabs(m[r][c]) > fabs(m[pivot][c]))
+                pivot = r;
+        }
+        if (fabs(m[pivot][c]) < 1e-12)
+            return false;
+        if (pivot != c) {
+            for (int j=c ; j<=numTerms ; j++) {
+                const double t = m[c][j];
+                m[c][j] = m[pivot][j];
+                m[pivot][j] = t;
+            }
+        }
+        for (int r=c+1 ; r<numTerms ; r++) {
+            const double f = m[r][c] / m[c][c];
+            for (int j=c ; j<=numTerms ; j++)
+                m[r][j] -= f * m[c][j];
+        }
+    }
+    double p[numTerms];
+    for (int i=numTerms-1 ; i>=0 ; i--) {
+        double s = m[i][numTerms];
+        for (int j=i+1 ; j<numTerms ; j++)
+            s -= m[i][j] * p[j];
+        p[i] = s / m[i][i];
+    }
+
+    if (p[0] <= 0 || p[1] <= 0 || p[2] <= 0)
+        return false;
+    float offset[3], scale[3], radii[3];
+    double g = 1;
+    for (int i=0 ; i<3 ; i++) {
+        const double c = -p[3+i] / (2 * p[i]);
+        offset[i] = float(c);
+        g += p[i] * c * c;
+    }
+    if (g <= 0)
+        return false;
+    for (int i=0 ; i<3 ; i++)
+        radii[i] = float(sqrt(g / p[i]));
+    const float radius = cbrtf(radii[0] * radii[1] * radii[2]);
+    // written so that a NaN fails them
+    if (!(radius >= kMinRadius && radius <= kMaxRadius))
+        return false;
+    for (int i=0 ; i<3 ; i++) {
+        scale[i] = radius / radii[i];
+        if (!(scale[i] <= kMaxScale && scale[i] >= 1 / kMaxScale))
+            return false;
+    }
+
+    // the window has to go around the sphere, and sit on it
+    float lo[3] = { radius*4, radius*4, radius*4 };
+    float hi[3] = { -radius*4, -radius*4, -radius*4 };
+    double sum = 0;
+    for (int k=0 ; k<mCount ; k++) {
+        float c[3];
+        for (int i=0 ; i<3 ; i++) {
+            c[i] = (mSamples[k][i] - offset[i]) * scale[i];
+            if (c[i] < lo[i]) lo[i] = c[i];
+            if (c[i] > hi[i]) hi[i] = c[i];
+        }
+        const float e = sqrtf(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]) - radius;
+        sum += e * e;
+    }
+    for (int i=0 ; i<3 ; i++) {
+        if (hi[i] - lo[i] < radius)
+            return false;
+    }
+    const float residual = sqrtf(float(sum / mCount)) / radius;
+    if (!(residual <= kMaxResidual))
+        return false;
+
+    memcpy(mOffset, offset, sizeof(mOffset));
+    memcpy(mScale, scale, sizeof(mScale));
+    mRadius = radius;
+    if (residual < kHighResidual)
+        mAccuracy = SENSOR_STATUS_ACCURACY_HIGH;
+    else if (residual < kMediumResidual)
+        mAccuracy = SENSOR_STATUS_ACCURACY_MEDIUM;
+    else
+        mAccuracy = SENSOR_STATUS_ACCURACY_LOW;
+    return true;
+}
+
+void MagCalibration::apply(float const* in, float* out) const
+{
+    out[0] = (in[0] - mOffset[0]) * mScale[0];
+    out[1] = (in[1] - mOffset[1]) * mScale[1];
+    out[2] = (in[2] - mOffset[2]) * mScale[2];
+}
+
+/*
+ * A saved calibration is only a good guess: the phone may have been put
+ * in a different case since. It starts at medium accuracy and gets
+ * replaced by the first fit of this session.
+ */
+bool MagCalibration::load(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    int version = 0;
+    float offset[3], scale[3], radius;
+    bool valid = fscanf(f, "%d %f %f %f %f %f %f %f", &version,
+            &offset[0], &offset[1], &offset[2],
+            &scale[0], &scale[1], &scale[2], &radius) == 8 &&
+            version == kFileVersion &&
+            radius >= kMinRadius && radius <= kMaxRadius;
+    fclose(f);
+    // the same bounds as a fit has to meet, written so that a NaN fails
+    for (int i=0 ; valid && i<3 ; i++) {
+        valid = fabsf(offset[i]) <= kMaxOffset &&
+                scale[i] <= kMaxScale && scale[i] >= 1 / kMaxScale;
+    }
+    if (!valid) {
+        LOGW("ignoring bad magnetometer calibration in %s", path);
+        return false;
+    }
+    memcpy(mOffset, offset, sizeof(mOffset));
+    memcpy(mScale, scale, sizeof(mScale));
+    mRadius = radius;
+    mAccuracy = SENSOR_STATUS_ACCURACY_MEDIUM;
+    return true;
+}
+
+int MagCalibration::save(const char* path) const
+{
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* f = fopen(temp, "w");
+    if (!f)
+        return -errno;
+    fprintf(f, "%d %f %f %f %f %f %f %f\n", kFileVersion,
+            mOffset[0], mOffset[1], mOffset[2],
+            mScale[0], mScale[1], mScale[2], mRadius);
+    // synced and renamed, see GyroCalibration::save()
+    bool ok = !fflush(f) && !fsync(fileno(f));
+    ok = !fclose(f) && ok;
+    if (!ok || rename(temp, path)) {
+        const int err = -errno;
+        unlink(temp);
+        return err;
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MAG_CALIBRATION_H
+#define ANDROID_MAG_CALIBRATION_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Hard and soft iron calibration of the magnetometer: a least squares fit
+ * of an axis-aligned ellipsoid A x^2 + B y^2 + C z^2 + D x + E y + F z = 1
+ * to the last maxSamples distinct samples. The normal equations are kept
+ * as running sums, so taking a sample in (and the oldest one out) costs
+ * the same whatever the window size; the 6x6 system is only solved
+ * every few samples. The result is an offset and a per-axis scale that
+ * map the ellipsoid back onto a sphere, plus an accuracy in the
+ * SENSOR_STATUS_ACCURACY_* scale.
+ */
+class MagCalibration
+{
+public:
+    enum { maxSamples = 64 };
+
+    MagCalibration();
+
+    void reset();
+    // one sample in uT, returns true if it produced a new calibration
+    bool handleSample(float const* v);
+    void apply(float const* in, float* out) const;
+
+    int getAccuracy() const { return mAccuracy; }
+    float const* getOffset() const { return mOffset; }
+
+    // warm start across reboots
+    bool load(const char* path);
+    int save(const char* path) const;
+
+private:
+    enum { numTerms = 6 };
+
+    float mSamples[maxSamples][3];
+    int mHead;
+    int mCount;
+    int mSinceFit;
+    // sum of phi.phi^T and of phi, phi = (x^2, y^2, z^2, x, y, z)
+    double mAtA[numTerms][numTerms];
+    double mAtb[numTerms];
+
+    float mOffset[3];
+    float mScale[3];
+    float mRadius;
+    int mAccuracy;
+
+    void accumulate(float const* v, double sign);
+    bool fit();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_MAG_CALIBRATION_H
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include "MotionDetector.h"
+
+/*****************************************************************************/
+
+// time constants of the gravity and step filters, in s
+static const float kGravityTau = 2.0f;
+static const float kSmoothTau = 0.04f;
+// step hysteresis on the smoothed signal, in m/s^2; nobody walks faster
+// than 4 steps/s
+static const float kStepHigh = 1.2f;
+static const float kStepLow = 0.4f;
+static const int64_t kMinStepInterval = 250000000LL;
+// a sample this far off gravity counts as activity, a run of activity
+// ends after kStillTime without any
+static const float kActivity = 0.6f;
+static const int64_t kStillTime = 1500000000LL;
+// a run is significant once it lasts this long or has this many steps
+static const int64_t kSignificantTime = 5000000000LL;
+static const uint32_t kSignificantSteps = 10;
+// longer gaps mean the accelerometer was off, start over
+static const int64_t kMaxGap = 500000000LL;
+
+MotionDetector::MotionDetector()
+{
+    reset();
+}
+
+void MotionDetector::reset()
+{
+    mGravity = 0;
+    mSmoothed = 0;
+    mLastTime = 0;
+    mArmed = false;
+    mLastStep = 0;
+    mActiveSince = 0;
+    mLastActive = 0;
+    mRunSteps = 0;
+}
+
+int MotionDetector::handleAccel(float const* v, int64_t timestamp)
+{
+    const float norm = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    const int64_t dt = timestamp - mLastTime;
+    mLastTime = timestamp;
+    if (!mGravity || dt <= 0 || dt > kMaxGap) {
+        mGravity = norm;
+        mSmoothed = 0;
+        mArmed = false;
+        mActiveSince = 0;
+        return None;
+    }
+
+    const float t = dt * 1e-9f;
+    mGravity += (norm - mGravity) * (t / (kGravityTau + t));
+    const float dev = norm - mGravity;
+    mSmoothed += (dev - mSmoothed) * (t / (kSmoothTau + t));
+
+    if (fabsf(dev) > kActivity) {
+        if (!mActiveSince) {
+            mActiveSince = timestamp;
+            mRunSteps = 0;
+        }
+        mLastActive = timestamp;
+    } else if (mActiveSince && timestamp - mLastActive > kStillTime) {
+        mActiveSince = 0;
+    }
+
+    int result = None;
+    if (mSmoothed < kStepLow) {
+        mArmed = true;
+    } else if (mArmed && mSmoothed > kStepHigh &&
+            timestamp - mLastStep >= kMinStepInterval) {
+        mArmed = false;
+        mLastStep = timestamp;
+        mRunSteps++;
+        result |= Step;
+    }
+
+    if (mActiveSince && (timestamp - mActiveSince >= kSignificantTime ||
+            mRunSteps >= kSignificantSteps)) {
+        result |= SignificantMotion;
+    }
+    return result;
+}
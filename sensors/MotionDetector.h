@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MOTION_DETECTOR_H
+#define ANDROID_MOTION_DETECTOR_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Step and significant motion detection on the magnitude of the
+ * acceleration, so the orientation of the device doesn't matter. A slow
+ * average of the magnitude tracks gravity; steps are the peaks of the
+ * low-passed remainder, with hysteresis. Significant motion is a run of
+ * activity that lasts long enough or has enough steps in it. Cheap enough
+ * to run on every accelerometer sample, and the filters are specified by
+ * time constant so any sampling rate from ~20 Hz up works.
+ */
+class MotionDetector
+{
+    float mGravity;         // slow average of |a|, 0 until the first sample
+    float mSmoothed;        // low-passed |a| - gravity
+    int64_t mLastTime;
+    bool mArmed;            // went back below the low threshold since the last step
+    int64_t mLastStep;
+    int64_t mActiveSince;   // start of the current run of activity, 0 if still
+    int64_t mLastActive;    // last sample above the activity threshold
+    uint32_t mRunSteps;     // steps in the current run
+
+public:
+    enum {
+        None                = 0,
+        Step                = 1,
+        SignificantMotion   = 2,
+    };
+
+    MotionDetector();
+
+    void reset();
+    // one accelerometer sample in m/s^2, returns what it completed
+    int handleAccel(float const* v, int64_t timestamp);
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_MOTION_DETECTOR_H
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <hardware_legacy/power.h>
+
+#include "MotionSensor.h"
+
+/*****************************************************************************/
+
+// a few seconds of steps between two poll() calls
+static const size_t kOutputEvents = 32;
+
+// significant motion only needs the gross movement, steps need up to
+// ~3 Hz of it
+static const int64_t kMotionPeriod = 100000000LL;
+static const int64_t kStepPeriod = 40000000LL;
+
+static const char kWakeLockName[] = "sensors_motion";
+
+MotionSensor::MotionSensor()
+    : SensorBase(NULL, NULL),
+      mEnabled(0),
+      mOutput(kOutputEvents),
+      mSteps(0),
+      mTriggered(false),
+      mWakeLocked(false)
+{
+}
+
+MotionSensor::~MotionSensor() {
+    releaseWakeLock();
+}
+
+int MotionSensor::enable(int32_t handle, int en)
+{
+    int what = -1;
+    switch (handle) {
+        case ID_SM: what = SignificantMotion; break;
+        case ID_SD: what = StepDetector;      break;
+        case ID_SC: what = StepCounter;       break;
+    }
+
+    if (uint32_t(what) >= numSensors)
+        return -EINVAL;
+
+    const uint32_t wasEnabled = mEnabled;
+    if (en)
+        mEnabled |= 1<<what;
+    else
+        mEnabled &= ~(1<<what);
+    if (!wasEnabled && mEnabled) {
+        // the accelerometer may have been off while we were
+        mDetector.reset();
+    }
+    return 0;
+}
+
+/*
+ * These only report when something happened, there is no rate to set.
+ */
+int MotionSensor::setDelay(int32_t, int64_t ns)
+{
+    return ns < 0 ? -EINVAL : 0;
+}
+
+int64_t MotionSensor::getInputPeriod() const
+{
+    if (mEnabled & ((1<<StepDetector) | (1<<StepCounter)))
+        return kStepPeriod;
+    return kMotionPeriod;
+}
+
+bool MotionSensor::hasPendingEvents() const {
+    return !mOutput.empty();
+}
+
+int MotionSensor::readEvents(sensors_event_t* data, int count)
+{
+    if (count < 1)
+        return -EINVAL;
+    return mOutput.drain(data, count);
+}
+
+sensors_event_t* MotionSensor::slot()
+{
+    sensors_event_t* ev;
+    if (!mOutput.writable(&ev))
+        return NULL;
+    memset(ev->data, 0, sizeof(ev->data));
+    return ev;
+}
+
+void MotionSensor::process(sensors_event_t const* events, int count)
+{
+    if (!mEnabled)
+        return;
+    for (int i=0 ; i<count ; i++) {
+        sensors_event_t const& ev(events[i]);
+        if (ev.type != SENSOR_TYPE_ACCELEROMETER)
+            continue;
+        const int result = mDetector.handleAccel(ev.acceleration.v, ev.timestamp);
+        sensors_event_t* out;
+        if ((result & MotionDetector::Step) && (mEnabled & (1<<StepDetector)) &&
+                (out = slot())) {
+            StepDetectorEvent::stamp(out, ev.timestamp);
+            out->data[0] = 1.0f;
+            mOutput.commit(1, ev.timestamp);
+        }
+        if ((result & MotionDetector::Step) && (mEnabled & (1<<StepCounter))) {
+            mSteps++;
+            if ((out = slot())) {
+                // as a uint64_t over data[0..1], like later releases
+                StepCounterEvent::stamp(out, ev.timestamp);
+                memcpy(out->data, &mSteps, sizeof(mSteps));
+                mOutput.commit(1, ev.timestamp);
+            }
+        }
+        if ((result & MotionDetector::SignificantMotion) &&
+                (mEnabled & (1<<SignificantMotion)) && (out = slot())) {
+            SignificantMotionEvent::stamp(out, ev.timestamp);
+            out->data[0] = 1.0f;
+            mOutput.commit(1, ev.timestamp);
+            mEnabled &= ~(1<<SignificantMotion);
+            mTriggered = true;
+            // keep the AP up until poll() returned the event
+            if (!mWakeLocked) {
+                int err = acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakeLockName);
+                LOGE_IF(err < 0, "Couldn't acquire %s", kWakeLockName);
+                mWakeLocked = true;
+            }
+        }
+    }
+}
+
+bool MotionSensor::takeTriggered()
+{
+    const bool triggered = mTriggered;
+    mTriggered = false;
+    return triggered;
+}
+
+void MotionSensor::releaseWakeLock()
+{
+    if (mWakeLocked) {
+        release_wake_lock(kWakeLockName);
+        mWakeLocked = false;
+    }
+}
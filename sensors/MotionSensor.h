@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MOTION_SENSOR_H
+#define ANDROID_MOTION_SENSOR_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "MotionDetector.h"
+#include "BatchBuffer.h"
+
+/*****************************************************************************/
+
+/*
+ * Virtual driver for the significant motion, step detector and step
+ * counter sensors. Like FusionSensor it has no fd of its own; the poll
+ * context feeds it the accelerometer stream, at the reduced rate
+ * getInputPeriod() asks for rather than whatever apps would pick.
+ * Significant motion is one-shot: it disarms itself once it fired, and
+ * holds a wake lock until the framework came back for the event.
+ */
+class MotionSensor : public SensorBase {
+public:
+            MotionSensor();
+    virtual ~MotionSensor();
+
+    enum {
+        SignificantMotion   = 0,
+        StepDetector        = 1,
+        StepCounter         = 2,
+        numSensors
+    };
+
+    virtual int enable(int32_t handle, int enabled);
+    virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+
+    bool isEnabled() const { return mEnabled != 0; }
+    // accelerometer period the detector needs
+    int64_t getInputPeriod() const;
+    void process(sensors_event_t const* events, int count);
+
+    // true once after significant motion fired and disarmed itself
+    bool takeTriggered();
+    void releaseWakeLock();
+
+private:
+    typedef SensorEvent<ID_SM, SENSOR_TYPE_SIGNIFICANT_MOTION> SignificantMotionEvent;
+    typedef SensorEvent<ID_SD, SENSOR_TYPE_STEP_DETECTOR> StepDetectorEvent;
+    typedef SensorEvent<ID_SC, SENSOR_TYPE_STEP_COUNTER> StepCounterEvent;
+
+    uint32_t mEnabled;
+    MotionDetector mDetector;
+    BatchBuffer mOutput;
+    // steps since boot while the counter was enabled
+    uint64_t mSteps;
+    bool mTriggered;
+    bool mWakeLocked;
+
+    sensors_event_t* slot();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_MOTION_SENSOR_H
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "PowerManager.h"
+
+/*****************************************************************************/
+
+PowerManager::PowerManager()
+    : mHoldTime(0), mIdleTimeout(0), mLingering(0),
+      mClient(0), mThread(0), mPolling(0), mLastConsumed(0), mIdle(0)
+{
+    memset(mDeadlines, 0, sizeof(mDeadlines));
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.power_hold", value, "1000");
+    mHoldTime = int64_t(atoi(value)) * 1000000LL;
+    property_get("ro.sensors.idle_timeout", value, "10000");
+    mIdleTimeout = int64_t(atoi(value)) * 1000000LL;
+}
+
+PowerManager::~PowerManager()
+{
+}
+
+/*
+ * The watchdog is detached for the life of the process, like the screen
+ * state thread; it only ever reads our fields and calls the client.
+ */
+int PowerManager::start(Client* client)
+{
+    mClient = client;
+    mLastConsumed = nowMs();
+    if (mIdleTimeout <= 0)
+        return 0;
+    if (pthread_create(&mThread, NULL, watchdogThread, this)) {
+        mThread = 0;
+        return -errno;
+    }
+    return 0;
+}
+
+void PowerManager::linger(int handle, int64_t now)
+{
+    if (uint32_t(handle) >= maxHandles)
+        return;
+    mLingering |= 1<<handle;
+    mDeadlines[handle] = now + mHoldTime;
+}
+
+bool PowerManager::resume(int handle)
+{
+    if (!isLingering(handle))
+        return false;
+    mLingering &= ~(1<<handle);
+    return true;
+}
+
+uint32_t PowerManager::expired(int64_t now) const
+{
+    uint32_t mask = 0;
+    for (int h=0 ; h<maxHandles ; h++) {
+        if ((mLingering & (1<<h)) && now >= mDeadlines[h])
+            mask |= 1<<h;
+    }
+    return mask;
+}
+
+int64_t PowerManager::nextDeadline() const
+{
+    int64_t deadline = 0;
+    for (int h=0 ; h<maxHandles ; h++) {
+        if ((mLingering & (1<<h)) && (!deadline || mDeadlines[h] < deadline))
+            deadline = mDeadlines[h];
+    }
+    return deadline;
+}
+
+void PowerManager::pollStarted()
+{
+    android_atomic_release_store(1, &mPolling);
+    if (android_atomic_acquire_load(&mIdle)) {
+        android_atomic_release_store(0, &mIdle);
+        mClient->onIdle(false);
+    }
+}
+
+void PowerManager::pollReturned()
+{
+    android_atomic_release_store(nowMs(), &mLastConsumed);
+    android_atomic_release_store(0, &mPolling);
+}
+
+void* PowerManager::watchdogThread(void* arg)
+{
+    PowerManager* const pm(static_cast<PowerManager*>(arg));
+    const int32_t timeout = int32_t(pm->mIdleTimeout / 1000000LL);
+    pthread_detach(pthread_self());
+    while (true) {
+        struct timespec half;
+        half.tv_sec = timeout / 2000;
+        half.tv_nsec = (timeout / 2 % 1000) * 1000000L;
+        nanosleep(&half, NULL);
+        if (android_atomic_acquire_load(&pm->mPolling) ||
+                android_atomic_acquire_load(&pm->mIdle))
+            continue;
+        // ms on CLOCK_MONOTONIC in an int32, the difference is what counts
+        const int32_t idle = nowMs() - android_atomic_acquire_load(&pm->mLastConsumed);
+        if (idle >= timeout) {
+            LOGI("no sensor events consumed for %d ms, going idle", idle);
+            android_atomic_release_store(1, &pm->mIdle);
+            pm->mClient->onIdle(true);
+        }
+    }
+    return NULL;
+}
+
+int32_t PowerManager::nowMs()
+{
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int32_t(int64_t(t.tv_sec)*1000LL + t.tv_nsec/1000000);
+}
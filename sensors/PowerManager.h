@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_POWER_MANAGER_H
+#define ANDROID_POWER_MANAGER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Power policy of the poll context, on top of the drivers' own on/off
+ * switching:
+ *  - a disabled handle lingers for ro.sensors.power_hold ms (default
+ *    1000) before its driver is really switched off, so an app toggling
+ *    a listener doesn't reopen the device and re-run its enable ioctl
+ *    every time;
+ *  - if nobody consumes events (no poll() in progress and none returned)
+ *    for ro.sensors.idle_timeout ms (default 10000, 0 disables it), the
+ *    client is told to go idle and caps every driver at a low rate until
+ *    poll() is called again.
+ */
+class PowerManager
+{
+public:
+    class Client {
+    public:
+        virtual ~Client() { }
+        // called from the watchdog thread (idle) or the poll thread (not)
+        virtual void onIdle(bool idle) = 0;
+    };
+
+    // period idle drivers are capped at (SENSOR_DELAY_NORMAL)
+    static const int64_t kIdlePeriod = 200000000LL;
+
+    PowerManager();
+    ~PowerManager();
+
+    int start(Client* client);
+
+    // lingering handles, all of these only on the poll context's lock
+    bool holds() const { return mHoldTime > 0; }
+    void linger(int handle, int64_t now);
+    bool resume(int handle);
+    bool isLingering(int handle) const { return mLingering & (1<<handle); }
+    // handles whose hold time is over, and the next time one will be
+    uint32_t expired(int64_t now) const;
+    int64_t nextDeadline() const;
+    void clear(int handle) { mLingering &= ~(1<<handle); }
+
+    // poll() bookkeeping, poll thread only
+    void pollStarted();
+    void pollReturned();
+    bool isIdle() const { return mIdle; }
+
+private:
+    enum { maxHandles = 32 };
+
+    int64_t mHoldTime;
+    int64_t mIdleTimeout;
+    uint32_t mLingering;
+    int64_t mDeadlines[maxHandles];
+
+    Client* mClient;
+    pthread_t mThread;
+    volatile int32_t mPolling;
+    volatile int32_t mLastConsumed;     // CLOCK_MONOTONIC, in ms
+    volatile int32_t mIdle;
+
+    static void* watchdogThread(void* arg);
+    static int32_t nowMs();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_POWER_MANAGER_H
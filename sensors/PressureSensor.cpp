@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <math.h>
 #include <poll.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/select.h>
@@ -26,20 +27,47 @@
 #include <linux/bmp085.h>
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "PressureSensor.h"
 
 /*****************************************************************************/
 
+// standard atmosphere at sea level, in hPa
+static const float kSeaLevel = 1013.25f;
+// how far the pressure may move from the altitude reference, in hPa; the
+// linearization error over that is well under a centimeter
+static const float kAltRefRange = 1.0f;
+
+static const DecoderChannel sChannels[] = {
+    { EVENT_TYPE_PRESSURE, 0, DecoderChannel::AXIS_X, CONVERT_B },
+};
+
 PressureSensor::PressureSensor()
     : SensorBase(BAROMETER_DEVICE_NAME, "barometer"),
       mEnabled(0),
-      mInputReader(32)
+      mInputReader(InputEventCircularReader::sizeForRate(
+              MIN_DELAY_B * 1000LL, frameEvents)),
+      mDecoder(sChannels),
+      mFrameHeld(false),
+      mIirWeight(1),
+      mStep(0),
+      mOversampling(-1),
+      mFiltered(0),
+      mReported(-1),
+      mAltRefPressure(0),
+      mAltRefHeight(0),
+      mAltSlope(0)
 {
-    mPendingEvent.version = sizeof(sensors_event_t);
-    mPendingEvent.sensor = ID_B;
-    mPendingEvent.type = SENSOR_TYPE_PRESSURE;
-    memset(mPendingEvent.data, 0x00, sizeof(mPendingEvent.data));
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.pressure_iir", value, "4");
+    int n = atoi(value);
+    mIirWeight = n > 1 ? 1.0f / n : 1.0f;
+    property_get("ro.sensors.pressure_step", value, "5");
+    mStep = atoi(value) * CONVERT_B;
+    property_get("ro.sensors.pressure_oss", value, "");
+    if (value[0])
+        mOversampling = atoi(value);
 
     open_device();
 
@@ -48,9 +76,9 @@ PressureSensor::PressureSensor()
     int flags = 0;
     if (!ioctl(dev_fd, BMP085_IOCTL_GET_ENABLE, &flags)) {
         if (flags)  {
-            mEnabled = 1;
+            mEnabled = 1<<Pressure;
             if (!ioctl(data_fd, EVIOCGABS(EVENT_TYPE_PRESSURE), &absinfo)) {
-                mPendingEvent.pressure = absinfo.value * CONVERT_B;
+                mDecoder.process(EVENT_TYPE_PRESSURE, absinfo.value);
             }
         }
     }
@@ -62,32 +90,53 @@ PressureSensor::PressureSensor()
 PressureSensor::~PressureSensor() {
 }
 
-int PressureSensor::enable(int32_t, int en)
+int PressureSensor::enable(int32_t handle, int en)
 {
-    int flags = en ? 1 : 0;
+    int what = -1;
+    switch (handle) {
+        case ID_B:   what = Pressure; break;
+        case ID_ALT: what = Altitude; break;
+    }
+
+    if (uint32_t(what) >= numSensors)
+        return -EINVAL;
+
+    uint32_t enabled = mEnabled;
+    if (en)
+        enabled |= 1<<what;
+    else
+        enabled &= ~(1<<what);
     int err = 0;
-    if (flags != mEnabled) {
+    if (!enabled != !mEnabled) {
+        int flags = enabled ? 1 : 0;
         if (flags) {
             open_device();
+#ifdef BMP085_IOCTL_SET_OSS
+            if (mOversampling >= 0 &&
+                    ioctl(dev_fd, BMP085_IOCTL_SET_OSS, &mOversampling)) {
+                LOGE("BMP085_IOCTL_SET_OSS failed (%s)", strerror(errno));
+            }
+#endif
         }
         err = ioctl(dev_fd, BMP085_IOCTL_SET_ENABLE, &flags);
         err = err<0 ? -errno : 0;
         LOGE_IF(err, "BMP085_IOCTL_SET_ENABLE failed (%s)", strerror(-err));
-        if (!err) {
-            mEnabled = flags;
-        }
         if (!flags) {
             close_device();
         }
     }
+    if (!err) {
+        if (enabled & ~mEnabled) {
+            // a new listener gets the current value straight away
+            mReported = -1;
+        }
+        mEnabled = enabled;
+    }
     return err;
 }
 
-int PressureSensor::setDelay(int32_t handle, int64_t ns)
+int PressureSensor::setHardwareDelay(int64_t ns)
 {
-    if (ns < 0)
-        return -EINVAL;
-
     int delay = ns / 1000000;
     if (ioctl(dev_fd, BMP085_IOCTL_SET_DELAY, &delay)) {
         return -errno;
@@ -95,10 +144,21 @@ int PressureSensor::setDelay(int32_t handle, int64_t ns)
     return 0;
 }
 
+// like enable(), the next frame goes out whether it moved or not
+void PressureSensor::resume(int32_t) {
+    mReported = -1;
+}
+
+// a frame without the room for both outputs waits in mInputReader
+bool PressureSensor::hasPendingEvents() const {
+    return mFrameHeld;
+}
+
 int PressureSensor::readEvents(sensors_event_t* data, int count)
 {
     if (count < 1)
         return -EINVAL;
+    mFrameHeld = false;
 
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
@@ -111,12 +171,25 @@ int PressureSensor::readEvents(sensors_event_t* data, int count)
         if (type == EV_ABS) {
             processEvent(event->code, event->value);
         } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-            mPendingEvent.timestamp = time;
-            if (mEnabled) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
+            // one slot per output, we come back to this frame otherwise
+            const int outputs = ((mEnabled >> Pressure) & 1) +
+                    ((mEnabled >> Altitude) & 1);
+            if (count < outputs) {
+                mFrameHeld = true;
+                break;
+            }
+            int64_t time = eventTimestamp(event->time);
+            if (mEnabled && filter(mDecoder.value(0))) {
+                if (mEnabled & (1<<Pressure)) {
+                    Event::stamp(data++, time)->pressure = mReported;
+                    count--;
+                    numEventReceived++;
+                }
+                if (mEnabled & (1<<Altitude)) {
+                    AltitudeEvent::stamp(data++, time)->data[0] = altitude(mReported);
+                    count--;
+                    numEventReceived++;
+                }
             }
         } else {
             LOGE("PressureSensor: unknown event (type=%d, code=%d)",
@@ -130,7 +203,38 @@ int PressureSensor::readEvents(sensors_event_t* data, int count)
 
 void PressureSensor::processEvent(int code, int value)
 {
-    if (code == EVENT_TYPE_PRESSURE) {
-            mPendingEvent.pressure = value * CONVERT_B;
+    mDecoder.process(code, value);
+}
+
+/*
+ * Returns true if the sample makes a new report, which is then in
+ * mReported.
+ */
+bool PressureSensor::filter(float pressure)
+{
+    if (mReported < 0) {
+        mFiltered = mReported = pressure;
+        return true;
+    }
+    mFiltered += (pressure - mFiltered) * mIirWeight;
+    if (fabsf(mFiltered - mReported) < mStep)
+        return false;
+    mReported = mFiltered;
+    return true;
+}
+
+/*
+ * h = 44330 * (1 - (p/p0)^(1/5.255)), the international barometric
+ * formula. powf() only runs when the pressure left the range around the
+ * last reference point, otherwise it's a multiply-add on the derivative.
+ */
+float PressureSensor::altitude(float pressure)
+{
+    if (!mAltRefPressure || fabsf(pressure - mAltRefPressure) > kAltRefRange) {
+        const float r = powf(pressure / kSeaLevel, 1 / 5.255f);
+        mAltRefPressure = pressure;
+        mAltRefHeight = 44330.0f * (1 - r);
+        mAltSlope = -44330.0f * r / (5.255f * pressure);
     }
+    return mAltRefHeight + (pressure - mAltRefPressure) * mAltSlope;
 }
@@ -27,24 +27,69 @@
 #include "nusensors.h"
 #include "SensorBase.h"
 #include "InputEventReader.h"
+#include "EventDecoder.h"
 
 /*****************************************************************************/
 
 struct input_event;
 
+/*
+ * BMP085 barometer, and the altitude derived from it. Samples go through
+ * an IIR filter (ro.sensors.pressure_iir, the 1/N weight of a new sample,
+ * default 4) and are only reported once the filtered value moved by
+ * ro.sensors.pressure_step Pa (default 5), so a device sitting on a desk
+ * stops sending the same pressure over and over. ro.sensors.pressure_oss
+ * picks the chip's oversampling mode, where the kernel driver has it.
+ */
 class PressureSensor : public SensorBase {
-    int mEnabled;
+    typedef SensorEvent<ID_B, SENSOR_TYPE_PRESSURE> Event;
+    typedef SensorEvent<ID_ALT, SENSOR_TYPE_ALTITUDE> AltitudeEvent;
+
+    enum {
+        Pressure    = 0,
+        Altitude    = 1,
+        numSensors
+    };
+
+    uint32_t mEnabled;
+    // input events per sample, at most
+    enum { frameEvents = 2 };
     InputEventCircularReader mInputReader;
-    sensors_event_t mPendingEvent;
+    EventDecoder<1> mDecoder;
+    // a SYN frame left in mInputReader for lack of room, see readEvents()
+    bool mFrameHeld;
+
+    // filter settings and state, in hPa
+    float mIirWeight;
+    float mStep;
+    int mOversampling;
+    float mFiltered;
+    float mReported;    // < 0 until the first report since enable
+
+    // altitude is exact at the reference pressure and linear around it
+    float mAltRefPressure;
+    float mAltRefHeight;
+    float mAltSlope;
+
+    bool filter(float pressure);
+    float altitude(float pressure);
 
 public:
             PressureSensor();
     virtual ~PressureSensor();
 
-    virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
+    virtual void resume(int32_t handle);
+    virtual InputEventCircularReader* getInputReader() {
+        return &mInputReader;
+    }
+    virtual size_t getFrameEvents() const { return frameEvents; }
     void processEvent(int code, int value);
+
+protected:
+    virtual int setHardwareDelay(int64_t ns);
 };
 
 /*****************************************************************************/
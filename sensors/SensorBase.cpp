@@ -27,19 +27,36 @@
 #include <linux/input.h>
 
 #include "SensorBase.h"
+#include "BatchBuffer.h"
+#include "InputDeviceIndex.h"
 
 /*****************************************************************************/
 
+// room for ~2.5s of a 200Hz sensor
+static const size_t kBatchCapacity = 512;
+
+// how long a realtime->monotonic offset is trusted before re-sampling it
+static const int64_t kClockOffsetLifetime = 1000000000LL;
+
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID               _IOW('E', 0xa0, int)
+#endif
+
 SensorBase::SensorBase(
         const char* dev_name,
         const char* data_name)
     : dev_name(dev_name), data_name(data_name),
-      dev_fd(-1), data_fd(-1)
+      dev_fd(-1), data_fd(-1),
+      mMaxLatency(0), mBatch(0), mDevicePeriod(0), mRateCap(0)
 {
-    data_fd = openInput(data_name);
+    // virtual drivers have no input device
+    if (data_name)
+        data_fd = openInput(data_name);
+    initTimestamps();
 }
 
 SensorBase::~SensorBase() {
+    delete mBatch;
     if (data_fd >= 0) {
         close(data_fd);
     }
@@ -52,6 +69,8 @@ int SensorBase::open_device() {
     if (dev_fd<0 && dev_name) {
         dev_fd = open(dev_name, O_RDONLY);
         LOGE_IF(dev_fd<0, "Couldn't open %s (%s)", dev_name, strerror(errno));
+        // whatever was requested while the device was closed
+        applyDelay();
     }
     return 0;
 }
@@ -60,15 +79,100 @@ int SensorBase::close_device() {
     if (dev_fd >= 0) {
         close(dev_fd);
         dev_fd = -1;
+        mDevicePeriod = 0;
     }
     return 0;
 }
 
+int SensorBase::attachInput() {
+    if (data_fd >= 0 || !data_name)
+        return 0;
+    data_fd = openInput(data_name);
+    if (data_fd < 0)
+        return -ENODEV;
+    // a new node starts a new stream, but don't let time go backwards
+    const int64_t last = mLastTimestamp;
+    initTimestamps();
+    mLastTimestamp = last;
+    return 0;
+}
+
+void SensorBase::detachInput() {
+    if (data_fd >= 0) {
+        close(data_fd);
+        data_fd = -1;
+    }
+}
+
 int SensorBase::getFd() const {
     return data_fd;
 }
 
 int SensorBase::setDelay(int32_t handle, int64_t ns) {
+    if (ns < 0)
+        return -EINVAL;
+    mRates.setPeriod(handle, ns);
+    return applyDelay();
+}
+
+/*
+ * Called by the poll context once a handle is running (or stopped), so its
+ * rate starts (or stops) counting.
+ */
+void SensorBase::setActive(int32_t handle, int active) {
+    if (active)
+        mRates.acquire(handle);
+    else
+        mRates.release(handle);
+    applyDelay();
+}
+
+/*
+ * Rate requests of in-HAL consumers (the fusion engine, direct channels),
+ * arbitrated with the handles' own. They never switch the device on.
+ */
+int SensorBase::setClientDelay(int client, int active, int64_t ns) {
+    if (ns < 0)
+        return -EINVAL;
+    mRates.setPeriod(client, ns);
+    if (active)
+        mRates.acquire(client);
+    else
+        mRates.release(client);
+    return applyDelay();
+}
+
+/*
+ * A cap overrides the requests, e.g. while the power manager found that
+ * nobody is consuming events.
+ */
+int SensorBase::setRateCap(int64_t ns) {
+    mRateCap = ns;
+    return applyDelay();
+}
+
+int SensorBase::applyDelay(bool force) {
+    int64_t ns = mRates.getDevicePeriod();
+    if (mRateCap && ns && ns < mRateCap)
+        ns = mRateCap;
+    if (dev_fd < 0 || !ns || (ns == mDevicePeriod && !force))
+        return 0;
+    int err = setHardwareDelay(ns);
+    mDevicePeriod = err ? 0 : ns;
+    return err;
+}
+
+int SensorBase::setHardwareDelay(int64_t ns) {
+    return 0;
+}
+
+int SensorBase::batch(int32_t handle, int64_t ns) {
+    if (ns < 0)
+        return -EINVAL;
+    if (ns && !mBatch) {
+        mBatch = new BatchBuffer(kBatchCapacity);
+    }
+    mMaxLatency = ns;
     return 0;
 }
 
@@ -76,6 +180,18 @@ bool SensorBase::hasPendingEvents() const {
     return false;
 }
 
+void SensorBase::resume(int32_t) {
+}
+
+// a value and its SYN_REPORT
+size_t SensorBase::getFrameEvents() const {
+    return 2;
+}
+
+InputEventCircularReader* SensorBase::getInputReader() {
+    return NULL;
+}
+
 int64_t SensorBase::getTimestamp() {
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
@@ -83,40 +199,82 @@ int64_t SensorBase::getTimestamp() {
     return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
 }
 
-int SensorBase::openInput(const char* inputName) {
-    int fd = -1;
-    const char *dirname = "/dev/input";
-    char devname[PATH_MAX];
-    char *filename;
-    DIR *dir;
-    struct dirent *de;
-    dir = opendir(dirname);
-    if(dir == NULL)
-        return -1;
-    strcpy(devname, dirname);
-    filename = devname + strlen(devname);
-    *filename++ = '/';
-    while((de = readdir(dir))) {
-        if(de->d_name[0] == '.' &&
-                (de->d_name[1] == '\0' ||
-                        (de->d_name[1] == '.' && de->d_name[2] == '\0')))
-            continue;
-        strcpy(filename, de->d_name);
-        fd = open(devname, O_RDONLY);
-        if (fd>=0) {
-            char name[80];
-            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), &name) < 1) {
-                name[0] = '\0';
-            }
-            if (!strcmp(name, inputName)) {
-                break;
+int64_t SensorBase::getRealtime() {
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+/*
+ * evdev stamps events with gettimeofday() unless told otherwise, while
+ * everything else in the HAL (and the framework) runs on CLOCK_MONOTONIC.
+ * Ask the kernel for monotonic stamps; older kernels don't know the ioctl
+ * and we fall back to translating with a periodically re-sampled offset.
+ */
+void SensorBase::initTimestamps() {
+    mMonotonicClock = false;
+    mClockOffset = 0;
+    mClockOffsetAge = 0;
+    mLastRawTimestamp = 0;
+    mLastTimestamp = 0;
+    mPeriod = 0;
+    mJitter = 0;
+    if (data_fd >= 0) {
+        int clk = CLOCK_MONOTONIC;
+        mMonotonicClock = !ioctl(data_fd, EVIOCSCLOCKID, &clk);
+        LOGD_IF(!mMonotonicClock, "%s: no EVIOCSCLOCKID, using offset model",
+                data_name);
+    }
+}
+
+/*
+ * Timestamp of an EV_SYN frame on CLOCK_MONOTONIC. Also tracks the sample
+ * period and jitter, and while batching (when events are read in bursts
+ * long after the fact) smooths the stream towards the expected period.
+ * The result is always strictly increasing per driver.
+ */
+int64_t SensorBase::eventTimestamp(timeval const& t) {
+    int64_t time = timevalToNano(t);
+    if (time == mLastRawTimestamp && mLastTimestamp) {
+        // same frame revisited (a reader that ran out of room mid-frame)
+        return mLastTimestamp;
+    }
+    mLastRawTimestamp = time;
+    if (!mMonotonicClock) {
+        if (!mClockOffsetAge || time - mClockOffsetAge > kClockOffsetLifetime ||
+                time < mClockOffsetAge) {
+            mClockOffset = getTimestamp() - getRealtime();
+            mClockOffsetAge = time;
+        }
+        time += mClockOffset;
+    }
+
+    if (mLastTimestamp) {
+        const int64_t delta = time - mLastTimestamp;
+        if (delta > 0) {
+            if (!mPeriod) {
+                mPeriod = delta;
             } else {
-                close(fd);
-                fd = -1;
+                // 1/16 EWMAs, cheap enough to run on every sample
+                const int64_t error = delta - mPeriod;
+                mPeriod += error / 16;
+                mJitter += ((error < 0 ? -error : error) - mJitter) / 16;
             }
         }
+        if (mMaxLatency && mPeriod) {
+            const int64_t expected = mLastTimestamp + mPeriod;
+            const int64_t error = time - expected;
+            if ((error < 0 ? -error : error) <= 4 * mJitter + mPeriod / 4)
+                time = expected + error / 4;
+        }
+        if (time <= mLastTimestamp)
+            time = mLastTimestamp + 1;
     }
-    closedir(dir);
-    LOGE_IF(fd<0, "couldn't find '%s' input device", inputName);
-    return fd;
+    mLastTimestamp = time;
+    return time;
+}
+
+int SensorBase::openInput(const char* inputName) {
+    return InputDeviceIndex::open(inputName);
 }
@@ -22,10 +22,35 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <hardware/sensors.h>
+
+#include "SensorStats.h"
+#include "SharedSource.h"
 
 /*****************************************************************************/
 
-struct sensors_event_t;
+class BatchBuffer;
+class InputEventCircularReader;
+
+/*
+ * Everything in the header of an event a driver emits is a compile-time
+ * constant, so drivers stamp it straight into the caller's slot and only
+ * write their payload after it, instead of copying a whole pre-built
+ * sensors_event_t (most of which is an unused union).
+ */
+template <int32_t SENSOR, int32_t TYPE>
+struct SensorEvent {
+    enum { sensor = SENSOR, type = TYPE };
+
+    static inline sensors_event_t* stamp(sensors_event_t* ev, int64_t timestamp) {
+        ev->version = sizeof(sensors_event_t);
+        ev->sensor = SENSOR;
+        ev->type = TYPE;
+        ev->reserved0 = 0;
+        ev->timestamp = timestamp;
+        return ev;
+    }
+};
 
 class SensorBase {
 protected:
@@ -33,19 +58,54 @@ protected:
     const char* data_name;
     int         dev_fd;
     int         data_fd;
+    int64_t     mMaxLatency;
+    BatchBuffer* mBatch;
+
+    // requested periods of the handles and in-HAL clients of this driver,
+    // and the one last programmed (0 while the device is closed)
+    SharedSource mRates;
+    int64_t     mDevicePeriod;
+    // slowest the device may be clocked at regardless, 0 if none
+    int64_t     mRateCap;
+
+    SensorStats mStats;
+
+    // timestamp model, see eventTimestamp()
+    bool        mMonotonicClock;
+    int64_t     mClockOffset;
+    int64_t     mClockOffsetAge;
+    int64_t     mLastRawTimestamp;
+    int64_t     mLastTimestamp;
+    int64_t     mPeriod;
+    int64_t     mJitter;
 
     static int openInput(const char* inputName);
     static int64_t getTimestamp();
+    static int64_t getRealtime();
 
 
     static int64_t timevalToNano(timeval const& t) {
         return t.tv_sec*1000000000LL + t.tv_usec*1000;
     }
 
+    void initTimestamps();
+    int64_t eventTimestamp(timeval const& t);
+
     int open_device();
     int close_device();
 
+    // program the device with the fastest requested period, if it changed
+    int applyDelay(bool force = false);
+    virtual int setHardwareDelay(int64_t ns);
+
 public:
+    // in-HAL consumers competing with the framework handles for the rate
+    enum {
+        CLIENT_MOTION   = 29,
+        CLIENT_FUSION   = 30,
+        CLIENT_DIRECT   = 31,
+    };
+
             SensorBase(
                     const char* dev_name,
                     const char* data_name);
@@ -54,9 +114,44 @@ public:
 
     virtual int readEvents(sensors_event_t* data, int count) = 0;
     virtual bool hasPendingEvents() const;
+
+    // instrumentation, see sensors_poll_context_t::dump()
+    const char* getName() const { return data_name ? data_name : "virtual"; }
+    SensorStats& getStats() { return mStats; }
+    virtual InputEventCircularReader* getInputReader();
     virtual int getFd() const;
     virtual int setDelay(int32_t handle, int64_t ns);
+    virtual int batch(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled) = 0;
+    // the handle came back within its power hold time, so enable() didn't
+    // run: a driver reporting on change re-arms its first report here
+    virtual void resume(int32_t handle);
+    // input events a sample takes in the evdev client queue, which bounds
+    // how long a parked driver can be left alone
+    virtual size_t getFrameEvents() const;
+
+    // input nodes come and go with the drivers that create them (a late
+    // probe, a module reload); the poll context re-attaches them
+    bool hasInput() const { return data_fd >= 0; }
+    int attachInput();
+    void detachInput();
+
+    void setActive(int32_t handle, int active);
+    int setClientDelay(int client, int active, int64_t ns);
+    int setRateCap(int64_t ns);
+    int64_t getDevicePeriod() const { return mRates.getDevicePeriod(); }
+    // software decimation of a handle running slower than the device
+    bool acceptSample(int32_t handle, int64_t timestamp) {
+        return mRates.accept(handle, timestamp);
+    }
+
+    // non-zero max report latency means events are held in the batch buffer
+    int64_t getMaxLatency() const { return mMaxLatency; }
+    BatchBuffer* getBatchBuffer() const { return mBatch; }
+
+    // running estimates of the sampling period and its jitter, in ns
+    int64_t getSamplePeriod() const { return mPeriod; }
+    int64_t getJitter() const { return mJitter; }
 };
 
 /*****************************************************************************/
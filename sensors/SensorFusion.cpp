@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <hardware/sensors.h>
+
+#include "SensorFusion.h"
+
+/*****************************************************************************/
+
+// correction gains of the accelerometer and magnetometer error terms
+static const float kAccelGain = 0.5f;
+static const float kMagGain = 0.25f;
+// gyro gaps longer than this restart the integration
+static const int64_t kMaxGyroGap = 200000000LL;
+
+static inline float invNorm(float x, float y, float z) {
+    const float n = x*x + y*y + z*z;
+    return n > 0 ? 1.0f / sqrtf(n) : 0;
+}
+
+SensorFusion::SensorFusion()
+{
+    reset();
+}
+
+void SensorFusion::reset()
+{
+    mQ[0] = 1; mQ[1] = mQ[2] = mQ[3] = 0;
+    memset(mAccel, 0, sizeof(mAccel));
+    memset(mMag, 0, sizeof(mMag));
+    mHasAccel = false;
+    mHasMag = false;
+    mInitialized = false;
+    mLastGyroTime = 0;
+    updateMatrix();
+}
+
+void SensorFusion::updateMatrix()
+{
+    const float w = mQ[0], x = mQ[1], y = mQ[2], z = mQ[3];
+    mR[0] = 1 - 2*(y*y + z*z);
+    mR[1] = 2*(x*y - w*z);
+    mR[2] = 2*(x*z + w*y);
+    mR[3] = 2*(x*y + w*z);
+    mR[4] = 1 - 2*(x*x + z*z);
+    mR[5] = 2*(y*z - w*x);
+    mR[6] = 2*(x*z - w*y);
+    mR[7] = 2*(y*z + w*x);
+    mR[8] = 1 - 2*(x*x + y*y);
+}
+
+void SensorFusion::handleAccel(float const* v)
+{
+    mAccel[0] = v[0];
+    mAccel[1] = v[1];
+    mAccel[2] = v[2];
+    mHasAccel = true;
+}
+
+void SensorFusion::handleMag(float const* v)
+{
+    mMag[0] = v[0];
+    mMag[1] = v[1];
+    mMag[2] = v[2];
+    mHasMag = true;
+}
+
+/*
+ * First estimate straight from gravity and the magnetic field, the same
+ * construction as SensorManager.getRotationMatrix(): the rows of R are
+ * East, North and Up expressed in the device frame.
+ */
+bool SensorFusion::initFromAccelMag()
+{
+    if (!mHasAccel || !mHasMag)
+        return false;
+    const float* a = mAccel;
+    const float* m = mMag;
+    float hx = m[1]*a[2] - m[2]*a[1];
+    float hy = m[2]*a[0] - m[0]*a[2];
+    float hz = m[0]*a[1] - m[1]*a[0];
+    const float invH = invNorm(hx, hy, hz);
+    const float invA = invNorm(a[0], a[1], a[2]);
+    if (invH == 0 || invA == 0 || invH > 10.0f)  // free fall or at the pole
+        return false;
+    hx *= invH; hy *= invH; hz *= invH;
+    const float ax = a[0]*invA, ay = a[1]*invA, az = a[2]*invA;
+    const float mx = ay*hz - az*hy;
+    const float my = az*hx - ax*hz;
+    const float mz = ax*hy - ay*hx;
+
+    // matrix (rows H, M, A) to quaternion
+    const float r00 = hx, r01 = hy, r02 = hz;
+    const float r10 = mx, r11 = my, r12 = mz;
+    const float r20 = ax, r21 = ay, r22 = az;
+    const float trace = r00 + r11 + r22;
+    float q[4];
+    if (trace > 0) {
+        const float s = 0.5f / sqrtf(trace + 1);
+        q[0] = 0.25f / s;
+        q[1] = (r21 - r12) * s;
+        q[2] = (r02 - r20) * s;
+        q[3] = (r10 - r01) * s;
+    } else if (r00 > r11 && r00 > r22) {
+        const float s = 2 * sqrtf(1 + r00 - r11 - r22);
+        q[0] = (r21 - r12) / s;
+        q[1] = 0.25f * s;
+        q[2] = (r01 + r10) / s;
+        q[3] = (r02 + r20) / s;
+    } else if (r11 > r22) {
+        const float s = 2 * sqrtf(1 + r11 - r00 - r22);
+        q[0] = (r02 - r20) / s;
+        q[1] = (r01 + r10) / s;
+        q[2] = 0.25f * s;
+        q[3] = (r12 + r21) / s;
+    } else {
+        const float s = 2 * sqrtf(1 + r22 - r00 - r11);
+        q[0] = (r10 - r01) / s;
+        q[1] = (r02 + r20) / s;
+        q[2] = (r12 + r21) / s;
+        q[3] = 0.25f * s;
+    }
+    memcpy(mQ, q, sizeof(mQ));
+    updateMatrix();
+    return true;
+}
+
+bool SensorFusion::handleGyro(float const* v, int64_t timestamp)
+{
+    const int64_t last = mLastGyroTime;
+    mLastGyroTime = timestamp;
+    if (!mInitialized) {
+        mInitialized = initFromAccelMag();
+        return mInitialized;
+    }
+    const int64_t dtNs = timestamp - last;
+    if (dtNs <= 0 || dtNs > kMaxGyroGap)
+        return true;
+    const float dt = dtNs * 1e-9f;
+
+    float gx = v[0], gy = v[1], gz = v[2];
+
+    // up as the accelerometer sees it vs our estimate (third row of R)
+    float ia = invNorm(mAccel[0], mAccel[1], mAccel[2]);
+    if (mHasAccel && ia != 0) {
+        const float ax = mAccel[0]*ia, ay = mAccel[1]*ia, az = mAccel[2]*ia;
+        const float vx = mR[6], vy = mR[7], vz = mR[8];
+        gx += kAccelGain * (ay*vz - az*vy);
+        gy += kAccelGain * (az*vx - ax*vz);
+        gz += kAccelGain * (ax*vy - ay*vx);
+    }
+
+    // same for north, using only the horizontal part of the field
+    float im = invNorm(mMag[0], mMag[1], mMag[2]);
+    if (mHasMag && im != 0) {
+        const float mx = mMag[0]*im, my = mMag[1]*im, mz = mMag[2]*im;
+        const float hx = mR[0]*mx + mR[1]*my + mR[2]*mz;
+        const float hy = mR[3]*mx + mR[4]*my + mR[5]*mz;
+        const float hz = mR[6]*mx + mR[7]*my + mR[8]*mz;
+        const float by = sqrtf(hx*hx + hy*hy);
+        const float bz = hz;
+        const float wx = by*mR[3] + bz*mR[6];
+        const float wy = by*mR[4] + bz*mR[7];
+        const float wz = by*mR[5] + bz*mR[8];
+        gx += kMagGain * (my*wz - mz*wy);
+        gy += kMagGain * (mz*wx - mx*wz);
+        gz += kMagGain * (mx*wy - my*wx);
+    }
+
+    // q += 0.5 * q (x) (0, g) * dt
+    const float hdt = 0.5f * dt;
+    const float w = mQ[0], x = mQ[1], y = mQ[2], z = mQ[3];
+    mQ[0] += (-x*gx - y*gy - z*gz) * hdt;
+    mQ[1] += ( w*gx + y*gz - z*gy) * hdt;
+    mQ[2] += ( w*gy - x*gz + z*gx) * hdt;
+    mQ[3] += ( w*gz + x*gy - y*gx) * hdt;
+    const float n = mQ[0]*mQ[0] + mQ[1]*mQ[1] + mQ[2]*mQ[2] + mQ[3]*mQ[3];
+    const float in = 1.0f / sqrtf(n);
+    mQ[0] *= in; mQ[1] *= in; mQ[2] *= in; mQ[3] *= in;
+    updateMatrix();
+    return true;
+}
+
+void SensorFusion::getRotationVector(float* out) const
+{
+    const float s = mQ[0] < 0 ? -1.0f : 1.0f;
+    out[0] = s * mQ[1];
+    out[1] = s * mQ[2];
+    out[2] = s * mQ[3];
+    out[3] = s * mQ[0];
+}
+
+void SensorFusion::getGravity(float* out) const
+{
+    out[0] = GRAVITY_EARTH * mR[6];
+    out[1] = GRAVITY_EARTH * mR[7];
+    out[2] = GRAVITY_EARTH * mR[8];
+}
+
+void SensorFusion::getLinearAcceleration(float* out) const
+{
+    out[0] = mAccel[0] - GRAVITY_EARTH * mR[6];
+    out[1] = mAccel[1] - GRAVITY_EARTH * mR[7];
+    out[2] = mAccel[2] - GRAVITY_EARTH * mR[8];
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_FUSION_H
+#define ANDROID_SENSOR_FUSION_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Attitude estimator: a fixed-size complementary (Mahony) filter on a
+ * quaternion. The gyroscope drives the estimate, the accelerometer and
+ * the magnetometer pull it back towards up and north. All vectors are in
+ * the Android device frame, the world frame is East-North-Up.
+ */
+class SensorFusion
+{
+    float mQ[4];            // w, x, y, z: device to world
+    float mR[9];            // rotation matrix of mQ, row major
+    float mAccel[3];
+    float mMag[3];
+    bool mHasAccel;
+    bool mHasMag;
+    bool mInitialized;
+    int64_t mLastGyroTime;
+
+    void updateMatrix();
+    bool initFromAccelMag();
+
+public:
+    SensorFusion();
+
+    void reset();
+    void handleAccel(float const* v);
+    void handleMag(float const* v);
+    // integrates one gyro sample, returns true once an estimate exists
+    bool handleGyro(float const* v, int64_t timestamp);
+
+    bool hasEstimate() const { return mInitialized; }
+
+    // x, y, z, w with w >= 0 as SENSOR_TYPE_ROTATION_VECTOR expects
+    void getRotationVector(float* out) const;
+    void getGravity(float* out) const;
+    void getLinearAcceleration(float* out) const;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_FUSION_H
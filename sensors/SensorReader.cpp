@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include "nusensors.h"
+#include "SensorBase.h"
+#include "SensorReader.h"
+
+/*****************************************************************************/
+
+SensorReader::SensorReader(SensorBase* sensor, int notifyFd, int cpu)
+    : mSensor(sensor),
+      mNotifyFd(notifyFd),
+      mCpu(cpu),
+      mStopFd(-1),
+      mThread(0),
+      mHead(0),
+      mTail(0),
+      mHungUp(0),
+      mNumNotifies(0),
+      mNumStalls(0)
+{
+}
+
+SensorReader::~SensorReader()
+{
+    stop();
+}
+
+int SensorReader::start()
+{
+    if (mThread)
+        return 0;
+    mStopFd = eventfd(0, EFD_NONBLOCK);
+    if (mStopFd < 0)
+        return -errno;
+    android_atomic_release_store(0, &mHungUp);
+    if (pthread_create(&mThread, NULL, readerThread, this)) {
+        mThread = 0;
+        close(mStopFd);
+        mStopFd = -1;
+        return -errno;
+    }
+    return 0;
+}
+
+/*
+ * Whatever is still in the ring stays there for the poll thread, so a
+ * reader can be stopped and started again without losing events.
+ */
+void SensorReader::stop()
+{
+    if (!mThread)
+        return;
+    eventfd_write(mStopFd, 1);
+    pthread_join(mThread, NULL);
+    mThread = 0;
+    close(mStopFd);
+    mStopFd = -1;
+}
+
+bool SensorReader::hungUp() const
+{
+    return android_atomic_acquire_load(&mHungUp);
+}
+
+size_t SensorReader::available() const
+{
+    return uint32_t(android_atomic_acquire_load(&mTail)) - uint32_t(mHead);
+}
+
+void SensorReader::consume(size_t n)
+{
+    android_atomic_release_store(mHead + n, &mHead);
+    // pairs with the barrier in fill(): either the reader sees the ring
+    // empty and notifies, or the poll thread sees its events in available()
+    android_memory_barrier();
+}
+
+void* SensorReader::readerThread(void* arg)
+{
+    static_cast<SensorReader*>(arg)->run();
+    return NULL;
+}
+
+void SensorReader::run()
+{
+    // who == 0 is the calling thread on Linux
+    setpriority(PRIO_PROCESS, 0, kPriority);
+    if (mCpu >= 0) {
+        // a raw mask, this bionic has no cpu_set_t
+        unsigned long mask = 1UL << mCpu;
+        if (syscall(__NR_sched_setaffinity, 0, sizeof(mask), &mask) < 0)
+            LOGW("%s reader not pinned to cpu %d (%s)", mSensor->getName(),
+                    mCpu, strerror(errno));
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = mSensor->getFd();
+    fds[1].fd = mStopFd;
+    fds[1].events = POLLIN;
+    bool stalled = false;
+    while (true) {
+        // a full ring leaves the device alone until the poll thread
+        // catches up, which it doesn't tell us about
+        const bool full = room() < bounceSize;
+        if (full && !stalled)
+            mNumStalls++;
+        stalled = full;
+        fds[0].events = full ? 0 : POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, full ? kStallMs : -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("%s reader poll failed (%s)", mSensor->getName(), strerror(errno));
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            // evdev hangs up the fds of a removed device, the poll thread
+            // detaches the driver when it sees this
+            android_atomic_release_store(1, &mHungUp);
+            eventfd_write(mNotifyFd, 1);
+            break;
+        }
+        while (fill())
+            ;
+    }
+}
+
+size_t SensorReader::room() const
+{
+    const uint32_t head = android_atomic_acquire_load(&mHead);
+    return ringSize - (uint32_t(mTail) - head);
+}
+
+/*
+ * Decode into the free part of the ring, returns true if the driver may
+ * have more and there is still room for it. Less room than bounceSize
+ * counts as full, a driver given too little room for a frame with several
+ * outputs decodes nothing.
+ */
+bool SensorReader::fill()
+{
+    const size_t free = room();
+    if (free < bounceSize)
+        return false;
+
+    const uint32_t tail = mTail;
+    const size_t slot = tail & (ringSize - 1);
+    size_t contiguous = free < ringSize - slot ? free : ringSize - slot;
+    int n;
+    if (contiguous < bounceSize) {
+        // not enough room in front of the wrap, decode aside and copy
+        sensors_event_t bounce[bounceSize];
+        contiguous = bounceSize;
+        n = mSensor->readEvents(bounce, contiguous);
+        for (int i=0 ; i<n ; i++)
+            mRing[(tail + i) & (ringSize - 1)] = bounce[i];
+    } else {
+        n = mSensor->readEvents(&mRing[slot], contiguous);
+    }
+    if (n <= 0)
+        return false;
+
+    android_atomic_release_store(tail + n, &mTail);
+    android_memory_barrier();
+    if (uint32_t(android_atomic_acquire_load(&mHead)) == tail) {
+        mNumNotifies++;
+        eventfd_write(mNotifyFd, 1);
+    }
+    return (n == int(contiguous) || mSensor->hasPendingEvents()) &&
+            room() >= bounceSize;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_READER_H
+#define ANDROID_SENSOR_READER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <hardware/sensors.h>
+
+/*****************************************************************************/
+
+class SensorBase;
+
+/*
+ * A thread reading one driver on its own, so that a slow readEvents() or
+ * a burst on another device doesn't delay it. Events are decoded straight
+ * into a single-producer single-consumer ring: the reader thread is the
+ * only writer, the poll thread the only reader, and neither takes a lock.
+ * The poll thread is woken through notifyFd only when the ring goes from
+ * empty to not empty. A full ring stops the reader until there is room
+ * again, the evdev buffer holds what comes meanwhile.
+ */
+class SensorReader
+{
+public:
+    enum {
+        ringSize = 256,                 // events, a power of two
+        bounceSize = 8,                 // the most a frame decodes to
+    };
+
+    SensorReader(SensorBase* sensor, int notifyFd, int cpu);
+    ~SensorReader();
+
+    int start();
+    void stop();
+    bool isRunning() const { return mThread != 0; }
+    // the driver's fd hung up, the reader stopped reading it
+    bool hungUp() const;
+    SensorBase* getSensor() const { return mSensor; }
+
+    // poll thread only: events in the ring, the i-th oldest of them, and
+    // giving the n oldest back to the reader
+    size_t available() const;
+    sensors_event_t const& at(size_t i) const {
+        return mRing[(mHead + i) & (ringSize - 1)];
+    }
+    void consume(size_t n);
+
+    // written by the reader thread, see sensors_poll_context_t::dump()
+    uint32_t getNumNotifies() const { return mNumNotifies; }
+    uint32_t getNumStalls() const { return mNumStalls; }
+
+private:
+    // nice value of the reader threads, ANDROID_PRIORITY_URGENT_DISPLAY
+    static const int kPriority = -8;
+    // how often a full ring is checked for room again
+    static const int kStallMs = 2;
+
+    SensorBase* const mSensor;
+    const int mNotifyFd;
+    const int mCpu;
+    int mStopFd;
+    pthread_t mThread;
+    // free running counts of events consumed and produced
+    volatile int32_t mHead;
+    volatile int32_t mTail;
+    volatile int32_t mHungUp;
+    uint32_t mNumNotifies;
+    uint32_t mNumStalls;
+    sensors_event_t mRing[ringSize];
+
+    static void* readerThread(void* arg);
+    void run();
+    size_t room() const;
+    bool fill();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_READER_H
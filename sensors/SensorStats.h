@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_STATS_H
+#define ANDROID_SENSOR_STATS_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Per-driver counters. They are only ever written by the poll thread, so
+ * they take no lock and are cheap enough to stay on in production; a dump
+ * from another thread may see them mid-update, which is fine for stats.
+ */
+struct SensorStats
+{
+    // latency buckets are powers of two starting at kLatencyBase,
+    // the last one holds everything above
+    enum { numLatencyBuckets = 16 };
+    static const int64_t kLatencyBase = 250000;
+
+    uint32_t delivered;     // handed to the framework
+    uint32_t decimated;     // dropped for running faster than requested
+    uint32_t latency[numLatencyBuckets];
+
+    SensorStats() { reset(); }
+    void reset() {
+        delivered = decimated = 0;
+        for (int i=0 ; i<numLatencyBuckets ; i++)
+            latency[i] = 0;
+    }
+
+    // sample time to delivery, both on CLOCK_MONOTONIC
+    void addLatency(int64_t ns) {
+        int bucket = 0;
+        while (bucket < numLatencyBuckets-1 && ns >= (kLatencyBase << bucket))
+            bucket++;
+        latency[bucket]++;
+    }
+
+    // the upper limit of bucket in ns, -1 for the last one
+    static int64_t bucketLimit(int bucket) {
+        return bucket < numLatencyBuckets-1 ? (kLatencyBase << bucket) : -1;
+    }
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_STATS_H
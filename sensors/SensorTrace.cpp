@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/sensors.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "DebugFile.h"
+#include "SensorTrace.h"
+
+/*****************************************************************************/
+
+static const char* const kTraceMarker = "/sys/kernel/debug/tracing/trace_marker";
+
+int SensorTrace::sMarkerFd = -1;
+int SensorTrace::sFileFd = -1;
+int SensorTrace::sPid;
+sensor_trace_record_t SensorTrace::sRecords[bufferedRecords];
+int SensorTrace::sNumRecords;
+
+void SensorTrace::init()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sensors.trace", value, "");
+    if (!value[0] || !strcmp(value, "0") || !debugCapturesAllowed())
+        return;
+
+    sPid = getpid();
+    sMarkerFd = open(kTraceMarker, O_WRONLY);
+    LOGW_IF(sMarkerFd<0, "couldn't open %s (%s)", kTraceMarker, strerror(errno));
+
+    if (strcmp(value, "2"))
+        return;
+    sFileFd = openDebugFile("trace", "trc");
+    if (sFileFd < 0) {
+        LOGW("couldn't create a trace file in %s (%s)", SENSORS_DEBUG_DIR,
+                strerror(-sFileFd));
+        sFileFd = -1;
+        return;
+    }
+    sensor_trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SENSOR_TRACE_MAGIC;
+    header.version = SENSOR_TRACE_VERSION;
+    header.recordSize = sizeof(sensor_trace_record_t);
+    write(sFileFd, &header, sizeof(header));
+}
+
+void SensorTrace::close()
+{
+    if (sFileFd >= 0) {
+        flush();
+        ::close(sFileFd);
+        sFileFd = -1;
+    }
+    if (sMarkerFd >= 0) {
+        ::close(sMarkerFd);
+        sMarkerFd = -1;
+    }
+}
+
+/*
+ * Same format as the atrace macros of later releases write, so systrace
+ * parses them: "B|pid|name", "E", "C|pid|name|value".
+ */
+void SensorTrace::writeMarker(char what, const char* name, int32_t value)
+{
+    char buf[128];
+    int len;
+    switch (what) {
+        case 'B': len = snprintf(buf, sizeof(buf), "B|%d|%s", sPid, name); break;
+        case 'C': len = snprintf(buf, sizeof(buf), "C|%d|%s|%d", sPid, name, value); break;
+        default:  len = snprintf(buf, sizeof(buf), "E"); break;
+    }
+    if (len > int(sizeof(buf)) - 1)
+        len = sizeof(buf) - 1;
+    write(sMarkerFd, buf, len);
+}
+
+void SensorTrace::writeRecords(sensors_event_t const* events, int count, int64_t now)
+{
+    for (int i=0 ; i<count ; i++) {
+        sensor_trace_record_t* const r(&sRecords[sNumRecords++]);
+        r->timestamp = events[i].timestamp;
+        r->delivered = now;
+        r->sensor = events[i].sensor;
+        r->type = events[i].type;
+        if (sNumRecords == bufferedRecords)
+            flush();
+    }
+}
+
+void SensorTrace::flush()
+{
+    if (!sNumRecords)
+        return;
+    const ssize_t size = sNumRecords * sizeof(sensor_trace_record_t);
+    if (write(sFileFd, sRecords, size) != size) {
+        LOGW("sensor trace truncated (%s)", strerror(errno));
+        ::close(sFileFd);
+        sFileFd = -1;
+    }
+    sNumRecords = 0;
+}
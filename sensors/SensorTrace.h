@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SENSOR_TRACE_H
+#define ANDROID_SENSOR_TRACE_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+struct sensors_event_t;
+
+/*
+ * Optional tracing of the poll thread, off unless debug.sensors.trace is
+ * set when the HAL is opened, and always off on user builds:
+ *  - "1" writes atrace style begin/end and counter markers to the ftrace
+ *    trace_marker, so the HAL shows up in systrace next to the kernel;
+ *  - "2" additionally records every delivered event to a new trace-*.trc
+ *    in SENSORS_DEBUG_DIR (sensor_trace_header_t followed by
+ *    sensor_trace_record_t's).
+ * Every entry point is a single branch when tracing is off.
+ */
+
+#define SENSOR_TRACE_MAGIC      0x53545243  // 'STRC'
+#define SENSOR_TRACE_VERSION    1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+} sensor_trace_header_t;
+
+typedef struct {
+    int64_t timestamp;      // of the sample
+    int64_t delivered;      // when pollEvents() returned it
+    int32_t sensor;
+    int32_t type;
+} sensor_trace_record_t;
+
+class SensorTrace
+{
+public:
+    static void init();
+    static void close();
+
+    static bool isEnabled() { return sMarkerFd >= 0; }
+
+    static void begin(const char* name) {
+        if (sMarkerFd >= 0)
+            writeMarker('B', name, 0);
+    }
+    static void end() {
+        if (sMarkerFd >= 0)
+            writeMarker('E', NULL, 0);
+    }
+    static void counter(const char* name, int32_t value) {
+        if (sMarkerFd >= 0)
+            writeMarker('C', name, value);
+    }
+    static void record(sensors_event_t const* events, int count, int64_t now) {
+        if (sFileFd >= 0)
+            writeRecords(events, count, now);
+    }
+
+private:
+    enum { bufferedRecords = 128 };
+
+    static int sMarkerFd;
+    static int sFileFd;
+    static int sPid;
+    static sensor_trace_record_t sRecords[bufferedRecords];
+    static int sNumRecords;
+
+    static void writeMarker(char what, const char* name, int32_t value);
+    static void writeRecords(sensors_event_t const* events, int count, int64_t now);
+    static void flush();
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SENSOR_TRACE_H
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "SharedSource.h"
+
+/*****************************************************************************/
+
+SharedSource::SharedSource()
+    : mActive(0)
+{
+    memset(mPeriods, 0, sizeof(mPeriods));
+    memset(mLastAccepted, 0, sizeof(mLastAccepted));
+}
+
+bool SharedSource::acquire(int consumer)
+{
+    if (uint32_t(consumer) >= maxConsumers || isAcquired(consumer))
+        return false;
+    const bool first = !mActive;
+    mActive |= 1<<consumer;
+    mLastAccepted[consumer] = 0;
+    return first;
+}
+
+bool SharedSource::release(int consumer)
+{
+    if (uint32_t(consumer) >= maxConsumers || !isAcquired(consumer))
+        return false;
+    mActive &= ~(1<<consumer);
+    return !mActive;
+}
+
+void SharedSource::setPeriod(int consumer, int64_t ns)
+{
+    if (uint32_t(consumer) < maxConsumers)
+        mPeriods[consumer] = ns;
+}
+
+int64_t SharedSource::getDevicePeriod() const
+{
+    int64_t period = 0;
+    for (int i=0 ; i<maxConsumers ; i++) {
+        if ((mActive & (1<<i)) && mPeriods[i] &&
+                (!period || mPeriods[i] < period)) {
+            period = mPeriods[i];
+        }
+    }
+    return period;
+}
+
+bool SharedSource::accept(int consumer, int64_t timestamp)
+{
+    if (!isAcquired(consumer))
+        return false;
+    const int64_t period = mPeriods[consumer];
+    const int64_t last = mLastAccepted[consumer];
+    // 1/8 of slack so jitter in the device rate doesn't drop every other
+    // sample when the consumer asked for exactly the device period
+    if (period && last && timestamp - last < period - period / 8)
+        return false;
+    mLastAccepted[consumer] = timestamp;
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SHARED_SOURCE_H
+#define ANDROID_SHARED_SOURCE_H
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+/*****************************************************************************/
+
+/*
+ * Reference counting and rate bookkeeping for one physical stream with
+ * several logical consumers. The device is on while anyone holds it and
+ * runs at the fastest period requested by an active consumer; slower
+ * consumers are decimated in software with accept().
+ */
+class SharedSource
+{
+public:
+    enum { maxConsumers = 32 };
+
+    SharedSource();
+
+    // both return true when the device itself has to be switched
+    bool acquire(int consumer);
+    bool release(int consumer);
+
+    bool isActive() const { return mActive != 0; }
+    uint32_t getActiveMask() const { return mActive; }
+    bool isAcquired(int consumer) const { return mActive & (1<<consumer); }
+
+    // 0 means "no preference", the consumer takes whatever the device runs at
+    void setPeriod(int consumer, int64_t ns);
+    int64_t getPeriod(int consumer) const { return mPeriods[consumer]; }
+
+    // period to program the device with, 0 if no active consumer cares
+    int64_t getDevicePeriod() const;
+
+    // whether the consumer wants the sample taken at timestamp
+    bool accept(int consumer, int64_t timestamp);
+
+private:
+    uint32_t mActive;
+    int64_t mPeriods[maxConsumers];
+    int64_t mLastAccepted[maxConsumers];
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_SHARED_SOURCE_H
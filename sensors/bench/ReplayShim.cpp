@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The benchmark builds the HAL with -Dioctl=sensors_replay_ioctl. The
+ * input "devices" are FIFOs named after the device they stand for and the
+ * chip control nodes don't exist, so both get their ioctls emulated here;
+ * anything else goes to the real ioctl(). The wake locks of
+ * libhardware_legacy are stubbed out as well.
+ */
+#undef ioctl
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <linux/input.h>
+#include <linux/kxtf9.h>
+
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID               _IOW('E', 0xa0, int)
+#endif
+
+static volatile int32_t sKxtf9Enabled;
+
+// what the HAL last switched the accelerometer to, for the power checks
+extern "C" int sensors_replay_kxtf9_enabled()
+{
+    return __sync_fetch_and_add(&sKxtf9Enabled, 0);
+}
+
+// the host has no wake locks, libhardware_legacy is target only
+extern "C" int acquire_wake_lock(int, const char*)
+{
+    return 0;
+}
+
+extern "C" int release_wake_lock(const char*)
+{
+    return 0;
+}
+
+extern "C" int sensors_replay_ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    va_start(args, request);
+    void* const arg = va_arg(args, void*);
+    va_end(args);
+
+    struct stat st;
+    const bool fifo = fd >= 0 && !fstat(fd, &st) && S_ISFIFO(st.st_mode);
+
+    if (fifo && _IOC_TYPE(request) == 'E') {
+        if (_IOC_NR(request) == _IOC_NR(EVIOCGNAME(0))) {
+            // the FIFO's own name is the device name
+            char link[32], path[PATH_MAX];
+            snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+            ssize_t len = readlink(link, path, sizeof(path) - 1);
+            if (len < 0)
+                return -1;
+            path[len] = '\0';
+            const char* name = strrchr(path, '/');
+            name = name ? name + 1 : path;
+            const size_t size = _IOC_SIZE(request);
+            snprintf(static_cast<char*>(arg), size, "%s", name);
+            return strlen(name) + 1 < size ? strlen(name) + 1 : size;
+        }
+        if (request == (unsigned long)EVIOCSCLOCKID) {
+            // the replay stamps everything on CLOCK_MONOTONIC already
+            return 0;
+        }
+        errno = ENOTTY;
+        return -1;
+    }
+
+    if (fd < 0) {
+        // a chip control node (/dev/kxtf9...): accept everything, and
+        // report "disabled" (all zeroes) to whoever asks
+        if (request == (unsigned long)KXTF9_IOCTL_SET_ENABLE && arg)
+            __sync_lock_test_and_set(&sKxtf9Enabled, *static_cast<int*>(arg));
+        if ((_IOC_DIR(request) & _IOC_READ) && arg)
+            memset(arg, 0, _IOC_SIZE(request));
+        return 0;
+    }
+
+    return ioctl(fd, request, arg);
+}
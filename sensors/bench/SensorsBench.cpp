@@ -0,0 +1,503 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host benchmark of the sensors.stingray poll path. Every input device is
+ * a FIFO in a scratch directory, fed by a thread replaying a recording
+ * made with debug.sensors.record (or a synthetic stream at the device's
+ * fastest rate), and the real HAL reads them through its readers and
+ * decoders. Reports events/s, ns/event and heap allocations done while
+ * polling.
+ *
+ * With -p it checks instead that a released accelerometer is really
+ * switched off once the disable hold (ro.sensors.power_hold) is over, and
+ * that a light sensor or barometer taken back within the hold still gives
+ * a reading, and that a batched accelerometer holds its samples.
+ *
+ *   sensors_bench [-n frames] [recording.rec ...]
+ *   sensors_bench -p
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <sys/stat.h>
+
+#include <linux/input.h>
+
+#include <hardware/sensors.h>
+
+#include "nusensors.h"
+#include "InputDeviceIndex.h"
+#include "InputRecorder.h"
+
+/*****************************************************************************/
+
+/*
+ * Allocation counting: operator new is overridden, malloc and friends
+ * are wrapped at link time (-Wl,--wrap=malloc...).
+ */
+static volatile int32_t sAllocations;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    __sync_fetch_and_add(&sAllocations, 1);
+    return __real_malloc(size);
+}
+void* __wrap_calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&sAllocations, 1);
+    return __real_calloc(n, size);
+}
+void* __wrap_realloc(void* p, size_t size) {
+    __sync_fetch_and_add(&sAllocations, 1);
+    return __real_realloc(p, size);
+}
+}
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    return __wrap_malloc(size);
+}
+void* operator new[](size_t size) throw(std::bad_alloc) {
+    return __wrap_malloc(size);
+}
+void operator delete(void* p) throw() {
+    free(p);
+}
+void operator delete[](void* p) throw() {
+    free(p);
+}
+
+/*****************************************************************************/
+
+extern "C" const struct sensors_module_t HAL_MODULE_INFO_SYM;
+extern "C" int sensors_replay_kxtf9_enabled();
+
+struct Stream {
+    const char* name;
+    int handle;
+    int type;               // EV_REL or EV_ABS
+    int codes[3];
+    int numCodes;
+    int64_t period;         // us, synthetic streams only
+};
+
+// what the drivers look for, at their fastest rates
+static const Stream kStreams[] = {
+    { "accelerometer", ID_A, EV_REL,
+        { EVENT_TYPE_ACCEL_X, EVENT_TYPE_ACCEL_Y, EVENT_TYPE_ACCEL_Z }, 3, MIN_DELAY_A },
+    { "gyroscope", ID_G, EV_REL,
+        { EVENT_TYPE_GYRO_P, EVENT_TYPE_GYRO_R, EVENT_TYPE_GYRO_Y }, 3, MIN_DELAY_G },
+    { "compass", ID_M, EV_REL,
+        { EVENT_TYPE_MAGV_X, EVENT_TYPE_MAGV_Y, EVENT_TYPE_MAGV_Z }, 3, MIN_DELAY_M },
+    { "barometer", ID_B, EV_ABS, { EVENT_TYPE_PRESSURE }, 1, MIN_DELAY_B },
+};
+
+// the MAX9635 only reports on change, only the power checks feed it
+static const Stream kLightStream =
+    { "max9635_als", ID_L, EV_MSC, { EVENT_TYPE_LIGHT }, 1, 0 };
+
+struct Feeder {
+    Stream const* stream;
+    InputPlayback* playback;    // NULL for a synthetic stream
+    int fd;
+    int frames;
+    pthread_t thread;
+};
+
+static Feeder sFeeders[sizeof(kStreams)/sizeof(kStreams[0]) + 1];
+static int sNumFeeders;
+static volatile int32_t sRunning;
+static volatile int32_t sStop;
+static int64_t sBase;
+// events the poll thread got, per handle
+static volatile int32_t sEvents[32];
+
+static int64_t now(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+static void writeAll(int fd, input_event const* events, size_t count)
+{
+    const char* p = reinterpret_cast<const char*>(events);
+    size_t size = count * sizeof(input_event);
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        p += n;
+        size -= n;
+    }
+}
+
+static void setTime(input_event* ev, int64_t us)
+{
+    ev->time.tv_sec = us / 1000000LL;
+    ev->time.tv_usec = us % 1000000LL;
+}
+
+static void* feederThread(void* arg)
+{
+    Feeder* const f(static_cast<Feeder*>(arg));
+    Stream const* const s(f->stream);
+    input_event events[64];
+    size_t n = 0;
+    if (f->playback) {
+        while (f->playback->next(&events[n], sBase)) {
+            if (++n == 64) {
+                writeAll(f->fd, events, n);
+                n = 0;
+            }
+        }
+    } else {
+        for (int frame=0 ; frame<f->frames ; frame++) {
+            if (n + s->numCodes + 1 > 64) {
+                writeAll(f->fd, events, n);
+                n = 0;
+            }
+            const int64_t t = sBase + frame * s->period;
+            for (int c=0 ; c<s->numCodes ; c++) {
+                setTime(&events[n], t);
+                events[n].type = s->type;
+                events[n].code = s->codes[c];
+                events[n++].value = (frame * 7 + c * 13) % 1024 - 512;
+            }
+            setTime(&events[n], t);
+            events[n].type = EV_SYN;
+            events[n].code = SYN_REPORT;
+            events[n++].value = 0;
+        }
+    }
+    writeAll(f->fd, events, n);
+
+    if (__sync_sub_and_fetch(&sRunning, 1) == 0) {
+        // the last one out unblocks the poll loop with a final frame, on
+        // every device as not all drivers report a bare one
+        usleep(200000);
+        sStop = 1;
+        setTime(&events[0], sBase);
+        events[0].type = EV_SYN;
+        events[0].code = SYN_REPORT;
+        events[0].value = 0;
+        for (int i=0 ; i<sNumFeeders ; i++)
+            writeAll(sFeeders[i].fd, events, 1);
+    }
+    return NULL;
+}
+
+static Stream const* findStream(const char* name)
+{
+    for (size_t i=0 ; i<sizeof(kStreams)/sizeof(kStreams[0]) ; i++) {
+        if (!strcmp(kStreams[i].name, name))
+            return &kStreams[i];
+    }
+    return NULL;
+}
+
+static void* pollThread(void* arg)
+{
+    sensors_poll_device_t* const dev(static_cast<sensors_poll_device_t*>(arg));
+    sensors_event_t buffer[16];
+    while (!sStop) {
+        const int n = dev->poll(dev, buffer, 16);
+        if (n < 0)
+            break;
+        for (int i=0 ; i<n ; i++) {
+            if (unsigned(buffer[i].sensor) < 32)
+                __sync_fetch_and_add(&sEvents[buffer[i].sensor], 1);
+        }
+    }
+    return NULL;
+}
+
+static bool waitForEvents(int handle, int32_t events)
+{
+    for (int i=0 ; i<10 && sEvents[handle] < events ; i++)
+        usleep(100000);
+    return sEvents[handle] >= events;
+}
+
+static void writeFrame(int fd, int type, int code, int value)
+{
+    input_event ev[2];
+    memset(ev, 0, sizeof(ev));
+    setTime(&ev[0], now(CLOCK_MONOTONIC) / 1000);
+    ev[0].type = type;
+    ev[0].code = code;
+    ev[0].value = value;
+    ev[1] = ev[0];
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    ev[1].value = 0;
+    writeAll(fd, ev, 2);
+}
+
+/*
+ * Enable, disable and let the hold run out with the poll thread going, as
+ * expireHandles() runs there. Returns the number of failed checks.
+ */
+static int checkPowerHold(sensors_poll_device_t* dev, int fd, int lightFd,
+        int pressureFd)
+{
+    int failed = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, pollThread, dev);
+
+    // steady light: the chip stays quiet, the level read before the
+    // release is all a listener coming back within the hold can get
+    dev->activate(dev, ID_L, 1);
+    writeFrame(lightFd, EV_MSC, EVENT_TYPE_LIGHT, 100);
+    if (!waitForEvents(ID_L, 1)) {
+        fprintf(stderr, "FAIL: no light reading after enabling\n");
+        failed++;
+    }
+    dev->activate(dev, ID_L, 0);
+    dev->activate(dev, ID_L, 1);
+    if (!waitForEvents(ID_L, 2)) {
+        fprintf(stderr, "FAIL: no light reading after resuming within the hold\n");
+        failed++;
+    }
+    dev->activate(dev, ID_L, 0);
+
+    // the same for a steady pressure, which is below the report step
+    dev->activate(dev, ID_B, 1);
+    writeFrame(pressureFd, EV_ABS, EVENT_TYPE_PRESSURE, 101325);
+    if (!waitForEvents(ID_B, 1)) {
+        fprintf(stderr, "FAIL: no pressure reading after enabling\n");
+        failed++;
+    }
+    dev->activate(dev, ID_B, 0);
+    dev->activate(dev, ID_B, 1);
+    writeFrame(pressureFd, EV_ABS, EVENT_TYPE_PRESSURE, 101325);
+    if (!waitForEvents(ID_B, 2)) {
+        fprintf(stderr, "FAIL: no pressure reading after resuming within the hold\n");
+        failed++;
+    }
+    dev->activate(dev, ID_B, 0);
+
+    dev->setDelay(dev, ID_A, MIN_DELAY_A * 1000LL);
+    dev->activate(dev, ID_A, 1);
+    if (!sensors_replay_kxtf9_enabled()) {
+        fprintf(stderr, "FAIL: accelerometer not switched on\n");
+        failed++;
+    }
+    dev->activate(dev, ID_A, 0);
+    if (!sensors_replay_kxtf9_enabled()) {
+        fprintf(stderr, "FAIL: accelerometer switched off within the hold\n");
+        failed++;
+    }
+    // the default hold is 1 s
+    for (int i=0 ; i<30 && sensors_replay_kxtf9_enabled() ; i++)
+        usleep(100000);
+    if (sensors_replay_kxtf9_enabled()) {
+        fprintf(stderr, "FAIL: accelerometer still on after the hold\n");
+        failed++;
+    }
+
+    // a batched accelerometer holds its samples for the max latency
+    sensors_poll_batch(ID_A, 500000000LL);
+    dev->activate(dev, ID_A, 1);
+    // the poll thread takes the driver off its reader asynchronously
+    usleep(100000);
+    const int32_t before = sEvents[ID_A];
+    for (int i=0 ; i<5 ; i++) {
+        writeFrame(fd, EV_REL, EVENT_TYPE_ACCEL_X, i);
+        usleep(MIN_DELAY_A);
+    }
+    if (sEvents[ID_A] != before) {
+        fprintf(stderr, "FAIL: batched samples delivered before the max latency\n");
+        failed++;
+    }
+    if (!waitForEvents(ID_A, before + 5)) {
+        fprintf(stderr, "FAIL: batched samples not delivered\n");
+        failed++;
+    }
+    dev->activate(dev, ID_A, 0);
+    sensors_poll_batch(ID_A, 0);
+
+    // switch it back on to get one frame through the poll loop
+    sStop = 1;
+    dev->activate(dev, ID_A, 1);
+    input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    setTime(&ev, now(CLOCK_MONOTONIC) / 1000);
+    ev.type = EV_SYN;
+    ev.code = SYN_REPORT;
+    writeAll(fd, &ev, 1);
+    pthread_join(thread, NULL);
+    dev->activate(dev, ID_A, 0);
+
+    printf("power hold: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+static int addFeeder(Stream const* stream, InputPlayback* playback, int frames)
+{
+    for (int i=0 ; i<sNumFeeders ; i++) {
+        if (sFeeders[i].stream == stream)
+            return -EEXIST;
+    }
+    Feeder* const f(&sFeeders[sNumFeeders++]);
+    f->stream = stream;
+    f->playback = playback;
+    f->frames = frames;
+    f->fd = -1;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 20000;
+    bool powerCheck = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p")) != -1) {
+        if (opt == 'n') {
+            frames = atoi(optarg);
+        } else if (opt == 'p') {
+            powerCheck = true;
+        } else {
+            fprintf(stderr, "usage: %s [-n frames] [recording.rec ...]\n"
+                    "       %s -p\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    for (int i=optind ; i<argc ; i++) {
+        InputPlayback* playback = new InputPlayback();
+        Stream const* stream;
+        if (playback->open(argv[i]) || !(stream = findStream(playback->getName()))) {
+            fprintf(stderr, "%s: not a recording of a known device\n", argv[i]);
+            return 1;
+        }
+        addFeeder(stream, playback, 0);
+    }
+    if (!sNumFeeders) {
+        for (size_t i=0 ; i<sizeof(kStreams)/sizeof(kStreams[0]) ; i++)
+            addFeeder(&kStreams[i], NULL, frames);
+    }
+    if (powerCheck)
+        addFeeder(&kLightStream, NULL, 0);
+
+    char dir[] = "/tmp/sensors_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    for (int i=0 ; i<sNumFeeders ; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, sFeeders[i].stream->name);
+        // O_RDWR keeps a writer around, so the HAL never sees a hangup
+        if (mkfifo(path, 0600) || (sFeeders[i].fd = open(path, O_RDWR)) < 0) {
+            perror(path);
+            return 1;
+        }
+    }
+    InputDeviceIndex::setDirectory(dir);
+
+    hw_device_t* device;
+    int err = HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+            SENSORS_HARDWARE_POLL, &device);
+    if (err) {
+        fprintf(stderr, "couldn't open the HAL (%s)\n", strerror(-err));
+        return 1;
+    }
+    sensors_poll_device_t* const dev(reinterpret_cast<sensors_poll_device_t*>(device));
+    if (powerCheck) {
+        int fd = -1, lightFd = -1, pressureFd = -1;
+        for (int i=0 ; i<sNumFeeders ; i++) {
+            if (sFeeders[i].stream->handle == ID_A)
+                fd = sFeeders[i].fd;
+            if (sFeeders[i].stream->handle == ID_L)
+                lightFd = sFeeders[i].fd;
+            if (sFeeders[i].stream->handle == ID_B)
+                pressureFd = sFeeders[i].fd;
+        }
+        const int failed = fd < 0 ? 1 : checkPowerHold(dev, fd, lightFd,
+                pressureFd);
+        if (fd < 0)
+            fprintf(stderr, "no accelerometer stream to check\n");
+        device->close(device);
+        for (int i=0 ; i<sNumFeeders ; i++) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dir, sFeeders[i].stream->name);
+            close(sFeeders[i].fd);
+            unlink(path);
+        }
+        rmdir(dir);
+        return failed ? 1 : 0;
+    }
+    for (int i=0 ; i<sNumFeeders ; i++) {
+        dev->activate(dev, sFeeders[i].stream->handle, 1);
+        dev->setDelay(dev, sFeeders[i].stream->handle, 0);
+    }
+
+    sBase = now(CLOCK_MONOTONIC) / 1000;
+    sRunning = sNumFeeders;
+    for (int i=0 ; i<sNumFeeders ; i++)
+        pthread_create(&sFeeders[i].thread, NULL, feederThread, &sFeeders[i]);
+
+    sensors_event_t buffer[64];
+    int64_t events = 0, polls = 0;
+    const int32_t allocations = sAllocations;
+    const int64_t wall = now(CLOCK_MONOTONIC);
+    const int64_t cpu = now(CLOCK_THREAD_CPUTIME_ID);
+    while (!sStop) {
+        int n = dev->poll(dev, buffer, 64);
+        if (n < 0) {
+            fprintf(stderr, "poll failed (%s)\n", strerror(-n));
+            break;
+        }
+        events += n;
+        polls++;
+    }
+    const int64_t cpuNs = now(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    const int64_t wallNs = now(CLOCK_MONOTONIC) - wall;
+    const int32_t allocated = sAllocations - allocations;
+
+    for (int i=0 ; i<sNumFeeders ; i++)
+        pthread_join(sFeeders[i].thread, NULL);
+
+    // the final 200 ms of the feeders are idle, don't count them
+    printf("%lld events in %lld polls\n", (long long)events, (long long)polls);
+    printf("%.0f events/s, %.1f ns/event (poll thread cpu), %d allocations\n",
+            events * 1e9 / (wallNs > 200000000LL ? wallNs - 200000000LL : wallNs),
+            events ? double(cpuNs) / events : 0.0, allocated);
+
+    device->close(device);
+    for (int i=0 ; i<sNumFeeders ; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, sFeeders[i].stream->name);
+        close(sFeeders[i].fd);
+        unlink(path);
+        delete sFeeders[i].playback;
+    }
+    rmdir(dir);
+    return 0;
+}
@@ -20,20 +20,36 @@
 #include <dirent.h>
 #include <math.h>
 
-#include <poll.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
 
 #include <linux/input.h>
 
 #include <cutils/atomic.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 
 #include "nusensors.h"
+#include "BatchBuffer.h"
+#include "InputDeviceIndex.h"
+#include "InputEventReader.h"
+#include "InputRecorder.h"
+#include "PowerManager.h"
+#include "SensorTrace.h"
 #include "AccelerationSensor.h"
 #include "LightSensor.h"
 #include "AkmSensor.h"
 #include "PressureSensor.h"
 #include "GyroSensor.h"
+#include "FusionSensor.h"
+#include "MotionSensor.h"
+#include "DirectChannel.h"
+#include "SensorReader.h"
+#include "DebugFile.h"
 
 /*****************************************************************************/
 
@@ -44,7 +60,9 @@ struct sensors_poll_context_t {
         ~sensors_poll_context_t();
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
+    int batch(int handle, int64_t ns);
     int pollEvents(sensors_event_t* data, int count);
+    int dump(char* buf, size_t size);
 
 private:
     enum {
@@ -53,15 +71,172 @@ private:
 	akm		= 2,
 	pressure	= 3,
 	gyro		= 4,
+	fusion		= 5,
+	motion		= 6,
         numSensorDrivers,
-        numFds,
     };
 
-    static const size_t wake = numFds - 1;
-    static const char WAKE_MESSAGE = 'W';
-    struct pollfd mPollFds[numFds];
-    int mWritePipeFd;
+    enum {
+        numHandles      = ID_GU + 1,
+        // the drivers plus the wake, timer, inotify and reader fds
+        numPollFds      = numSensorDrivers + 4,
+        // EVDEV_BUFFER_SIZE of the kernels this runs on: what a parked
+        // driver's queue holds before the oldest samples get overwritten
+        evdevQueueEvents = 64,
+    };
+
+    static const uint32_t kFusionHandles = (1<<ID_RV) | (1<<ID_GR) | (1<<ID_LA);
+    // physical handles the virtual ones are computed from
+    static const uint32_t kFusionInputs = (1<<ID_A) | (1<<ID_M) | (1<<ID_G);
+    static const uint32_t kMotionHandles = (1<<ID_SM) | (1<<ID_SD) | (1<<ID_SC);
+    static const uint32_t kMotionInputs = (1<<ID_A);
+
+    // epoll_event.data.ptr of the non-driver fds. Drivers are registered
+    // with a pointer to their SensorBase, so these only need to be distinct.
+    static char sWakeTag;
+    static char sTimerTag;
+    static char sInputTag;
+    static char sReaderTag;
+
+    int mEpollFd;
+    int mWakeFd;
+    int mTimerFd;
+    int mInotifyFd;
+    // ro.sensors.reader_threads: the hot drivers are read on threads of
+    // their own, see SensorReader.h. mReaderFd is their notification.
+    bool mThreaded;
+    int mReaderCpu;
+    int mReaderFd;
+    SensorReader* mReaders[numSensorDrivers];
+    // drivers are only constructed when first used, see getDriver()
     SensorBase* mSensors[numSensorDrivers];
+    // drivers registered with epoll, i.e. with at least one handle enabled.
+    // Poll thread only, like mReady and the reader threads: the others
+    // queue their changes in mPendingDrivers, see updateRegistration()
+    SensorBase* mActive[numSensorDrivers];
+    int mNumActive;
+    // how the active drivers were registered, one bit per driver index:
+    // read on a reader thread, or batching on this one. The live
+    // isBatching() follows batch() on the binder threads.
+    uint32_t mOnReader;
+    uint32_t mBatching;
+    // drivers that reported data and haven't been fully drained yet
+    SensorBase* mReady[numSensorDrivers];
+    int mNumReady;
+    // handles the framework asked for vs handles actually running, which
+    // also includes the inputs of the virtual sensors
+    uint32_t mRequestedHandles;
+    uint32_t mEnabledHandles;
+    // drivers whose registration the poll thread has to re-evaluate,
+    // one bit per driver index, only changed with mLock held
+    volatile int32_t mPendingDrivers;
+    // handles resumed within their hold time, for SensorBase::resume()
+    uint32_t mResumedHandles;
+    // serializes the binder threads with each other and with the poll
+    // thread; mChannels is only written by the poll thread, under mLock,
+    // so its own unlocked reads are safe
+    pthread_mutex_t mLock;
+    DirectChannelServer mDirectServer;
+    DirectChannel* mChannels[DirectChannelServer::maxChannels];
+    int mNumChannels;
+    int64_t mLatencies[numHandles];
+    // what the timer is armed for, the batch part of it, and when the
+    // parked drivers' kernel queues have to be moved to their batches
+    int64_t mTimerDeadline;
+    int64_t mBatchDeadline;
+    int64_t mDrainDeadline;
+    bool mParked;
+    // poll thread statistics, see dump()
+    uint32_t mNumPolls;
+    uint32_t mNumWakeups;
+    uint32_t mWindowWakeups;
+    uint32_t mWakeupRate;
+    int64_t mWindowStart;
+    int64_t mStatsInterval;
+    int64_t mLastStats;
+    // debug.sensors.record=1 records the raw input streams, see
+    // InputRecorder.h
+    bool mRecording;
+    pthread_t mScreenThread;
+    volatile int32_t mScreenOff;
+
+    // held-off disables and the idle rate cap, see PowerManager.h. The
+    // client is a member so that the context itself has no vtable in
+    // front of device.
+    struct IdleHandler : public PowerManager::Client {
+        sensors_poll_context_t* ctx;
+        virtual void onIdle(bool idle);
+    };
+    friend struct IdleHandler;
+    PowerManager mPower;
+    IdleHandler mIdleHandler;
+
+    static void* screenStateThread(void* arg);
+    SensorBase* getDriver(int index);
+    int applyLatency(int index, int handle);
+    void sendWakeMessage();
+    int enableHandle(int handle, int enabled);
+    int switchHandle(int handle, int enabled);
+    void expireHandles(int64_t now);
+    void setIdle(bool idle);
+    int applyHandles(uint32_t requested, int handle);
+    void updateDirectChannels();
+    void updateClientRates();
+    void updateRegistration(int index);
+    void applyRegistrations();
+    void addDriver(int index);
+    void setBatching(int index, bool batching);
+    void removeDriver(int slot);
+    void detachDriver(SensorBase* sensor);
+    void handleReaders();
+    bool readersPending() const;
+    int mergeReaders(sensors_event_t* data, int count);
+    void handleInputChange();
+    int dispatch(sensors_event_t* data, int count);
+    int deliver(sensors_event_t* data, int count);
+    void setReady(SensorBase* sensor);
+    void clearReady(int slot);
+    void updateParking();
+    int fillBatch(SensorBase* sensor, int64_t now);
+    int flushBatches(sensors_event_t* data, int count, int64_t now, bool all);
+    void updateBatchTimer(int64_t now);
+    void updateStats(sensors_event_t const* data, int count, int64_t now);
+    void finishOneShot();
+
+    // drivers computing their events from the others' instead of a device
+    static bool isVirtual(int index) {
+        return index == fusion || index == motion;
+    }
+
+    static bool isBatching(SensorBase const* sensor) {
+        return sensor->getMaxLatency() && sensor->getBatchBuffer();
+    }
+
+    // the high rate drivers, which get a reader thread in threaded mode
+    static bool isHot(int index) {
+        return index == acceleration || index == akm || index == gyro;
+    }
+
+    // batching drivers stay on the poll thread, parking relies on it
+    bool wantsReader(int index) const {
+        return mThreaded && isHot(index) && !isBatching(mSensors[index]);
+    }
+
+    int driverIndex(SensorBase const* sensor) const {
+        for (int i=0 ; i<numSensorDrivers ; i++) {
+            if (mSensors[i] == sensor)
+                return i;
+        }
+        return -1;
+    }
+
+    // poll thread only, what the driver was registered as
+    bool onReader(SensorBase const* sensor) const {
+        return mOnReader & (1<<driverIndex(sensor));
+    }
+    bool batches(SensorBase const* sensor) const {
+        return mBatching & (1<<driverIndex(sensor));
+    }
 
     int handleToDriver(int handle) const {
         switch (handle) {
@@ -69,140 +244,1231 @@ private:
                 return acceleration;
             case ID_M:
             case ID_O:
+            case ID_MU:
                 return akm;
             case ID_G:
+            case ID_GU:
                 return gyro;
             case ID_L:
                 return light;
 	    case ID_B:
+	    case ID_ALT:
                 return pressure;
+            case ID_RV:
+            case ID_GR:
+            case ID_LA:
+                return fusion;
+            case ID_SM:
+            case ID_SD:
+            case ID_SC:
+                return motion;
         }
         return -EINVAL;
     }
 };
 
+char sensors_poll_context_t::sWakeTag;
+char sensors_poll_context_t::sTimerTag;
+char sensors_poll_context_t::sInputTag;
+char sensors_poll_context_t::sReaderTag;
+
+static int64_t monotonicNow()
+{
+    struct timespec t;
+    t.tv_sec = t.tv_nsec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
 /*****************************************************************************/
 
 sensors_poll_context_t::sensors_poll_context_t()
+    : mNumActive(0),
+      mOnReader(0),
+      mBatching(0),
+      mNumReady(0),
+      mRequestedHandles(0),
+      mEnabledHandles(0),
+      mPendingDrivers(0),
+      mResumedHandles(0),
+      mNumChannels(0),
+      mTimerDeadline(0),
+      mBatchDeadline(0),
+      mDrainDeadline(0),
+      mParked(false),
+      mNumPolls(0),
+      mNumWakeups(0),
+      mWindowWakeups(0),
+      mWakeupRate(0),
+      mWindowStart(0),
+      mStatsInterval(0),
+      mLastStats(0)
 {
-    mSensors[acceleration] = new AccelerationSensor();
-    mPollFds[acceleration].fd = mSensors[acceleration]->getFd();
-    mPollFds[acceleration].events = POLLIN;
-    mPollFds[acceleration].revents = 0;
+    pthread_mutex_init(&mLock, NULL);
+
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        mSensors[i] = NULL;
+        mReaders[i] = NULL;
+    }
+
+    mEpollFd = epoll_create(numPollFds);
+    LOGE_IF(mEpollFd<0, "error creating epoll fd (%s)", strerror(errno));
 
-    mSensors[light] = new LightSensor();
-    mPollFds[light].fd = mSensors[light]->getFd();
-    mPollFds[light].events = POLLIN;
-    mPollFds[light].revents = 0;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
 
-    mSensors[akm] = new AkmSensor();
-    mPollFds[akm].fd = mSensors[akm]->getFd();
-    mPollFds[akm].events = POLLIN;
-    mPollFds[akm].revents = 0;
+    mWakeFd = eventfd(0, EFD_NONBLOCK);
+    LOGE_IF(mWakeFd<0, "error creating wake eventfd (%s)", strerror(errno));
+    ev.data.ptr = &sWakeTag;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev);
 
-    mSensors[pressure] = new PressureSensor();
-    mPollFds[pressure].fd = mSensors[pressure]->getFd();
-    mPollFds[pressure].events = POLLIN;
-    mPollFds[pressure].revents = 0;
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    LOGE_IF(mTimerFd<0, "error creating batch timer (%s)", strerror(errno));
+    ev.data.ptr = &sTimerTag;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &ev);
+
+    // the AKM8975 and BMP085 sometimes probe after the HAL is up; ueventd
+    // creates the node then fixes its permissions, so watch both
+    mInotifyFd = inotify_init();
+    if (mInotifyFd >= 0) {
+        fcntl(mInotifyFd, F_SETFL, O_NONBLOCK);
+        if (inotify_add_watch(mInotifyFd, "/dev/input",
+                IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+            LOGE("error watching /dev/input (%s)", strerror(errno));
+        }
+        ev.data.ptr = &sInputTag;
+        epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mInotifyFd, &ev);
+    } else {
+        LOGE("error creating inotify fd (%s)", strerror(errno));
+    }
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.sensors.reader_threads", value, "0");
+    mThreaded = atoi(value) != 0;
+    // cpu0 is never hotplugged, -1 leaves the readers unpinned
+    property_get("ro.sensors.reader_cpu", value, "0");
+    mReaderCpu = atoi(value);
+    mReaderFd = -1;
+    if (mThreaded) {
+        mReaderFd = eventfd(0, EFD_NONBLOCK);
+        if (mReaderFd < 0) {
+            LOGE("error creating reader eventfd (%s)", strerror(errno));
+            mThreaded = false;
+        } else {
+            ev.data.ptr = &sReaderTag;
+            epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mReaderFd, &ev);
+        }
+    }
+
+    // batching is opt-in; ro.sensors.max_latency (in ms) applies to the
+    // high rate sensors only, which are the ones keeping the AP awake
+    for (int i=0 ; i<numHandles ; i++)
+        mLatencies[i] = 0;
+    property_get("ro.sensors.max_latency", value, "0");
+    int64_t latency = int64_t(atoi(value)) * 1000000LL;
+    if (latency > 0) {
+        batch(ID_A, latency);
+        batch(ID_G, latency);
+    }
+
+    mScreenOff = 0;
+    if (pthread_create(&mScreenThread, NULL, screenStateThread, this)) {
+        LOGE("error creating screen state thread");
+        mScreenThread = 0;
+    }
 
-    mSensors[gyro] = new GyroSensor();
-    mPollFds[gyro].fd = mSensors[gyro]->getFd();
-    mPollFds[gyro].events = POLLIN;
-    mPollFds[gyro].revents = 0;
+    // debug.sensors.stats=N logs the counters every N seconds
+    property_get("debug.sensors.stats", value, "0");
+    mStatsInterval = int64_t(atoi(value)) * 1000000000LL;
+    SensorTrace::init();
+    property_get("debug.sensors.record", value, "0");
+    mRecording = atoi(value) && debugCapturesAllowed();
 
-    int wakeFds[2];
-    int result = pipe(wakeFds);
-    LOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
-    fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
-    fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
-    mWritePipeFd = wakeFds[1];
+    int err = mDirectServer.start(mWakeFd);
+    LOGW_IF(err, "direct report channels unavailable (%s)", strerror(-err));
 
-    mPollFds[wake].fd = wakeFds[0];
-    mPollFds[wake].events = POLLIN;
-    mPollFds[wake].revents = 0;
+    mIdleHandler.ctx = this;
+    err = mPower.start(&mIdleHandler);
+    LOGE_IF(err, "error creating idle watchdog (%s)", strerror(-err));
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
+    for (int i=0 ; i<mNumChannels ; i++) {
+        delete mChannels[i];
+    }
+    // the readers stop before the drivers they read go away
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        delete mReaders[i];
+    }
     for (int i=0 ; i<numSensorDrivers ; i++) {
         delete mSensors[i];
     }
-    close(mPollFds[wake].fd);
-    close(mWritePipeFd);
+    pthread_mutex_destroy(&mLock);
+    SensorTrace::close();
+    if (mInotifyFd >= 0)
+        close(mInotifyFd);
+    if (mReaderFd >= 0)
+        close(mReaderFd);
+    close(mTimerFd);
+    close(mWakeFd);
+    close(mEpollFd);
 }
 
-int sensors_poll_context_t::activate(int handle, int enabled) {
+/*
+ * Opening a driver means finding its input node and probing the chip, and
+ * system_server opens the HAL on the boot critical path, so a driver is
+ * only constructed the first time one of its handles is used. Callers
+ * hold mLock.
+ */
+SensorBase* sensors_poll_context_t::getDriver(int index)
+{
+    if (mSensors[index])
+        return mSensors[index];
+    switch (index) {
+        case acceleration:  mSensors[index] = new AccelerationSensor(); break;
+        case light:         mSensors[index] = new LightSensor();        break;
+        case akm:           mSensors[index] = new AkmSensor();          break;
+        case pressure:      mSensors[index] = new PressureSensor();     break;
+        case gyro:          mSensors[index] = new GyroSensor();         break;
+        case fusion:        mSensors[index] = new FusionSensor();       break;
+        case motion:        mSensors[index] = new MotionSensor();       break;
+    }
+    // batch() may have been called before the driver existed
+    applyLatency(index, -1);
+    if (mPower.isIdle())
+        mSensors[index]->setRateCap(PowerManager::kIdlePeriod);
+    InputEventCircularReader* reader(mSensors[index]->getInputReader());
+    if (reader && mRecording)
+        reader->setRecorder(new InputRecorder(mSensors[index]->getName()));
+    return mSensors[index];
+}
+
+/*
+ * The framework of this era doesn't tell the HAL about the display, so
+ * follow the same early-suspend files SurfaceFlinger blocks on. The thread
+ * is detached for the life of the process, like the HAL module itself.
+ */
+void* sensors_poll_context_t::screenStateThread(void* arg)
+{
+    sensors_poll_context_t* ctx = static_cast<sensors_poll_context_t*>(arg);
+    static const char* const kSleep = "/sys/power/wait_for_fb_sleep";
+    static const char* const kWake = "/sys/power/wait_for_fb_wake";
+    pthread_detach(pthread_self());
+    while (true) {
+        const char* path = ctx->mScreenOff ? kWake : kSleep;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            LOGW("%s not available, batching ignores the screen state", path);
+            return NULL;
+        }
+        char buf;
+        int err;
+        do {
+            err = read(fd, &buf, 1);
+        } while (err < 0 && errno == EINTR);
+        close(fd);
+        if (err < 0)
+            return NULL;
+        android_atomic_release_store(!ctx->mScreenOff, &ctx->mScreenOff);
+        ctx->sendWakeMessage();
+    }
+    return NULL;
+}
+
+void sensors_poll_context_t::sendWakeMessage()
+{
+    int result = eventfd_write(mWakeFd, 1);
+    LOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+}
+
+/*
+ * Only drivers with an enabled handle are watched, so a disabled driver
+ * costs nothing in the poll loop. A driver moves between the poll thread
+ * and a reader thread when its batching changes.
+ * Callers hold mLock. This only queues the change, the poll thread applies
+ * it in applyRegistrations(); callers on a binder thread wake it up.
+ */
+void sensors_poll_context_t::updateRegistration(int index)
+{
+    android_atomic_release_store(mPendingDrivers | (1<<index), &mPendingDrivers);
+}
+
+/*
+ * Poll thread only: bring mActive and the reader threads in line with the
+ * handles enabled by now.
+ */
+void sensors_poll_context_t::applyRegistrations()
+{
+    if (!android_atomic_acquire_load(&mPendingDrivers))
+        return;
+    pthread_mutex_lock(&mLock);
+    const uint32_t pending = mPendingDrivers;
+    android_atomic_release_store(0, &mPendingDrivers);
+    for (int index=0 ; index<numSensorDrivers ; index++) {
+        if (!(pending & (1<<index)))
+            continue;
+        SensorBase* const sensor(mSensors[index]);
+        bool enabled = false;
+        for (int h=0 ; h<numHandles ; h++) {
+            if ((mEnabledHandles & (1<<h)) && handleToDriver(h) == index)
+                enabled = true;
+        }
+
+        int slot = -1;
+        for (int i=0 ; i<mNumActive ; i++) {
+            if (mActive[i] == sensor)
+                slot = i;
+        }
+        if (sensor->getFd() < 0)
+            continue;
+        if (enabled && slot >= 0 && wantsReader(index) == onReader(sensor)) {
+            if (!onReader(sensor))
+                setBatching(index, isBatching(sensor));
+            continue;
+        }
+        if (slot >= 0)
+            removeDriver(slot);
+        if (enabled)
+            addDriver(index);
+    }
+    // the drivers read on this thread, so they re-arm here
+    for (int h=0 ; h<numHandles ; h++) {
+        if (!(mResumedHandles & (1<<h)))
+            continue;
+        SensorBase* const sensor(mSensors[handleToDriver(h)]);
+        sensor->resume(h);
+        if (!onReader(sensor) && sensor->hasPendingEvents())
+            setReady(sensor);
+    }
+    mResumedHandles = 0;
+    pthread_mutex_unlock(&mLock);
+}
+
+void sensors_poll_context_t::addDriver(int index)
+{
+    SensorBase* const sensor(mSensors[index]);
+    if (wantsReader(index)) {
+        if (!mReaders[index])
+            mReaders[index] = new SensorReader(sensor, mReaderFd, mReaderCpu);
+        int err = mReaders[index]->start();
+        if (!err) {
+            mOnReader |= 1<<index;
+            mActive[mNumActive++] = sensor;
+            return;
+        }
+        LOGE("error starting %s reader (%s), reading it inline",
+                sensor->getName(), strerror(-err));
+    }
+
+    const bool batching = isBatching(sensor);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (mParked && batching) ? 0 : EPOLLIN;
+    ev.data.ptr = sensor;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, sensor->getFd(), &ev) < 0) {
+        LOGE("error adding sensor fd to epoll (%s)", strerror(errno));
+        return;
+    }
+    if (batching)
+        mBatching |= 1<<index;
+    mActive[mNumActive++] = sensor;
+}
+
+/*
+ * A driver staying on the poll thread started or stopped batching: a
+ * parked one has to get its events back, or lose them.
+ */
+void sensors_poll_context_t::setBatching(int index, bool batching)
+{
+    SensorBase* const sensor(mSensors[index]);
+    if (batching == batches(sensor))
+        return;
+    if (batching)
+        mBatching |= 1<<index;
+    else
+        mBatching &= ~(1<<index);
+    if (!mParked)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = batching ? 0 : EPOLLIN;
+    ev.data.ptr = sensor;
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, sensor->getFd(), &ev);
+}
+
+void sensors_poll_context_t::removeDriver(int slot)
+{
+    SensorBase* const sensor(mActive[slot]);
+    const int index = driverIndex(sensor);
+    mActive[slot] = mActive[--mNumActive];
+
+    if (onReader(sensor)) {
+        // what it read so far is still merged from its ring
+        mOnReader &= ~(1<<index);
+        mReaders[index]->stop();
+        return;
+    }
+    mBatching &= ~(1<<index);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, sensor->getFd(), &ev);
+    // anything still buffered goes out through the batch flush
+    for (int i=0 ; i<mNumReady ; i++) {
+        if (mReady[i] == sensor) {
+            clearReady(i);
+            break;
+        }
+    }
+}
+
+/*
+ * The driver's input node went away: stop polling it. It gets re-attached
+ * by handleInputChange() if the node comes back.
+ */
+void sensors_poll_context_t::detachDriver(SensorBase* sensor)
+{
+    for (int i=0 ; i<mNumActive ; i++) {
+        if (mActive[i] == sensor) {
+            removeDriver(i);
+            break;
+        }
+    }
+    for (int i=0 ; i<mNumReady ; i++) {
+        if (mReady[i] == sensor) {
+            clearReady(i);
+            break;
+        }
+    }
+    sensor->detachInput();
+    InputDeviceIndex::invalidate();
+}
+
+/*
+ * Poll thread only: a reader saw its device hang up.
+ */
+void sensors_poll_context_t::handleReaders()
+{
+    eventfd_t msg;
+    eventfd_read(mReaderFd, &msg);
+    pthread_mutex_lock(&mLock);
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if ((mOnReader & (1<<i)) && mReaders[i]->hungUp())
+            detachDriver(mSensors[i]);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+bool sensors_poll_context_t::readersPending() const
+{
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (mReaders[i] && mReaders[i]->available())
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Poll thread only: move the events of all reader rings into data, oldest
+ * timestamp first across the rings. Each ring is in timestamp order
+ * already, so this is a k-way merge over at most three heads.
+ * Returns the number of events taken.
+ */
+int sensors_poll_context_t::mergeReaders(sensors_event_t* data, int count)
+{
+    SensorReader* readers[numSensorDrivers];
+    size_t avail[numSensorDrivers];
+    size_t taken[numSensorDrivers];
+    int k = 0;
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (!mReaders[i])
+            continue;
+        avail[k] = mReaders[i]->available();
+        if (!avail[k])
+            continue;
+        taken[k] = 0;
+        readers[k++] = mReaders[i];
+    }
+
+    int n = 0;
+    while (n < count && k) {
+        int best = 0;
+        for (int r=1 ; r<k ; r++) {
+            if (readers[r]->at(taken[r]).timestamp <
+                    readers[best]->at(taken[best]).timestamp)
+                best = r;
+        }
+        data[n++] = readers[best]->at(taken[best]++);
+        if (taken[best] == avail[best]) {
+            readers[best]->consume(taken[best]);
+            k--;
+            readers[best] = readers[k];
+            avail[best] = avail[k];
+            taken[best] = taken[k];
+        }
+    }
+    for (int r=0 ; r<k ; r++)
+        readers[r]->consume(taken[r]);
+    return n;
+}
+
+/*
+ * Poll thread only: something changed in /dev/input. Removed nodes are
+ * noticed separately through EPOLLHUP on their fd; here drivers without a
+ * node try to find theirs again.
+ */
+void sensors_poll_context_t::handleInputChange()
+{
+    char buf[512];
+    bool added = false;
+    ssize_t n;
+    while ((n = read(mInotifyFd, buf, sizeof(buf))) > 0) {
+        for (ssize_t offset=0 ; offset + ssize_t(sizeof(inotify_event)) <= n ; ) {
+            const inotify_event* event =
+                    reinterpret_cast<const inotify_event*>(buf + offset);
+            if (event->mask & (IN_CREATE | IN_ATTRIB))
+                added = true;
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+    InputDeviceIndex::invalidate();
+    if (!added)
+        return;
+
+    pthread_mutex_lock(&mLock);
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        SensorBase* const sensor(mSensors[i]);
+        if (!sensor || sensor->hasInput())
+            continue;
+        if (!sensor->attachInput()) {
+            LOGI("input device of sensor driver %d attached", i);
+            updateRegistration(i);
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void sensors_poll_context_t::setReady(SensorBase* sensor)
+{
+    for (int i=0 ; i<mNumReady ; i++) {
+        if (mReady[i] == sensor)
+            return;
+    }
+    mReady[mNumReady++] = sensor;
+}
+
+void sensors_poll_context_t::clearReady(int slot)
+{
+    mReady[slot] = mReady[--mNumReady];
+}
+
+/*
+ * Apps register and unregister listeners in bursts (every onPause(), every
+ * rotation), so switching a physical handle off is held off for a while
+ * and switching it back on within that costs nothing: the device stays
+ * open and its enable ioctl isn't re-run. Its rate stops counting
+ * straight away. expireHandles() does the real switching off.
+ */
+int sensors_poll_context_t::enableHandle(int handle, int enabled) {
     int index = handleToDriver(handle);
-    if (index < 0) return index;
-    int err =  mSensors[index]->enable(handle, enabled);
+    if (index < 0 || isVirtual(index) || !mPower.holds())
+        return switchHandle(handle, enabled);
+    if (enabled) {
+        if (!mPower.resume(handle))
+            return switchHandle(handle, 1);
+        mSensors[index]->setActive(handle, 1);
+        mResumedHandles |= 1<<handle;
+        updateRegistration(index);
+        return 0;
+    }
+    if (!(mEnabledHandles & (1<<handle)) || mPower.isLingering(handle))
+        return 0;
+    mPower.linger(handle, monotonicNow());
+    mSensors[index]->setActive(handle, 0);
+    return 0;
+}
+
+int sensors_poll_context_t::switchHandle(int handle, int enabled) {
+    int index = handleToDriver(handle);
+    if (index < 0 || !(mEnabledHandles & (1<<handle)) == !enabled)
+        return 0;
+    int err = getDriver(index)->enable(handle, enabled);
     if (!err && handle == ID_O) {
         err = static_cast<AccelerationSensor*>(
-                mSensors[acceleration])->enableOrientation(enabled);
+                getDriver(acceleration))->enableOrientation(enabled);
+    }
+    if (!err) {
+        if (enabled)
+            mEnabledHandles |= 1<<handle;
+        else
+            mEnabledHandles &= ~(1<<handle);
+        mSensors[index]->setActive(handle, enabled);
+        updateRegistration(index);
+    }
+    return err;
+}
+
+/*
+ * Poll thread only: switch off the handles whose hold time is over.
+ */
+void sensors_poll_context_t::expireHandles(int64_t now)
+{
+    pthread_mutex_lock(&mLock);
+    const uint32_t expired = mPower.expired(now);
+    for (int h=0 ; h<numHandles ; h++) {
+        if (!(expired & (1<<h)))
+            continue;
+        mPower.clear(h);
+        int err = switchHandle(h, 0);
+        LOGE_IF(err, "error disabling sensor %d (%s)", h, strerror(-err));
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * Nobody has been reading events for ro.sensors.idle_timeout (or somebody
+ * is again): clock every driver down in the meantime, whatever the
+ * framework asked for.
+ */
+void sensors_poll_context_t::setIdle(bool idle)
+{
+    pthread_mutex_lock(&mLock);
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (mSensors[i])
+            mSensors[i]->setRateCap(idle ? PowerManager::kIdlePeriod : 0);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void sensors_poll_context_t::IdleHandler::onIdle(bool idle)
+{
+    ctx->setIdle(idle);
+}
+
+/*
+ * Bring the running handles in line with what the framework requested
+ * plus whatever the virtual sensors and the direct channels need. Returns
+ * the error of enabling or disabling the given handle, if any.
+ */
+int sensors_poll_context_t::applyHandles(uint32_t requested, int handle) {
+    uint32_t wanted = requested;
+    if (requested & kFusionHandles)
+        wanted |= kFusionInputs;
+    if (requested & kMotionHandles)
+        wanted |= kMotionInputs;
+    for (int i=0 ; i<mNumChannels ; i++)
+        wanted |= 1<<mChannels[i]->getHandle();
+
+    // bring the inputs up before the virtual sensors reading them, and
+    // take them down after
+    int err = 0;
+    for (int h=0 ; h<numHandles ; h++) {
+        if ((wanted & (1<<h)) && !isVirtual(handleToDriver(h))) {
+            int e = enableHandle(h, 1);
+            if (h == handle) err = e;
+        }
     }
-    if (enabled && !err) {
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        LOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+    for (int h=0 ; h<numHandles ; h++) {
+        if (isVirtual(handleToDriver(h))) {
+            int e = enableHandle(h, wanted & (1<<h));
+            if (h == handle) err = e;
+        }
+    }
+    for (int h=0 ; h<numHandles ; h++) {
+        if (!(wanted & (1<<h)) && !isVirtual(handleToDriver(h))) {
+            int e = enableHandle(h, 0);
+            if (h == handle) err = e;
+        }
+    }
+    updateClientRates();
+    return err;
+}
+
+/*
+ * The virtual sensors and the direct channels compete for the rate of the
+ * physical drivers as clients of their own, next to the framework handles.
+ */
+void sensors_poll_context_t::updateClientRates()
+{
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        if (!mSensors[i])
+            continue;
+        int active = 0;
+        int64_t period = 0;
+        for (int c=0 ; c<mNumChannels ; c++) {
+            if (handleToDriver(mChannels[c]->getHandle()) != i)
+                continue;
+            const int64_t ns = mChannels[c]->getPeriod();
+            if (!active || ns < period)
+                period = ns;
+            active = 1;
+        }
+        mSensors[i]->setClientDelay(SensorBase::CLIENT_DIRECT, active, period);
+    }
+
+    MotionSensor* const motionSensor(static_cast<MotionSensor*>(mSensors[motion]));
+    if (motionSensor && mSensors[acceleration]) {
+        mSensors[acceleration]->setClientDelay(SensorBase::CLIENT_MOTION,
+                motionSensor->isEnabled(), motionSensor->getInputPeriod());
+    }
+
+    SensorBase* const fusionSensor(mSensors[fusion]);
+    if (!fusionSensor)
+        return;
+    const int fusing = static_cast<FusionSensor*>(fusionSensor)->isEnabled();
+    for (int h=0 ; h<numHandles ; h++) {
+        if ((kFusionInputs & (1<<h)) && mSensors[handleToDriver(h)]) {
+            mSensors[handleToDriver(h)]->setClientDelay(SensorBase::CLIENT_FUSION,
+                    fusing, fusionSensor->getDevicePeriod());
+        }
+    }
+}
+
+int sensors_poll_context_t::activate(int handle, int enabled) {
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+
+    pthread_mutex_lock(&mLock);
+    uint32_t requested = mRequestedHandles;
+    if (enabled)
+        requested |= 1<<handle;
+    else
+        requested &= ~(1<<handle);
+    int err = applyHandles(requested, handle);
+    if (!err)
+        mRequestedHandles = requested;
+    pthread_mutex_unlock(&mLock);
+
+    // a disable may have started a hold time the timer has to cover
+    if (!err) {
+        sendWakeMessage();
     }
     return err;
 }
 
+/*
+ * Poll thread only: pick up channels the server accepted, drop the ones
+ * whose client went away, and adjust the running handles to match.
+ */
+void sensors_poll_context_t::updateDirectChannels()
+{
+    DirectChannel* added[DirectChannelServer::maxChannels];
+    bool changed = false;
+    // applyHandles() and updateClientRates() walk the channels from the
+    // binder threads, the list only changes with mLock held
+    pthread_mutex_lock(&mLock);
+    for (int i=0 ; i<mNumChannels ; ) {
+        if (mChannels[i]->isClosed()) {
+            delete mChannels[i];
+            mChannels[i] = mChannels[--mNumChannels];
+            changed = true;
+            continue;
+        }
+        i++;
+    }
+    size_t n = mDirectServer.collect(added,
+            DirectChannelServer::maxChannels - mNumChannels);
+    for (size_t i=0 ; i<n ; i++) {
+        mChannels[mNumChannels++] = added[i];
+        changed = true;
+    }
+    if (changed)
+        applyHandles(mRequestedHandles, -1);
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * Every event read from a physical driver goes through here: the virtual
+ * sensors and direct channels get to see it at the full device rate, then
+ * it goes through deliver().
+ * Returns the number of events kept, compacted at the front of data.
+ */
+int sensors_poll_context_t::dispatch(sensors_event_t* data, int count)
+{
+    FusionSensor* const fusionSensor(static_cast<FusionSensor*>(mSensors[fusion]));
+    if (fusionSensor && fusionSensor->isEnabled()) {
+        fusionSensor->process(data, count);
+        if (fusionSensor->hasPendingEvents())
+            setReady(fusionSensor);
+    }
+    MotionSensor* const motionSensor(static_cast<MotionSensor*>(mSensors[motion]));
+    if (motionSensor && motionSensor->isEnabled()) {
+        motionSensor->process(data, count);
+        if (motionSensor->hasPendingEvents())
+            setReady(motionSensor);
+    }
+    for (int c=0 ; c<mNumChannels ; c++) {
+        DirectChannel* const channel(mChannels[c]);
+        for (int i=0 ; i<count ; i++) {
+            if (data[i].sensor == channel->getHandle())
+                channel->write(data[i]);
+        }
+    }
+    return deliver(data, count);
+}
+
+/*
+ * Significant motion switched itself off once its event went out, the
+ * accelerometer may not be needed anymore either.
+ */
+void sensors_poll_context_t::finishOneShot()
+{
+    MotionSensor* const motionSensor(static_cast<MotionSensor*>(mSensors[motion]));
+    if (!motionSensor->takeTriggered())
+        return;
+    pthread_mutex_lock(&mLock);
+    mRequestedHandles &= ~(1<<ID_SM);
+    applyHandles(mRequestedHandles, -1);
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * Drop the events the framework didn't ask for: handles only running to
+ * feed a virtual sensor or a channel, and samples of a handle the device
+ * is clocked faster than for someone else.
+ */
+int sensors_poll_context_t::deliver(sensors_event_t* data, int count)
+{
+    int kept = 0;
+    for (int i=0 ; i<count ; i++) {
+        const int handle = data[i].sensor;
+        if (!(mRequestedHandles & (1<<handle)))
+            continue;
+        SensorBase* const sensor(mSensors[handleToDriver(handle)]);
+        if (!sensor->acceptSample(handle, data[i].timestamp)) {
+            sensor->getStats().decimated++;
+            continue;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    return kept;
+}
+
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
 
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+    pthread_mutex_lock(&mLock);
+    int err = getDriver(index)->setDelay(handle, ns);
+    if (!err && handle == ID_O) {
+        // akmd computes orientation from the shared KXTF9 stream
+        err = getDriver(acceleration)->setDelay(ID_O, ns);
+    }
+    if (!err && index == fusion) {
+        updateClientRates();
+    }
+    pthread_mutex_unlock(&mLock);
+    return err;
+}
+
+int sensors_poll_context_t::batch(int handle, int64_t ns) {
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    if (ns < 0) return -EINVAL;
+
+    pthread_mutex_lock(&mLock);
+    mLatencies[handle] = ns;
+    int err = mSensors[index] ? applyLatency(index, handle) : 0;
+    // a driver only batches on the poll thread
+    if (mSensors[index])
+        updateRegistration(index);
+    pthread_mutex_unlock(&mLock);
+    // parking depends on the latency, make sure the poll loop re-evaluates
+    sendWakeMessage();
+    return err;
+}
+
+int sensors_poll_context_t::applyLatency(int index, int handle) {
+    // a driver multiplexing several handles batches at the tightest latency
+    int64_t latency = -1;
+    for (int h=0 ; h<numHandles ; h++) {
+        if (handleToDriver(h) == index && (latency < 0 || mLatencies[h] < latency))
+            latency = mLatencies[h];
+    }
+    return mSensors[index]->batch(handle, latency);
+}
+
+/*
+ * Decode whatever the driver has queued into its batch buffer. Returns
+ * non-zero when the driver may still have data (the buffer filled up).
+ */
+int sensors_poll_context_t::fillBatch(SensorBase* sensor, int64_t now)
+{
+    BatchBuffer* const batch(sensor->getBatchBuffer());
+    sensors_event_t* slot;
+    size_t room;
+    while ((room = batch->writable(&slot)) != 0) {
+        int nb = sensor->readEvents(slot, room);
+        if (nb < int(room)) {
+            if (nb > 0)
+                batch->commit(dispatch(slot, nb), now);
+            return 0;
+        }
+        batch->commit(dispatch(slot, nb), now);
+    }
+    return 1;
+}
+
+int sensors_poll_context_t::flushBatches(sensors_event_t* data, int count,
+        int64_t now, bool all)
+{
+    int nbEvents = 0;
+    for (int i=0 ; count && i<numSensorDrivers ; i++) {
+        SensorBase* const sensor(mSensors[i]);
+        BatchBuffer* const batch(sensor ? sensor->getBatchBuffer() : NULL);
+        if (!batch || batch->empty())
+            continue;
+        if (all || batch->full() || !sensor->getMaxLatency() ||
+                now - batch->queuedSince() >= sensor->getMaxLatency()) {
+            int nb = batch->drain(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+    }
+    return nbEvents;
+}
+
+/*
+ * While the screen is off the batching drivers are parked: they stay
+ * registered but with no events, and the kernel input queue holds their
+ * samples until the batch timer fires. That queue is much smaller than
+ * the batch buffer, so the timer also fires in between to move it over,
+ * see updateBatchTimer().
+ */
+void sensors_poll_context_t::updateParking()
+{
+    const bool parked = android_atomic_acquire_load(&mScreenOff);
+    if (parked == mParked)
+        return;
+    mParked = parked;
+    for (int i=0 ; i<mNumActive ; i++) {
+        SensorBase* const sensor(mActive[i]);
+        if (!batches(sensor))
+            continue;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = parked ? 0 : EPOLLIN;
+        ev.data.ptr = sensor;
+        epoll_ctl(mEpollFd, EPOLL_CTL_MOD, sensor->getFd(), &ev);
+    }
+}
+
+/*
+ * Arm the timer for the earliest batch deadline, or the end of the
+ * earliest hold time if that comes first.
+ */
+void sensors_poll_context_t::updateBatchTimer(int64_t now)
+{
+    int64_t deadline = 0;
+    for (int i=0 ; i<mNumActive ; i++) {
+        SensorBase* const sensor(mActive[i]);
+        if (!batches(sensor))
+            continue;
+        BatchBuffer* const batch(sensor->getBatchBuffer());
+        const int64_t latency = sensor->getMaxLatency();
+        // an empty buffer keeps the deadline already armed, otherwise
+        // unrelated wakeups would keep pushing it out
+        int64_t due = batch->queuedSince() + latency;
+        if (batch->empty()) {
+            due = now + latency;
+            if (mBatchDeadline > now && mBatchDeadline < due)
+                due = mBatchDeadline;
+        }
+        if (!deadline || due < deadline)
+            deadline = due;
+    }
+    mBatchDeadline = deadline;
+
+    // a parked driver has to be read before its queue wraps, there's
+    // half of it as margin for timer slack
+    int64_t drain = 0;
+    for (int i=0 ; mParked && i<mNumActive ; i++) {
+        SensorBase* const sensor(mActive[i]);
+        const int64_t period = sensor->getDevicePeriod();
+        if (!batches(sensor) || !period)
+            continue;
+        const int64_t span = int64_t(evdevQueueEvents / sensor->getFrameEvents())
+                * period / 2;
+        int64_t due = now + span;
+        if (mDrainDeadline > now && mDrainDeadline < due)
+            due = mDrainDeadline;
+        if (!drain || due < drain)
+            drain = due;
+    }
+    mDrainDeadline = drain;
+    if (drain && (!deadline || drain < deadline))
+        deadline = drain;
+
+    pthread_mutex_lock(&mLock);
+    const int64_t hold = mPower.nextDeadline();
+    pthread_mutex_unlock(&mLock);
+    if (hold && (!deadline || hold < deadline))
+        deadline = hold;
+
+    if (deadline == mTimerDeadline)
+        return;
+    mTimerDeadline = deadline;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline) {
+        if (deadline <= now)
+            deadline = now + 1;
+        spec.it_value.tv_sec = deadline / 1000000000LL;
+        spec.it_value.tv_nsec = deadline % 1000000000LL;
+    }
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        LOGE("error arming batch timer (%s)", strerror(errno));
+    }
+}
+
+/*
+ * Account for the events pollEvents() is about to return. Poll thread
+ * only, like everything the counters are updated from.
+ */
+void sensors_poll_context_t::updateStats(sensors_event_t const* data, int count,
+        int64_t now)
+{
+    for (int i=0 ; i<count ; i++) {
+        SensorStats& stats(mSensors[handleToDriver(data[i].sensor)]->getStats());
+        stats.delivered++;
+        stats.addLatency(now - data[i].timestamp);
+    }
+    SensorTrace::record(data, count, now);
+    SensorTrace::counter("sensors:delivered", count);
+
+    if (now - mWindowStart >= 1000000000LL) {
+        mWakeupRate = int64_t(mWindowWakeups) * 1000000000LL / (now - mWindowStart);
+        mWindowWakeups = 0;
+        mWindowStart = now;
+    }
+    if (mStatsInterval && now - mLastStats >= mStatsInterval) {
+        char buf[2048];
+        mLastStats = now;
+        dump(buf, sizeof(buf));
+        LOGI("%s", buf);
+    }
+}
+
+int sensors_poll_context_t::dump(char* buf, size_t size)
+{
+    size_t len = snprintf(buf, size, "%u polls, %u wakeups, %u wakeups/s\n",
+            mNumPolls, mNumWakeups, mWakeupRate);
+    for (int i=0 ; i<numSensorDrivers && len<size ; i++) {
+        SensorBase* const sensor(mSensors[i]);
+        if (!sensor)
+            continue;
+        SensorStats const& stats(sensor->getStats());
+        len += snprintf(buf+len, size-len, "%s: delivered=%u decimated=%u",
+                sensor->getName(), stats.delivered, stats.decimated);
+        InputEventCircularReader const* reader(sensor->getInputReader());
+        if (reader && len<size) {
+            len += snprintf(buf+len, size-len,
+                    " reads=%u events=%u overruns=%u dropped=%u",
+                    reader->getNumReads(), reader->getNumEvents(),
+                    reader->getNumOverruns(), reader->getNumDropped());
+        }
+        if (mReaders[i] && len<size) {
+            len += snprintf(buf+len, size-len, " ring=%u notifies=%u stalls=%u",
+                    unsigned(mReaders[i]->available()),
+                    mReaders[i]->getNumNotifies(), mReaders[i]->getNumStalls());
+        }
+        // latency histogram, "<limit_us:count", only the non-empty buckets
+        for (int b=0 ; b<SensorStats::numLatencyBuckets && len<size ; b++) {
+            if (!stats.latency[b])
+                continue;
+            const int64_t limit = SensorStats::bucketLimit(b);
+            if (limit >= 0) {
+                len += snprintf(buf+len, size-len, " <%lldus:%u",
+                        (long long)(limit / 1000), stats.latency[b]);
+            } else {
+                len += snprintf(buf+len, size-len, " more:%u", stats.latency[b]);
+            }
+        }
+        if (len<size)
+            len += snprintf(buf+len, size-len, "\n");
+    }
+    return len<size ? len : size-1;
 }
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
+    sensors_event_t const* const first(data);
     int nbEvents = 0;
     int n = 0;
+    bool timerExpired = false;
+    bool drainParked = false;
+
+    mPower.pollStarted();
+    // the framework got whatever woke it up last time
+    if (mSensors[motion])
+        static_cast<MotionSensor*>(mSensors[motion])->releaseWakeLock();
+    for (int i=0 ; i<mNumActive ; i++) {
+        if (!onReader(mActive[i]) && mActive[i]->hasPendingEvents())
+            setReady(mActive[i]);
+    }
 
     do {
-        // see if we have some leftover from the last poll()
-        for (int i=0 ; count && i<numSensorDrivers ; i++) {
-            SensorBase* const sensor(mSensors[i]);
-            if ((mPollFds[i].revents & POLLIN) || (sensor->hasPendingEvents())) {
-                int nb = sensor->readEvents(data, count);
-                if (nb < count) {
-                    // no more data for this sensor
-                    mPollFds[i].revents = 0;
+        const int64_t now = monotonicNow();
+
+        // what activate() and batch() changed since, or this thread itself
+        applyRegistrations();
+
+        if (timerExpired || drainParked) {
+            // parked drivers are only read when the timer fires, their
+            // batches only go out at the deadline
+            for (int i=0 ; i<mNumActive ; i++) {
+                if (batches(mActive[i]))
+                    setReady(mActive[i]);
+            }
+        }
+
+        // what the reader threads decoded, in timestamp order
+        if (mThreaded && count) {
+            int nb = dispatch(data, mergeReaders(data, count));
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
+
+        // see if we have some leftover from the last poll(). Switching
+        // significant motion off may take its inputs down with it, which
+        // waits until the ready drivers have been read
+        bool oneShot = false;
+        for (int i=0 ; count && i<mNumReady ; ) {
+            SensorBase* const sensor(mReady[i]);
+            SensorTrace::begin(sensor->getName());
+            if (batches(sensor)) {
+                const int more = fillBatch(sensor, now);
+                SensorTrace::end();
+                if (!more) {
+                    clearReady(i);
+                    continue;
                 }
-                count -= nb;
-                nbEvents += nb;
-                data += nb;
+                i++;
+                continue;
+            }
+            int nb = sensor->readEvents(data, count);
+            SensorTrace::end();
+            if (nb < 0)
+                nb = 0;
+            const bool drained = nb < count;
+            if (sensor != mSensors[fusion] && sensor != mSensors[motion])
+                nb = dispatch(data, nb);
+            else
+                nb = deliver(data, nb);
+            if (sensor == mSensors[motion])
+                oneShot = true;
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+            if (drained) {
+                // no more data for this sensor
+                clearReady(i);
+                continue;
             }
+            i++;
         }
+        if (oneShot)
+            finishOneShot();
+
+        // hand out the batches whose deadline passed, or everything
+        // if the timer woke us up from a parked state
+        int nb = flushBatches(data, count, now, timerExpired);
+        count -= nb;
+        nbEvents += nb;
+        data += nb;
+        timerExpired = false;
+        drainParked = false;
 
         if (count) {
+            updateParking();
+            updateBatchTimer(now);
+
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
             // anything to return
-            n = poll(mPollFds, numFds, nbEvents ? 0 : -1);
+            // a ring that filled up again since the merge doesn't
+            // notify, the reader only does that for an empty ring
+            const bool pending = mThreaded && readersPending();
+            struct epoll_event events[numPollFds];
+            n = epoll_wait(mEpollFd, events, numPollFds,
+                    (nbEvents || pending) ? 0 : -1);
+            mNumPolls++;
+            if (n > 0) {
+                mNumWakeups++;
+                mWindowWakeups++;
+            }
             if (n<0) {
-                LOGE("poll() failed (%s)", strerror(errno));
-                return -errno;
+                if (errno == EINTR) {
+                    n = 1;
+                    continue;
+                }
+                const int err = -errno;
+                LOGE("epoll_wait() failed (%s)", strerror(errno));
+                mPower.pollReturned();
+                return err;
             }
-            if (mPollFds[wake].revents & POLLIN) {
-                char msg;
-                int result = read(mPollFds[wake].fd, &msg, 1);
-                LOGE_IF(result<0, "error reading from wake pipe (%s)", strerror(errno));
-                LOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
-                mPollFds[wake].revents = 0;
+            for (int i=0 ; i<n ; i++) {
+                void* const ptr = events[i].data.ptr;
+                if (ptr == &sWakeTag) {
+                    eventfd_t msg;
+                    int result = eventfd_read(mWakeFd, &msg);
+                    LOGE_IF(result<0, "error reading from wake eventfd (%s)", strerror(errno));
+                    updateDirectChannels();
+                } else if (ptr == &sTimerTag) {
+                    uint64_t expirations;
+                    read(mTimerFd, &expirations, sizeof(expirations));
+                    const int64_t now = monotonicNow();
+                    mTimerDeadline = 0;
+                    if (mBatchDeadline && now >= mBatchDeadline) {
+                        mBatchDeadline = 0;
+                        timerExpired = true;
+                    }
+                    if (mDrainDeadline && now >= mDrainDeadline) {
+                        mDrainDeadline = 0;
+                        drainParked = true;
+                    }
+                    expireHandles(now);
+                } else if (ptr == &sInputTag) {
+                    handleInputChange();
+                } else if (ptr == &sReaderTag) {
+                    handleReaders();
+                } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    // evdev hangs up the fds of a removed device
+                    pthread_mutex_lock(&mLock);
+                    detachDriver(static_cast<SensorBase*>(ptr));
+                    pthread_mutex_unlock(&mLock);
+                } else {
+                    setReady(static_cast<SensorBase*>(ptr));
+                }
             }
+            if (!n && pending)
+                n = 1;
         }
         // if we have events and space, go read them
     } while (n && count);
 
+    updateStats(first, nbEvents, monotonicNow());
+    mPower.pollReturned();
     return nbEvents;
 }
 
 /*****************************************************************************/
 
+// the open device, for sensors_poll_dump()
+static sensors_poll_context_t* sContext;
+
 static int poll__close(struct hw_device_t *dev)
 {
     sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
     if (ctx) {
+        if (sContext == ctx)
+            sContext = NULL;
         delete ctx;
     }
     return 0;
@@ -244,6 +1510,23 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device)
     dev->device.poll            = poll__poll;
 
     *device = &dev->device.common;
+    sContext = dev;
     status = 0;
     return status;
 }
+
+int sensors_poll_dump(int fd)
+{
+    if (!sContext)
+        return -ENODEV;
+    char buf[2048];
+    int len = sContext->dump(buf, sizeof(buf));
+    return write(fd, buf, len) < 0 ? -errno : 0;
+}
+
+int sensors_poll_batch(int handle, int64_t ns)
+{
+    if (!sContext)
+        return -ENODEV;
+    return sContext->batch(handle, ns);
+}
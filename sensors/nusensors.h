@@ -34,6 +34,19 @@ __BEGIN_DECLS
 
 int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
+/*
+ * Write the HAL's counters to fd as text. Not part of the HAL interface,
+ * debugging tools look it up with dlsym() on the module.
+ */
+int sensors_poll_dump(int fd);
+
+/*
+ * Set the max report latency of a handle, in ns, 0 for none. This HAL
+ * version has no batch entry point, ro.sensors.max_latency goes through
+ * here and tools can call it the same way as sensors_poll_dump().
+ */
+int sensors_poll_batch(int handle, int64_t ns);
+
 /*****************************************************************************/
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -46,6 +59,35 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 #define ID_L  (5)
 #define ID_B  (6)
 #define ID_G  (7)
+// virtual sensors computed in the HAL
+#define ID_RV (8)
+#define ID_GR (9)
+#define ID_LA (10)
+#define ID_SM (11)
+#define ID_SD (12)
+#define ID_SC (13)
+#define ID_ALT (14)
+#define ID_MU (15)
+#define ID_GU (16)
+
+// not in this framework's sensors.h yet, same values as later releases
+#ifndef SENSOR_TYPE_SIGNIFICANT_MOTION
+#define SENSOR_TYPE_SIGNIFICANT_MOTION  (17)
+#endif
+#ifndef SENSOR_TYPE_STEP_DETECTOR
+#define SENSOR_TYPE_STEP_DETECTOR       (18)
+#endif
+#ifndef SENSOR_TYPE_STEP_COUNTER
+#define SENSOR_TYPE_STEP_COUNTER        (19)
+#endif
+#ifndef SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED
+#define SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED (14)
+#endif
+#ifndef SENSOR_TYPE_GYROSCOPE_UNCALIBRATED
+#define SENSOR_TYPE_GYROSCOPE_UNCALIBRATED      (16)
+#endif
+// no framework type for it, so a vendor one: meters in data[0]
+#define SENSOR_TYPE_ALTITUDE            (0x10001)
 
 /*****************************************************************************/
 
@@ -116,6 +158,17 @@ int init_nusensors(hw_module_t const* module, hw_device_t** device);
 
 #define SENSOR_STATE_MASK           (0x7FFF)
 
+// the fusion outputs draw on all three of its inputs
+#define POWER_FUSION                (0.57f + 6.8f + 6.1f)
+// the motion detectors only need the accelerometer
+#define POWER_MOTION                (0.57f)
+
+// fastest sampling period of each device, in us
+#define MIN_DELAY_A                 (20000)
+#define MIN_DELAY_M                 (30000)
+#define MIN_DELAY_B                 (30000)
+#define MIN_DELAY_G                 (1250)
+
 /*****************************************************************************/
 
 __END_DECLS
@@ -29,7 +29,7 @@ static const struct sensor_t sSensorList[] = {
         { "KXTF9 3-axis Accelerometer",
                 "Kionix",
                 1, SENSORS_HANDLE_BASE+ID_A,
-                SENSOR_TYPE_ACCELEROMETER, MAX_RANGE_A, CONVERT_A, 0.57f, 20000, { } },
+                SENSOR_TYPE_ACCELEROMETER, MAX_RANGE_A, CONVERT_A, 0.57f, MIN_DELAY_A, { } },
 	{ "Ambient Light sensor",
                 "Maxim",
                 1, SENSORS_HANDLE_BASE+ID_L,
@@ -37,19 +37,55 @@ static const struct sensor_t sSensorList[] = {
 	{ "AK8975 3-axis Magnetic field sensor",
                 "Asahi Kasei",
                 1, SENSORS_HANDLE_BASE+ID_M,
-                SENSOR_TYPE_MAGNETIC_FIELD, 2000.0f, CONVERT_M, 6.8f, 30000, { } },
+                SENSOR_TYPE_MAGNETIC_FIELD, 2000.0f, CONVERT_M, 6.8f, MIN_DELAY_M, { } },
+	{ "AK8975 3-axis Magnetic field sensor (uncalibrated)",
+                "Asahi Kasei",
+                1, SENSORS_HANDLE_BASE+ID_MU,
+                SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED, 2000.0f, CONVERT_M, 6.8f, MIN_DELAY_M, { } },
 	{ "AK8975 Orientation sensor",
                 "Asahi Kasei",
                 1, SENSORS_HANDLE_BASE+ID_O,
-                SENSOR_TYPE_ORIENTATION, 360.0f, CONVERT_O, 7.05f, 30000, { } },
+                SENSOR_TYPE_ORIENTATION, 360.0f, CONVERT_O, 7.05f, MIN_DELAY_M, { } },
 	{ "BMP085 Pressure sensor",
                 "Bosch",
                 1, SENSORS_HANDLE_BASE+ID_B,
-                SENSOR_TYPE_PRESSURE, 110000.0f, 1.0f, 1.0f, 30000, { } },
+                SENSOR_TYPE_PRESSURE, 110000.0f, 1.0f, 1.0f, MIN_DELAY_B, { } },
+	{ "BMP085 Altitude sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_ALT,
+                SENSOR_TYPE_ALTITUDE, 9000.0f, 0.1f, 1.0f, MIN_DELAY_B, { } },
 	{ "L3G4200D Gyroscope sensor",
                 "ST Micro",
                 1, SENSORS_HANDLE_BASE+ID_G,
-                SENSOR_TYPE_GYROSCOPE, MAX_RANGE_G, CONVERT_G, 6.1f, 1250, { } },
+                SENSOR_TYPE_GYROSCOPE, MAX_RANGE_G, CONVERT_G, 6.1f, MIN_DELAY_G, { } },
+	{ "L3G4200D Gyroscope sensor (uncalibrated)",
+                "ST Micro",
+                1, SENSORS_HANDLE_BASE+ID_GU,
+                SENSOR_TYPE_GYROSCOPE_UNCALIBRATED, MAX_RANGE_G, CONVERT_G, 6.1f, MIN_DELAY_G, { } },
+	{ "Rotation Vector Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_RV,
+                SENSOR_TYPE_ROTATION_VECTOR, 1.0f, 1.0f / (1<<24), POWER_FUSION, MIN_DELAY_G, { } },
+	{ "Gravity Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_GR,
+                SENSOR_TYPE_GRAVITY, GRAVITY_EARTH, CONVERT_A, POWER_FUSION, MIN_DELAY_G, { } },
+	{ "Linear Acceleration Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_LA,
+                SENSOR_TYPE_LINEAR_ACCELERATION, MAX_RANGE_A, CONVERT_A, POWER_FUSION, MIN_DELAY_G, { } },
+	{ "Significant Motion Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_SM,
+                SENSOR_TYPE_SIGNIFICANT_MOTION, 1.0f, 1.0f, POWER_MOTION, -1, { } },
+	{ "Step Detector Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_SD,
+                SENSOR_TYPE_STEP_DETECTOR, 1.0f, 1.0f, POWER_MOTION, 0, { } },
+	{ "Step Counter Sensor",
+                "Motorola",
+                1, SENSORS_HANDLE_BASE+ID_SC,
+                SENSOR_TYPE_STEP_COUNTER, 4294967295.0f, 1.0f, POWER_MOTION, 0, { } },
 };
 
 static int open_sensors(const struct hw_module_t* module, const char* name,
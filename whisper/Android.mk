@@ -8,7 +8,7 @@ include $(CLEAR_VARS)
 
 LOCAL_CFLAGS := -fshort-enums
 
-LOCAL_SRC_FILES := SA_Phys_Linux.c Whisper_AccyMain.c SHA_Comm.c SHA_CommInterfaceTemplate.c SHA_CommMarshalling.c SHA_TimeUtilsLoop.c
+LOCAL_SRC_FILES := SA_Phys_Linux.c Whisper_AccyMain.c SHA_Comm.c SHA_CommInterfaceTemplate.c SHA_CommMarshalling.c SHA_TimeUtilsClock.c Whisper_HidDock.c
 
 LOCAL_C_INCLUDES := \
 	hardware/libhardware_legacy/include
@@ -20,4 +20,23 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_EXECUTABLE)
 
+# Host benchmark of the UART path against a simulated device on a pty
+# (bench/WhisperSim.c). Not built by default:
+#   mmm device/moto/stingray/whisper whisper_bench
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -fshort-enums -DLOG_ACCY_OFF -Dopen=whisper_bench_open
+
+LOCAL_SRC_FILES := SA_Phys_Linux.c SHA_Comm.c SHA_CommInterfaceTemplate.c SHA_CommMarshalling.c SHA_TimeUtilsClock.c \
+	bench/WhisperSim.c bench/WhisperBench.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt
+LOCAL_MODULE := whisper_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
 #########################
@@ -26,6 +26,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <termios.h>
@@ -45,19 +46,60 @@
 #define OPPBAUD         B230400
 #define WAKEBAUD        B115200
 
+// One character at OPPBAUD: start bit, 7 data bits and a stop bit, rounded up
+#define CHAR_TIME_US    40
+// How long after the last character goes out the wire may stay quiet: the
+// echo comes back at once, a response or the wake status once the device
+// has turned the line around.
+#define ECHO_SLACK_US   5000
+#define REPLY_SLACK_US  10000
+#define WAKE_SLACK_US   10000
+// The line has to stay high this long after the wake pulse before the
+// device takes the first token.
+#define WAKE_HIGH_US    2500
+// VMIN is a cc_t
+#define MAX_VMIN        255
+
 
 static void configTtyParams();
 static int8_t setBaudRate(speed_t Inspeed);
-static int8_t writeToDevice(uint8_t *data, uint8_t len);
+static int8_t writeToDevice(const uint8_t *data, uint8_t len);
+static int8_t writeRaw(const uint8_t *raw, uint16_t rawLen);
+static void expandBytes(uint8_t *raw, const uint8_t *data, uint16_t len);
 static int8_t readFromDevice(uint8_t *readBuf, uint16_t readLen, 
-                             uint8_t CmdOfset, uint16_t *retBytes);
+                             uint8_t CmdOfset, uint16_t *retBytes,
+                             uint32_t timeout);
+static int8_t setReadMin(uint8_t vmin);
 static int8_t sleepDevice(void);
-static int16_t formatBytes(uint8_t *ByteData, uint8_t *ByteDataRaw, 
+static int16_t formatBytes(uint8_t *ByteData, const uint8_t *ByteDataRaw, 
                            int16_t lenData);
 
 
+// Every byte goes out as 8 UART characters, LSB first, one per bit.
+#define TX_BIT(b, i)    ((((b) >> (i)) & 1) ? M_ONE_BIT : M_ZERO_BIT)
+#define TX_BYTE(b)      { TX_BIT(b, 0), TX_BIT(b, 1), TX_BIT(b, 2), TX_BIT(b, 3), \
+                          TX_BIT(b, 4), TX_BIT(b, 5), TX_BIT(b, 6), TX_BIT(b, 7) }
+#define TX_ROW4(b)      TX_BYTE(b), TX_BYTE((b) + 1), TX_BYTE((b) + 2), TX_BYTE((b) + 3)
+#define TX_ROW16(b)     TX_ROW4(b), TX_ROW4((b) + 4), TX_ROW4((b) + 8), TX_ROW4((b) + 12)
+#define TX_ROW64(b)     TX_ROW16(b), TX_ROW16((b) + 16), TX_ROW16((b) + 32), TX_ROW16((b) + 48)
+
+static const uint8_t txExpand[256][8] = {
+    TX_ROW64(0), TX_ROW64(64), TX_ROW64(128), TX_ROW64(192)
+};
+
+// A received character reads as a one when bits 2..6 are all set, which is
+// what the (raw ^ M_ONE_BIT) & 0x7C test of the device documentation means.
+#define RX_BIT(c)       (((c) & 0x7C) == 0x7C)
+#define RX_ROW4(c)      RX_BIT(c), RX_BIT((c) + 1), RX_BIT((c) + 2), RX_BIT((c) + 3)
+#define RX_ROW16(c)     RX_ROW4(c), RX_ROW4((c) + 4), RX_ROW4((c) + 8), RX_ROW4((c) + 12)
+#define RX_ROW64(c)     RX_ROW16(c), RX_ROW16((c) + 16), RX_ROW16((c) + 32), RX_ROW16((c) + 48)
+
+static const uint8_t rxBit[256] = {
+    RX_ROW64(0), RX_ROW64(64), RX_ROW64(128), RX_ROW64(192)
+};
+
+
 static const char ttyPort[] = "/dev/ttyHS0";
-static uint8_t readwriteBuf[MAX_BUF_LEN];
 static uint8_t WakeStr = {0x00};
 static uint8_t* pWake = &WakeStr;
 static uint8_t TransmitStr = {0x88};
@@ -67,17 +109,24 @@ static uint8_t* pCmd = &CmdStr;
 static uint8_t SleepStr= {0xCC};
 static uint8_t InStr[41];
 static uint8_t* pIStr = InStr;
-static fd_set readfs;
 static struct termios termOptions;
+static int readMin = -1;
+// set between SHAP_StartBatch() and SHAP_EndBatch()
+static uint8_t inBatch = 0;
+// readable once the current exchange should be abandoned, -1 if none
+static int cancelFd = -1;
 
 int ttyFd = -1;
 
 
- /*  Sets up and configures the UART for use */
+ /*  Sets up and configures the UART for use. The tty stays open and
+  *  configured across attempts, see SHAP_CloseChannel(), so later calls
+  *  only flush it. */
 int8_t SHAP_OpenChannel(void) {
-    struct termios tty;
-    speed_t speed;
-    struct timespec ts;
+    if (ttyFd != -1) {
+        tcflush(ttyFd, TCIOFLUSH);
+        return SHA_SUCCESS;
+    }
 
     ttyFd = open(ttyPort, O_RDWR);
     if (ttyFd == -1) {
@@ -93,52 +142,64 @@ int8_t SHAP_OpenChannel(void) {
        DBG_ERROR("tcflush() error");
     }
 
+    // tcsetattr(TCSANOW) is in effect when it returns
     configTtyParams();
 
-    ts.tv_sec = 0;
-    ts.tv_nsec = MAX_IO_TIMEOUT * 1000000; 
-    nanosleep(&ts, NULL);
-
     return SHA_SUCCESS;
 }
 
 
 
+/*  Puts the device to sleep and ends the attempt; the tty is kept for the
+ *  next one until SHAP_CloseFile(). */
 int8_t SHAP_CloseChannel(void) {
-    int8_t ret = sleepDevice();
-    close(ttyFd);
-    return ret;
+    return sleepDevice();
 }
 
 int8_t SHAP_SendBytes(uint8_t count, uint8_t *buffer) {
     uint16_t bytesRead;
     int8_t i, retVal;
+    uint8_t raw[MAX_BUF_LEN];
 
     if (!count || !buffer) {
         DBG_ERROR("Bad input");
         return SHA_BAD_PARAM;
     }
 
-    if (tcflush(ttyFd, TCIOFLUSH) == 0) {
-        DBG_TRACE("The input and output queues have been flushed");
-    }
-    else {
-        DBG_ERROR("tcflush() error");
+    // Command token plus the packet, each byte expanded to 8 characters
+    if ((count+1)*8 > MAX_BUF_LEN) {
+        DBG_ERROR("Bad input");
+        return SHA_BAD_PARAM;
     }
 
-    memmove(&buffer[1], buffer, count);
-    buffer[0] = CmdStr;
+    // In a batch the queues were flushed once up front and every read since
+    // took exactly what it asked for, so there is nothing stale to drop.
+    if (!inBatch) {
+        if (tcflush(ttyFd, TCIOFLUSH) == 0) {
+            DBG_TRACE("The input and output queues have been flushed");
+        }
+        else {
+            DBG_ERROR("tcflush() error");
+        }
+    }
 
-    writeToDevice(buffer, count+1);
+    // The token goes in front of the expanded packet rather than into the
+    // caller's buffer, so a retry resends the same packet.
+    expandBytes(raw, pCmd, 1);
+    expandBytes(&raw[8], buffer, count);
+    writeRaw(raw, (count+1)*8);
 
-    // Read the echo back ...
-    readFromDevice(readwriteBuf, 8*(count+1), 0, &bytesRead);  
+    // Read the echo back and drop it
+    readFromDevice(NULL, 8*(count+1), 0, &bytesRead,
+                   8*(count+1)*CHAR_TIME_US + ECHO_SLACK_US);
 
-    if (tcflush(ttyFd, TCIFLUSH) == 0) {
-       DBG_TRACE("The input queue has been flushed");
-    }
-    else {
-       DBG_ERROR("tcflush() error");
+    if (!inBatch || bytesRead != 8*(count+1)) {
+        if (tcflush(ttyFd, TCIFLUSH) == 0) {
+           DBG_TRACE("The input queue has been flushed");
+        }
+        else {
+           DBG_ERROR("tcflush() error");
+        }
     }
 
     return SHA_SUCCESS;
@@ -161,7 +222,13 @@ int8_t SHAP_ReceiveBytes(uint8_t recCommLen, uint8_t *dataBuf) {
         DBG_ERROR("Test Write to %s unsuccessful", ttyPort);
     }
 
-    iResVal = readFromDevice(dataBuf, (cmdLen+1)*8, 8, &bytesRead);
+    iResVal = readFromDevice(dataBuf, (cmdLen+1)*8, 8, &bytesRead,
+                             (cmdLen+1)*8*CHAR_TIME_US + REPLY_SLACK_US);
+
+    // a short frame leaves the line out of step for the next command
+    if (inBatch && bytesRead != (cmdLen+1)*8) {
+        tcflush(ttyFd, TCIFLUSH);
+    }
 
     if (iResVal == SHA_COMM_FAIL) {
         DBG_ERROR("Read Error unable to read port: %d from device: %s", ttyFd, ttyPort);
@@ -173,79 +240,144 @@ int8_t SHAP_ReceiveBytes(uint8_t recCommLen, uint8_t *dataBuf) {
 
 
 
+/*  Makes reads give up as soon as fd becomes readable, -1 for none. The fd
+ *  is only polled, resetting it is up to the owner. */
+void SHAP_SetCancelFd(int fd) {
+    cancelFd = fd;
+}
+
+
 
+/*  Starts a run of commands that share one flush of the queues up front
+ *  and one at the end, instead of a pair around every command. */
+int8_t SHAP_StartBatch(void) {
+    if (tcflush(ttyFd, TCIOFLUSH) != 0) {
+        DBG_ERROR("tcflush() error");
+    }
+    inBatch = 1;
+    return SHA_SUCCESS;
+}
+
+
+
+int8_t SHAP_EndBatch(void) {
+    inBatch = 0;
+    if (tcflush(ttyFd, TCIFLUSH) != 0) {
+        DBG_ERROR("tcflush() error");
+    }
+    return SHA_SUCCESS;
+}
+
+
+
+
+/*  Releases the tty once whatever was queued has gone out */
 void SHAP_CloseFile(void) {
-    struct timespec ts;
-    close(ttyFd);
+    if (ttyFd == -1) {
+        return;
+    }
 
-    ts.tv_sec = 0;
-    ts.tv_nsec = MAX_IO_TIMEOUT * 1000000; 
-    nanosleep(&ts, NULL);
+    tcdrain(ttyFd);
+    close(ttyFd);
+    ttyFd = -1;
+    readMin = -1;
+    inBatch = 0;
 }
 
 
 
 
-/*  Reads the message from device. returns NULL if error */
+/*  Reads the message from device and decodes it into readBuf, skipping the
+ *  first CmdOfset characters. A NULL readBuf just consumes the characters.
+ *  Gives up timeout us from now; VMIN is set to what is still
+ *  missing, so poll() wakes up once for the whole frame rather than once
+ *  per character. */
 static int8_t readFromDevice(uint8_t *readBuf, uint16_t readLen, 
-                             uint8_t CmdOfset, uint16_t *retBytes) {
-    int8_t goOn = 1;
-    struct timeval Timeout;
+                             uint8_t CmdOfset, uint16_t *retBytes,
+                             uint32_t timeout) {
+    struct pollfd pfd[2];
+    int64_t deadline, remaining;
     uint16_t numBytesRead = 0;
+    uint16_t want;
     int retVal;
-    uint16_t i;
+    uint8_t raw[MAX_BUF_LEN];
 
-    Timeout.tv_usec = 200000;
-    Timeout.tv_sec = 0;
     *retBytes = 0;
 
-    for (i = 0; i < sizeof(readwriteBuf); i++) {
-        readwriteBuf[i]= 0x00;
+    if (readLen > MAX_BUF_LEN || CmdOfset > readLen) {
+        DBG_ERROR("Bad read length %d offset %d", readLen, CmdOfset);
+        return SHA_BAD_PARAM;
     }
 
-    while (goOn) {
-        FD_SET(ttyFd, &readfs);
-        retVal = select(ttyFd+1, &readfs, NULL, NULL, &Timeout);
+    pfd[0].fd = ttyFd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cancelFd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    deadline = SHAP_GetTimeUs() + timeout;
 
-        if (retVal == 0) {
-            DBG_ERROR("Timeout on select() occurred on port %d. Receive <%d> bytes", ttyFd, numBytesRead);
-            if (numBytesRead > 0) {
-                return SHA_SUCCESS;
-            }
-            else {
-                return SHA_COMM_FAIL;
+    while (numBytesRead < readLen) {
+        want = readLen - numBytesRead;
+        setReadMin(want > MAX_VMIN ? MAX_VMIN : want);
+
+        remaining = deadline - SHAP_GetTimeUs();
+        retVal = remaining > 0 ? poll(pfd, cancelFd == -1 ? 1 : 2,
+                                      (int)((remaining + 999) / 1000)) : 0;
+
+        if (retVal < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            DBG_ERROR("Poll Error. ERRNO = %d", errno);
+            return SHA_COMM_FAIL;
         }
 
-        if (retVal < 0 && errno == EINTR) {
-            DBG_ERROR("SELECT returned EINTR ");
-            continue;
+        if (pfd[1].revents & POLLIN) {
+            DBG_TRACE("Read on port %d cancelled after <%d> bytes", ttyFd, numBytesRead);
+            return SHA_COMM_FAIL;
         }
 
-        if (FD_ISSET(ttyFd, &readfs)) {
+        if (retVal == 0) {
+            // Collect whatever made it; with VMIN at 0 read() does not block.
+            setReadMin(0);
             do {
-                retVal = read(ttyFd, &readwriteBuf[numBytesRead], MAX_BUF_LEN);
+                retVal = read(ttyFd, &raw[numBytesRead], want);
             } while (retVal < 0 && errno == EINTR);
-
             if (retVal > 0) {
                 numBytesRead += retVal;
                 *retBytes = numBytesRead;
+            }
+            DBG_ERROR("Timeout occurred on port %d. Receive <%d> bytes", ttyFd, numBytesRead);
+            if (numBytesRead > 0) {
+                return SHA_SUCCESS;
+            }
+            else {
+                return SHA_COMM_FAIL;
+            }
+        }
 
-                DBG_TRACE("REQ READ LEN = %d, NUM BYT READ = %d, retVal = %d offset = %d", 
-                           readLen, numBytesRead, retVal, CmdOfset);
+        do {
+            retVal = read(ttyFd, &raw[numBytesRead], want);
+        } while (retVal < 0 && errno == EINTR);
 
-                if (numBytesRead >= (readLen)) {
-                    DBG_TRACE("Read Success");
-                    break;
-                }
-            }
+        if (retVal > 0) {
+            numBytesRead += retVal;
+            *retBytes = numBytesRead;
+
+            DBG_TRACE("REQ READ LEN = %d, NUM BYT READ = %d, retVal = %d offset = %d", 
+                       readLen, numBytesRead, retVal, CmdOfset);
         }
-        else {
-            DBG_ERROR("Select Error. ERRNO = %d", errno);
+        else if (retVal < 0) {
+            DBG_ERROR("Read Error. ERRNO = %d", errno);
+            return SHA_COMM_FAIL;
         }
     }
 
-    formatBytes(readBuf, &readwriteBuf[CmdOfset], readLen-CmdOfset);
+    DBG_TRACE("Read Success");
+
+    if (readBuf) {
+        formatBytes(readBuf, &raw[CmdOfset], readLen-CmdOfset);
+    }
 
     return SHA_SUCCESS;
 }
@@ -253,63 +385,96 @@ static int8_t readFromDevice(uint8_t *readBuf, uint16_t readLen,
 
 
 
-/* Transmits a message to be sent over tty */
-static int8_t writeToDevice(uint8_t *data, uint8_t len) {
-    uint16_t i,j;
-    int nbytes, nwritten;
-    uint8_t *byteptr;
+/* Sets how many characters a read() waits for, with no inter-character timer */
+static int8_t setReadMin(uint8_t vmin) {
+    struct termios tty;
 
-    // Every byte gets transferred into 8 bytes
-    if (len*8 > MAX_BUF_LEN) {
+    if (readMin == vmin) {
+        return SHA_SUCCESS;
+    }
+
+    if (tcgetattr(ttyFd, &tty) == -1) {
+        DBG_ERROR("Error returned by tcgetattr. errno = %d", errno);
         return SHA_COMM_FAIL;
     }
 
-    for(i = 0; i < len; i++) {
-        for(j = 0; j < 8; j++) {
-            if (data[i] & (1 << j)) {
-                readwriteBuf[(i*8)+j] = M_ONE_BIT;
-            }
-            else {
-                readwriteBuf[(i*8)+j] = M_ZERO_BIT;
-            }
-        }
+    tty.c_cc[VMIN] = vmin;
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(ttyFd, TCSANOW, &tty) == -1) {
+        DBG_ERROR("Error returned by tcsetattr. errno = %d", errno);
+        readMin = -1;
+        return SHA_COMM_FAIL;
     }
 
+    readMin = vmin;
+    return SHA_SUCCESS;
+}
+
+
+
+
+/* Expands len bytes into len*8 UART characters */
+static void expandBytes(uint8_t *raw, const uint8_t *data, uint16_t len) {
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        memcpy(&raw[i*8], txExpand[data[i]], 8);
+    }
+}
+
+
+
+
+/* Writes already expanded characters, returns the number of whole bytes sent */
+static int8_t writeRaw(const uint8_t *raw, uint16_t rawLen) {
+    int nwritten;
+
     do {
-        nwritten = write(ttyFd, readwriteBuf, len*8);
+        nwritten = write(ttyFd, raw, rawLen);
     } while (nwritten < 0 && errno == EINTR);
 
     if (nwritten == -1) {
         DBG_ERROR("Write Failed with errno = %d", errno);
         return SHA_COMM_FAIL;
     }
-    else if (nwritten != len*8)   {
-        DBG_ERROR("ERROR. write less than requested<%d>. written: %i",nwritten, len*8);
+    else if (nwritten != rawLen)   {
+        DBG_ERROR("ERROR. write less than requested<%d>. written: %i", rawLen, nwritten);
     }
 
-    nbytes = nwritten / 8;
+    return nwritten / 8;
+}
+
 
-    return nbytes;
+
+
+/* Transmits a message to be sent over tty */
+static int8_t writeToDevice(const uint8_t *data, uint8_t len) {
+    uint8_t raw[MAX_BUF_LEN];
+
+    // Every byte gets transferred into 8 bytes
+    if (len*8 > MAX_BUF_LEN) {
+        return SHA_COMM_FAIL;
+    }
+
+    expandBytes(raw, data, len);
+
+    return writeRaw(raw, len*8);
 }
 
 
 
 
 /* Formats the data received from UART to byte data */
-static int16_t formatBytes(uint8_t *ByteData, uint8_t *ByteDataRaw,
+static int16_t formatBytes(uint8_t *ByteData, const uint8_t *ByteDataRaw,
                            int16_t lenData) {
-    uint16_t i,j;
-    int16_t retLen = lenData;
-
-    for(j = 0; j < retLen/8;j++) {
-        for (i = 0; i < 8; i++) {
-            if ((ByteDataRaw[(8 *j)+i] ^ 0x7F) & 0x7C) {
-                ByteData[j] &= ~(1 << i);
-            }
-            else {
-                ByteData[j] |= (1 << i);
-            }
-        }
+    int16_t j;
+    const uint8_t *r = ByteDataRaw;
+
+    for (j = 0; j < lenData/8; j++, r += 8) {
+        ByteData[j] = rxBit[r[0]]      | rxBit[r[1]] << 1 |
+                      rxBit[r[2]] << 2 | rxBit[r[3]] << 3 |
+                      rxBit[r[4]] << 4 | rxBit[r[5]] << 5 |
+                      rxBit[r[6]] << 6 | rxBit[r[7]] << 7;
     }
 
     return SHA_SUCCESS;
@@ -320,7 +485,7 @@ static int16_t formatBytes(uint8_t *ByteData, uint8_t *ByteDataRaw,
 /* Wakes the device */ 
 int8_t SHAP_WakeDevice(void) {
     int iResVal;
-    struct timespec ts;
+    int64_t wokenAt;
     uint16_t bytes_read;
     uint8_t bytes_written;
     ssize_t osize;
@@ -340,12 +505,18 @@ int8_t SHAP_WakeDevice(void) {
         return SHA_COMM_FAIL;
     }
 
-    ts.tv_sec = 0;
-    ts.tv_nsec = 3000000;
-    nanosleep(&ts, NULL);
+    // The pulse has to be on the wire before the baud rate changes under it,
+    // then the line idles high for the device to come up.
+    tcdrain(ttyFd);
+    wokenAt = SHAP_GetTimeUs();
 
     // set the Baud Rate to Comm speed
     setBaudRate(OPPBAUD);
+    iResVal = WAKE_HIGH_US - (int)(SHAP_GetTimeUs() - wokenAt);
+    if (iResVal > 0) {
+        SHAP_Delay(iResVal);
+    }
+
     if (writeToDevice(pTrm, 1) == 1) {
         DBG_TRACE("Wakeup Write to %s successful", ttyPort);
     }
@@ -354,7 +525,8 @@ int8_t SHAP_WakeDevice(void) {
     }
 
 
-    iResVal = readFromDevice(pIStr, 41, 9, &bytes_read);
+    iResVal = readFromDevice(pIStr, 41, 9, &bytes_read,
+                             41*CHAR_TIME_US + WAKE_SLACK_US);
 
     if (iResVal == SHA_COMM_FAIL || bytes_read < 41) {
         sleepDevice();
@@ -392,7 +564,6 @@ static int8_t sleepDevice(void)
 {
     uint8_t *byteptr = &SleepStr;
     ssize_t osize;
-    struct timespec ts;
     do {
         osize = write(ttyFd, byteptr, 1);
     } while (osize < 0 && errno == EINTR);
@@ -401,22 +572,12 @@ static int8_t sleepDevice(void)
         DBG_ERROR("Write Failed errno = %d", errno);
         return SHA_COMM_FAIL;
     }
-    ts.tv_sec = 0;
-    ts.tv_nsec = 100000000; // sleep for 100ms
-    nanosleep(&ts, NULL);
+    // done once the token has left the UART
+    tcdrain(ttyFd);
 
     return SHA_SUCCESS;
 }
 
-void SA_Delay(uint32_t delay)
-{
-    struct timespec ts;
-
-    ts.tv_sec = 0;
-    ts.tv_nsec = delay*1000; // convert us to ns
-    nanosleep(&ts, NULL);
-}
-
 /*  Sets the baudrate of the tty port */
 static int8_t setBaudRate(speed_t Inspeed) {
     int8_t ret;
@@ -488,6 +649,7 @@ static void configTtyParams()
 
     tcflush(ttyFd, TCIFLUSH);
     tcsetattr(ttyFd, TCSANOW, &tty);
+    readMin = 1;
 }
 
 
@@ -38,5 +38,8 @@ int8_t SHAP_SendBytes(uint8_t count, uint8_t *buffer);
 int8_t SHAP_ReceiveBytes(uint8_t recCommLen, uint8_t *dataBuf);
 int8_t SHAP_OpenChannel(void);
 int8_t SHAP_CloseChannel(void);
+int8_t SHAP_StartBatch(void);
+int8_t SHAP_EndBatch(void);
+void SHAP_SetCancelFd(int fd);
 void SHAP_CloseFile(void);
 #endif
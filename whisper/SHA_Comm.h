@@ -45,6 +45,8 @@
 
 #define WATCHDOG_TIMEOUT        (21)    //!< maximum watchdog timeout of device in s
 
+#define SHA_CRC_TEST_SIZE       (64)       //!< size of the buffer SHAC_CrcInit() checks the CRC on
+
 /** \brief used as parameter group for communication functions */
 typedef struct {
     uint8_t *txBuffer;
@@ -54,6 +56,8 @@ typedef struct {
 } SHA_CommParameters;
 
 
+int8_t SHAC_CrcInit(void);
+uint16_t SHAC_CalculateCrc(uint8_t *data, uint8_t count);
 uint8_t SHAC_Wakeup();
 int8_t SHAC_SendAndReceive(SHA_CommParameters *params);
 #endif
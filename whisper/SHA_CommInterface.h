@@ -37,5 +37,7 @@ int8_t SHAP_SendCommand(uint8_t count, uint8_t *buffer);
 int8_t SHAP_ReceiveResponse(uint8_t count, uint8_t *buffer);
 int8_t SHAP_Idle(void);
 int8_t SHAP_Sleep(void);
+int8_t SHAP_BeginSequence(void);
+int8_t SHAP_EndSequence(void);
 
 #endif
@@ -61,3 +61,22 @@ int8_t SHAP_Idle() {
 int8_t SHAP_Sleep() {
     return SHA_GEN_FAIL;
 }
+
+
+/** \brief Starts a run of back-to-back commands. (stub)
+ *
+ * The physical layer may skip its per-command resynchronization until
+ * SHAP_EndSequence().
+ * \return status of the operation
+ */
+int8_t SHAP_BeginSequence(void) {
+    return SHAP_StartBatch();
+}
+
+
+/** \brief Ends a run of commands started with SHAP_BeginSequence(). (stub)
+ * \return status of the operation
+ */
+int8_t SHAP_EndSequence(void) {
+    return SHAP_EndBatch();
+}
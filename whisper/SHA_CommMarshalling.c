@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "SHA_Comm.h"
+#include "SHA_CommInterface.h"
 #include "SHA_CommMarshalling.h"
 #include "SHA_Status.h"
 
@@ -38,6 +39,10 @@ uint8_t sendbuf[SENDBUF_SIZE];
 uint8_t receicebuf[RECEIVEBUF_SIZE];
 SHA_CommParameters commparms;
 
+// last dock whose identity was read in full, see SHAC_ReadDockIdentity()
+static SHA_DockIdentity lastDock;
+static uint8_t lastDockValid = 0;
+
 
 
 
@@ -87,6 +92,7 @@ uint8_t SHAC_Mac(uint8_t Mode, uint16_t KeyID, uint8_t *Challenge) {
  * \return status of the operation
  */
 uint8_t SHAC_Read(uint8_t Zone, uint16_t Address) {
+    // sendbuf is rebuilt for every attempt, SHAC_SendAndReceive() may retry
     sendbuf[COUNT_IDX] = READ_COUNT;
     sendbuf[CMD_ORDINAL_IDX] = READ;
     sendbuf[READ_ZONE_IDX] = Zone;
@@ -95,9 +101,9 @@ uint8_t SHAC_Read(uint8_t Zone, uint16_t Address) {
     commparms.txBuffer = &sendbuf[0];
     commparms.rxBuffer = &receicebuf[0];
     if (Zone & 0x80)            // if bit 7 = 1, 32 bytes
-        commparms.rxSize = 35;
+        commparms.rxSize = READ_RSP_SIZE_LONG;
     else
-        commparms.rxSize = 7;
+        commparms.rxSize = READ_RSP_SIZE_SHORT;
     // The execution delay will have to increased for clear text & enc data
     commparms.executionDelay = GENERALCMDDELAY;
     // Transfer the command to the chip
@@ -106,3 +112,112 @@ uint8_t SHAC_Read(uint8_t Zone, uint16_t Address) {
 
 }
 
+
+
+/**
+ *
+ * \brief Runs READ commands back to back, inside a sequence the caller
+ * opened.
+ *
+ * \param[in,out] Requests READs to run, results are filled in
+ * \param[in]  Count number of requests
+ * \return status of the first failed READ, or SHA_SUCCESS
+ */
+static int8_t runReads(SHA_ReadRequest *Requests, uint8_t Count) {
+    uint8_t i;
+    int8_t status = SHA_SUCCESS;
+
+    for (i = 0; i < Count; i++)
+        Requests[i].Status = SHA_GEN_FAIL;
+
+    for (i = 0; i < Count && status == SHA_SUCCESS; i++) {
+        status = SHAC_Read(Requests[i].Zone, Requests[i].Address);
+        Requests[i].Status = status;
+        if (status == SHA_SUCCESS && Requests[i].Response)
+            memcpy(Requests[i].Response, receicebuf, commparms.rxSize);
+    }
+
+    return status;
+}
+
+
+
+/**
+ *
+ * \brief Runs READ commands back to back.
+ *
+ * The physical layer resynchronizes once around the whole run instead of
+ * around every command. Each response, sized by its zone, goes to its own
+ * request. The run stops at the first READ that fails.
+ *
+ * \param[in,out] Requests READs to run, results are filled in
+ * \param[in]  Count number of requests, at most READ_BATCH_MAX
+ * \return status of the first failed READ, or SHA_SUCCESS
+ */
+uint8_t SHAC_ReadBatch(SHA_ReadRequest *Requests, uint8_t Count) {
+    int8_t status;
+
+    if (!Requests || !Count || Count > READ_BATCH_MAX)
+        return SHA_BAD_PARAM;
+
+    SHAP_BeginSequence();
+    status = runReads(Requests, Count);
+    SHAP_EndSequence();
+
+    return status;
+}
+
+
+
+/**
+ *
+ * \brief Reads the fuses that identify a dock.
+ *
+ * The fuse serial number is read first. If it belongs to the last dock
+ * read in full, the rest of its identity comes from the cache and the
+ * other READs are skipped.
+ *
+ * \param[out] Identity identity of the attached dock
+ * \param[out] Cached set when the identity came from the cache, may be NULL
+ * \return status of the operation
+ */
+uint8_t SHAC_ReadDockIdentity(SHA_DockIdentity *Identity, uint8_t *Cached) {
+    SHA_ReadRequest serial[1], rest[2];
+    int8_t status;
+
+    if (!Identity)
+        return SHA_BAD_PARAM;
+    if (Cached)
+        *Cached = 0;
+
+    serial[0].Zone = 0x01;
+    serial[0].Address = 0x0003;
+    serial[0].Response = Identity->FuseSN;
+    rest[0].Zone = 0x01;
+    rest[0].Address = 0x0002;
+    rest[0].Response = Identity->StatusFuse;
+    rest[1].Zone = 0x00;
+    rest[1].Address = 0x0000;
+    rest[1].Response = Identity->RomSN;
+
+    // one sequence, the rest of the batch only runs for a new dock
+    SHAP_BeginSequence();
+    status = runReads(serial, 1);
+    if (status == SHA_SUCCESS) {
+        if (lastDockValid && !memcmp(lastDock.FuseSN, Identity->FuseSN, READ_RSP_SIZE_SHORT)) {
+            memcpy(Identity, &lastDock, sizeof(lastDock));
+            if (Cached)
+                *Cached = 1;
+        }
+        else {
+            status = runReads(rest, 2);
+            if (status == SHA_SUCCESS) {
+                memcpy(&lastDock, Identity, sizeof(lastDock));
+                lastDockValid = 1;
+            }
+        }
+    }
+    SHAP_EndSequence();
+
+    return status;
+}
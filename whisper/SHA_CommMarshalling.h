@@ -200,6 +200,28 @@ n+1 & n+2        Checksum        Checksum of the command packet
 #define GENERALCMDDELAY         1000
 
 
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+// Batched reads
+#define READ_RSP_SIZE_SHORT     7
+#define READ_RSP_SIZE_LONG      35
+#define READ_BATCH_MAX          8
+
+/** \brief one READ of a batch, see SHAC_ReadBatch() */
+typedef struct {
+    uint8_t Zone;
+    uint16_t Address;
+    uint8_t *Response;          //!< receives the whole response, READ_RSP_SIZE_SHORT or _LONG bytes
+    int8_t Status;              //!< result of this READ
+} SHA_ReadRequest;
+
+/** \brief what identifies a dock: whole READ responses, count byte first */
+typedef struct {
+    uint8_t StatusFuse[8];      //!< zone 0x01 address 0x0002
+    uint8_t FuseSN[8];          //!< zone 0x01 address 0x0003
+    uint8_t RomSN[8];           //!< zone 0x00 address 0x0000
+} SHA_DockIdentity;
+
 //////////////////////////////////////////////////////////////////////
 // Function definitions
 uint8_t SHAC_DeriveKey(uint8_t Random, uint16_t TargetKey, uint8_t *Data);
@@ -214,6 +236,8 @@ uint8_t SHAC_Nonce(uint8_t Mode, uint8_t *Numin);
 uint8_t SHAC_Pause(uint8_t Selector);
 uint8_t SHAC_Random(uint8_t Mode);
 uint8_t SHAC_Read(uint8_t Zone, uint16_t Address);
+uint8_t SHAC_ReadBatch(SHA_ReadRequest *Requests, uint8_t Count);
+uint8_t SHAC_ReadDockIdentity(SHA_DockIdentity *Identity, uint8_t *Cached);
 uint8_t SHAC_TempSense(uint8_t *Temp);
 uint8_t SHAC_Write(uint8_t Zone, uint16_t Address, uint8_t *Value, uint8_t *MACData);
 
@@ -28,7 +28,17 @@
 
 #include <stdint.h>
 
+/** \brief measured against requested length of the delays of one length */
+typedef struct {
+    uint32_t requested;     //!< requested delay in us
+    uint32_t count;         //!< number of delays of this length
+    uint32_t maxLate;       //!< longest overrun in us
+    uint64_t totalLate;     //!< sum of the overruns in us
+} SHA_DelayStats;
+
+int64_t SHAP_GetTimeUs(void);
 void SHAP_Delay(uint32_t delay);
-void loop_delay(int8_t multp);
+uint8_t SHAP_GetDelayStats(SHA_DelayStats *stats);
+void SHAP_LogDelayStats(void);
 
 #endif
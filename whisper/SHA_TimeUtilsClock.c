@@ -0,0 +1,142 @@
+// Copyright (c) 2010, Atmel Corporation.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Atmel nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "SHA_TimeUtils.h"
+#include "Whisper_AccyMain.h"
+
+
+//!< Waits shorter than this are spun out on the clock instead of slept.
+#define SHA_SPIN_LIMIT_US       (50)
+
+//!< Number of distinct requested delays that get their own statistics.
+#define SHA_DELAY_STATS_SIZE    (8)
+
+
+//!< How late clock_nanosleep() tends to return, learned as we go.
+static int32_t wakeLatencyUs = 0;
+
+static SHA_DelayStats delayStats[SHA_DELAY_STATS_SIZE];
+
+
+/** \brief Returns CLOCK_MONOTONIC in microseconds. */
+int64_t SHAP_GetTimeUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/** \brief Accounts one delay to the statistics of its requested length. */
+static void recordDelay(uint32_t requested, int64_t measured) {
+    uint8_t i;
+    uint32_t late = measured > requested ? (uint32_t) (measured - requested) : 0;
+
+    for (i = 0; i < SHA_DELAY_STATS_SIZE; i++) {
+        if (!delayStats[i].count || delayStats[i].requested == requested)
+            break;
+    }
+    if (i == SHA_DELAY_STATS_SIZE)
+        return;
+
+    delayStats[i].requested = requested;
+    delayStats[i].count++;
+    delayStats[i].totalLate += late;
+    if (late > delayStats[i].maxLate)
+        delayStats[i].maxLate = late;
+}
+
+
+/** \brief Delays for a certain amount of time.
+ *
+ * Sleeps on CLOCK_MONOTONIC until shortly before the deadline, by how late
+ * wake-ups have been running, and spins out only what is left of that.
+ * Delays below SHA_SPIN_LIMIT_US are spun out entirely.
+ *
+ * \param[in] delay Delay for this number of microseconds (us).
+ */
+void SHAP_Delay(uint32_t delay) {
+    const int64_t start = SHAP_GetTimeUs();
+    const int64_t end = start + delay;
+    int64_t wake, now;
+    struct timespec ts;
+
+    if (!delay)
+        return;
+
+    wake = end - wakeLatencyUs;
+    if (delay >= SHA_SPIN_LIMIT_US && wake > start) {
+        ts.tv_sec = wake / 1000000;
+        ts.tv_nsec = (wake % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+
+        // 1/8 EWMA of the oversleep, bounded so the spin stays short
+        now = SHAP_GetTimeUs();
+        wakeLatencyUs += (int32_t) ((now - wake) - wakeLatencyUs) / 8;
+        if (wakeLatencyUs < 0)
+            wakeLatencyUs = 0;
+        else if (wakeLatencyUs > SHA_SPIN_LIMIT_US)
+            wakeLatencyUs = SHA_SPIN_LIMIT_US;
+    }
+
+    do {
+        now = SHAP_GetTimeUs();
+    } while (now < end);
+
+    recordDelay(delay, now - start);
+}
+
+
+/** \brief Copies out the statistics of the delays seen so far.
+ *
+ * \param[out] stats array of at least SHA_DELAY_STATS_SIZE entries
+ * \return number of entries filled in
+ */
+uint8_t SHAP_GetDelayStats(SHA_DelayStats *stats) {
+    uint8_t i;
+
+    for (i = 0; i < SHA_DELAY_STATS_SIZE && delayStats[i].count; i++)
+        stats[i] = delayStats[i];
+
+    return i;
+}
+
+
+/** \brief Logs how late each requested delay length ran, on average and worst. */
+void SHAP_LogDelayStats(void) {
+    uint8_t i;
+
+    for (i = 0; i < SHA_DELAY_STATS_SIZE && delayStats[i].count; i++) {
+        DBG_TRACE("delay %u us: %u calls, late avg %u us max %u us",
+                  delayStats[i].requested, delayStats[i].count,
+                  (uint32_t) (delayStats[i].totalLate / delayStats[i].count),
+                  delayStats[i].maxLate);
+    }
+}
@@ -25,11 +25,13 @@
 
 #include <signal.h>
 #include <string.h>
+#include <poll.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -45,7 +47,6 @@
 #include <private/android_filesystem_config.h>
 
 #include <linux/spi/cpcap.h>
-#include <linux/hidraw.h>
 
 
 #include "SA_Phys_Linux.h"
@@ -54,6 +55,7 @@
 #include "SHA_Comm.h"
 #include "SHA_TimeUtils.h"
 #include "Whisper_AccyMain.h"
+#include "Whisper_HidDock.h"
 
 
 /*==================================================================================================
@@ -74,6 +76,9 @@ static const uint8_t hidIdQuery[] = {0x3f, 0x12, 0x00, 0x01, 0xf1, 0xe2};
 #define UART_SWITCH_STATE_PATH          "/sys/class/switch/whisper/state"
 #define HID_SWITCH_STATE_PATH           "/sys/class/switch/whisper_hid/state"
 #define DOCK_TYPE_OFFSET                27
+#define UART_SWITCH_NAME                "whisper"
+#define HID_SWITCH_NAME                 "whisper_hid"
+#define UEVENT_MSG_LEN                  1024
 
 #define DOCK_ATTACHED                   '1'
 #define DOCK_NOT_ATTACHED               '0'
@@ -86,12 +91,21 @@ static const uint8_t hidIdQuery[] = {0x3f, 0x12, 0x00, 0x01, 0xf1, 0xe2};
 #define IOCTL_SUCCESS                   0
 #define MAX_TRY_IOCTL                   5
 
+/* Retries back off exponentially from the first delay, within a total budget (us) */
+#define WAKEUP_BACKOFF_US               1000
+#define WAKEUP_BUDGET_US                40000
+#define COMM_BACKOFF_US                 20000
+#define COMM_BUDGET_US                  400000
+#define IOCTL_BACKOFF_US                5000
+#define IOCTL_BUDGET_US                 250000
+
 #define HID_STATUS_QUERY_LENGTH         64
 #define HID_ID_QUERY_LENGTH             64
 #define HID_MAC_QUERY_LENGTH            64
 #define HID_STATUS_MSG_LENGTH		64
 #define HID_ID_MSG_LENGTH		64
 #define HID_MAC_MSG_LENGTH		64
+#define HID_RESPONSE_TIMEOUT_MS         200
 
 #define LOG_FILE_NAME                   "/data/whisper/whisperd.log"
 #define LOG_FILE_PATH                   "/data/whisper"
@@ -100,30 +114,57 @@ static const uint8_t hidIdQuery[] = {0x3f, 0x12, 0x00, 0x01, 0xf1, 0xe2};
                                           EXTERNAL VARIABLES
 ==================================================================================================*/
 
+/*==================================================================================================
+                                            LOCAL TYPES
+==================================================================================================*/
+typedef struct {
+    int64_t  deadline;
+    uint32_t delay;
+} AccyBackoff;
+
+/* The keys of a kernel uevent we act on; each points into the message */
+typedef struct {
+    const char *action;
+    const char *subsystem;
+    const char *devpath;
+    const char *switchName;
+    const char *switchState;
+} AccyUevent;
+
 /*==================================================================================================
                                      LOCAL FUNCTION PROTOTYPES
 ==================================================================================================*/
-static void copyResults(int8_t cmdSize, uint8_t *out);
 static int  accyInit(void);
 static void accySigHandler(signed int signal);
 static void accyProtDaemon(void *arg);
-static void readSwitchState(int);
+static int  readSwitchFile(int protocolType);
+static void readSwitchState(int protocolType, int state);
+static int  parseUevent(char *msg, int len, AccyUevent *ev);
+static void handleUevent(const AccyUevent *ev);
+static void signalEvent(int fd);
+static int  clearEvent(int fd);
 static int  accySpawnThread();
 static void createOutput(uint8_t *inp, char *out, int bytes);
 static void waitForUevents();
 static void doIoctl(int cmd, unsigned int data, char *dev_id, char *dev_prop);
+static void backoffInit(AccyBackoff *b, uint32_t first, uint32_t budget);
+static int  backoffWait(AccyBackoff *b);
 
 /*==================================================================================================
                                           LOCAL VARIABLES
 ==================================================================================================*/
-static SHA_CommParameters*    mainparms;
-static sem_t SigAccyProtStart;
 static int ueventFd;
+/* dock state changed, wakes accyProtDaemon */
+static int startEventFd = -1;
+/* undocked, aborts whatever accyProtDaemon is waiting for */
+static int cancelEventFd = -1;
+/* switch state files, kept open and re-read with pread() */
+static int switchFds[] = {-1, -1};
+static const char *switchPaths[] = {UART_SWITCH_STATE_PATH, HID_SWITCH_STATE_PATH};
 static int wakeLock = 0;
 static int globalState;
 static int globalProtocol;
 static int cpcapFd = -1;
-static int hidFd = -1;
 
 /*==================================================================================================
                                           GLOBAL VARIABLES
@@ -136,133 +177,248 @@ int  currLogSize = 0;
 ==================================================================================================*/
 
 
-static void readSwitchState(int protocolType) {
-    const int SIZE = 16;
-    int switchFd = -1;
-    char buf[SIZE];
-    int count;
+static void backoffInit(AccyBackoff *b, uint32_t first, uint32_t budget) {
+    b->deadline = SHAP_GetTimeUs() + budget;
+    b->delay = first;
+}
 
-    if (protocolType == PROTOCOL_UART) {
-        switchFd = open(UART_SWITCH_STATE_PATH, O_RDONLY, 0);
-        if (switchFd == -1) {
-            DBG_ERROR("Failed opening %s, errno = %s", UART_SWITCH_STATE_PATH, strerror(errno));
-            return;
-        }
+
+/* Waits out the next retry delay and doubles it. Returns 0 without waiting
+ * once the budget is spent; the last wait is cut short to fit. An undock
+ * ends the wait early, the caller finds out from globalState. */
+static int backoffWait(AccyBackoff *b) {
+    int64_t remaining = b->deadline - SHAP_GetTimeUs();
+    uint32_t delay;
+    struct pollfd pfd;
+
+    if (remaining <= 0) {
+        return 0;
     }
-    else if (protocolType == PROTOCOL_HID) {
-        switchFd = open(HID_SWITCH_STATE_PATH, O_RDONLY, 0);
-        if (switchFd == -1) {
-            DBG_ERROR("Failed opening %s, errno = %s", HID_SWITCH_STATE_PATH, strerror(errno));
-            return;
+
+    delay = remaining < b->delay ? (uint32_t)remaining : b->delay;
+    b->delay *= 2;
+
+    pfd.fd = cancelEventFd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (delay + 999) / 1000) > 0) {
+        DBG_TRACE("Retry wait cut short");
+        clearEvent(cancelEventFd);
+    }
+    return 1;
+}
+
+
+static void signalEvent(int fd) {
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+        DBG_ERROR("eventfd write failed, errno = %s", strerror(errno));
+    }
+}
+
+
+/* Returns whether the event had been signalled, and resets it */
+static int clearEvent(int fd) {
+    uint64_t count = 0;
+
+    return read(fd, &count, sizeof(count)) == sizeof(count) && count;
+}
+
+
+/* Returns the first character of a switch state file, or -1 */
+static int readSwitchFile(int protocolType) {
+    char buf[16];
+    int count;
+    int *fd = &switchFds[protocolType];
+
+    if (*fd == -1) {
+        *fd = open(switchPaths[protocolType], O_RDONLY, 0);
+        if (*fd == -1) {
+            DBG_ERROR("Failed opening %s, errno = %s", switchPaths[protocolType], strerror(errno));
+            return -1;
         }
     }
 
     do {
-      count = read(switchFd, buf, SIZE);
+      count = pread(*fd, buf, sizeof(buf), 0);
     } while (count < 0 && errno == EINTR);
 
     if (count < 1) {
         DBG_ERROR("Error reading switch, returned %d", count);
-        close(switchFd);
-        return;
+        // reopen next time, the switch may have been re-registered
+        close(*fd);
+        *fd = -1;
+        return -1;
     }
 
-    if (buf[0] == DOCK_ATTACHED) {
+    return buf[0];
+}
+
+
+/* Applies a switch state, as the uevent carried it or, if state is -1, as
+ * read from sysfs */
+static void readSwitchState(int protocolType, int state) {
+    if (state == -1) {
+        state = readSwitchFile(protocolType);
+        if (state == -1) {
+            return;
+        }
+    }
+
+    if (state == DOCK_ATTACHED) {
         globalState = GLOBAL_STATE_DOCKED;
         if (protocolType == PROTOCOL_HID) {
-            char hidDevice[] = "/dev/hidraw0";
-            int i;
-            struct hidraw_devinfo hiddevinfo;
-            int status;
-
+            // the hidraw node is looked up by the protocol thread, USB
+            // enumeration may still be going on at this point
             globalProtocol = PROTOCOL_HID;
             DBG_TRACE("HID Dock Attached");
+        }
+        else if (protocolType == PROTOCOL_UART) {
+            globalProtocol = PROTOCOL_UART;
+        }
+    }
+    else if (state == DOCK_NOT_ATTACHED) {
+        globalState = GLOBAL_STATE_UNDOCKED;
+    }
+}
 
-            for (i = 0; i < HIDRAW_MAX_DEVICES; i++) {
-                hidFd = open(hidDevice, O_RDWR);
 
-                if(hidFd < 0) {
-                    DBG_ERROR("Failed to open HID Device:%s", hidDevice);
-                    break;
-                }
-                else {
-                    status = ioctl(hidFd, HIDIOCGRAWINFO, &hiddevinfo);
+/* Splits a netlink uevent, "action@devpath" followed by KEY=value strings,
+ * all NUL terminated. Returns 0 if it isn't one. */
+static int parseUevent(char *msg, int len, AccyUevent *ev) {
+    char *p = msg;
+    char *end = msg + len;
 
-                    if (status != IOCTL_SUCCESS) {
-                        DBG_ERROR("ioctl cmd:HIDIOCGRAWINFO failed for %s", hidDevice);
-                    }
-                    else {
-                        if(hiddevinfo.vendor == 0x22b8 && hiddevinfo.product == 0x0938) {
-                            DBG_TRACE("Found HD Dock: %s", hidDevice);
-                            break;
-                        }
-                        else {
-                            DBG_ERROR("Device: %s not a HD dock", hidDevice);
-                            close(hidDevice);
-                        }
-                    }
-                    // TODO: You cant do this.
-                    hidDevice[11]++;
-                }
-            }
+    memset(ev, 0, sizeof(*ev));
+    msg[len] = '\0';
 
-            hidDevice[11] = '0';
+    if (!strchr(msg, '@')) {
+        return 0;
+    }
+
+    while (p < end) {
+        if (!strncmp(p, "ACTION=", 7)) {
+            ev->action = p + 7;
         }
-        else if (protocolType == PROTOCOL_UART) {
-            globalProtocol = PROTOCOL_UART;
+        else if (!strncmp(p, "SUBSYSTEM=", 10)) {
+            ev->subsystem = p + 10;
+        }
+        else if (!strncmp(p, "DEVPATH=", 8)) {
+            ev->devpath = p + 8;
+        }
+        else if (!strncmp(p, "SWITCH_NAME=", 12)) {
+            ev->switchName = p + 12;
+        }
+        else if (!strncmp(p, "SWITCH_STATE=", 13)) {
+            ev->switchState = p + 13;
         }
+        p += strlen(p) + 1;
     }
-    else if (buf[0] == DOCK_NOT_ATTACHED) {
-        globalState = GLOBAL_STATE_UNDOCKED;
+
+    // switch devices are named after the last DEVPATH component
+    if (!ev->switchName && ev->devpath) {
+        const char *name = strrchr(ev->devpath, '/');
+        ev->switchName = name ? name + 1 : ev->devpath;
     }
 
-    close(switchFd);
+    return ev->subsystem != NULL;
 }
 
 
-static void waitForUevents() {
-    fd_set accySet;
-    char msg[1024];
-    int nready, status;
+static void handleUevent(const AccyUevent *ev) {
+    int protocolType, state;
 
-    FD_ZERO(&accySet);
-    FD_SET(ueventFd, &accySet);
+    if (strcmp(ev->subsystem, "switch") || !ev->switchName) {
+        return;
+    }
+
+    if (!strcmp(ev->switchName, HID_SWITCH_NAME)) {
+        protocolType = PROTOCOL_HID;
+    }
+    else if (!strcmp(ev->switchName, UART_SWITCH_NAME)) {
+        protocolType = PROTOCOL_UART;
+    }
+    else {
+        return;
+    }
+
+    state = ev->switchState ? ev->switchState[0] : -1;
+    readSwitchState(protocolType, state);
+    DBG_TRACE("%s: switch state %d", ev->switchName, globalState);
+
+    if (globalState == GLOBAL_STATE_UNDOCKED) {
+        signalEvent(cancelEventFd);
+    }
+    signalEvent(startEventFd);
+}
+
+
+static void waitForUevents() {
+    struct epoll_event event;
+    struct sockaddr_nl from;
+    socklen_t fromLen;
+    AccyUevent ev;
+    char msg[UEVENT_MSG_LEN + 1];
+    int epollFd, nready, status;
 
     /* at powerup, we might have missed the uevent. So, read switch */
-    readSwitchState(PROTOCOL_HID);
+    readSwitchState(PROTOCOL_HID, -1);
 
     if (globalState == GLOBAL_STATE_DOCKED) {
         DBG_TRACE("HID Dock attached at Power up");
-        sem_post(&SigAccyProtStart);
+        signalEvent(startEventFd);
     }
     else {
-        readSwitchState(PROTOCOL_UART);
+        readSwitchState(PROTOCOL_UART, -1);
         if (globalState == GLOBAL_STATE_DOCKED) {
             DBG_TRACE("UART Dock attached at Power up");
-            sem_post(&SigAccyProtStart);
+            signalEvent(startEventFd);
         }
     }
 
+    epollFd = epoll_create(1);
+    if (epollFd < 0) {
+        DBG_ERROR("epoll_create failed, errno = %s", strerror(errno));
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = ueventFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ueventFd, &event) < 0) {
+        DBG_ERROR("epoll_ctl failed, errno = %s", strerror(errno));
+        close(epollFd);
+        return;
+    }
+
     while(1) {
-        nready = select(ueventFd+1, &accySet, NULL, NULL, NULL);
-
-        if (nready > 0) {
-            if (FD_ISSET(ueventFd, &accySet)) {
-                status = recv(ueventFd, msg, sizeof(msg), MSG_DONTWAIT);
-                if ((status > 0) && (strcasestr(msg, "whisper_hid")) && (strcasestr(msg, "switch"))) {
-                    readSwitchState(PROTOCOL_HID);
-                    DBG_TRACE("HID: SEM POST after readSwitchState %d", globalState);
-                    sem_post(&SigAccyProtStart);
-                }
-                else if ((status > 0) && (strcasestr(msg, "whisper")) && (strcasestr(msg, "switch"))) {
-                    readSwitchState(PROTOCOL_UART);
-                    DBG_TRACE("UART: SEM POST after readSwitchState %d", globalState);
-                    sem_post(&SigAccyProtStart);
-                }
+        nready = epoll_wait(epollFd, &event, 1, -1);
+
+        if (nready < 0) {
+            if (errno != EINTR) {
+                DBG_ERROR("epoll_wait errored out, errno = %s", strerror(errno));
             }
+            continue;
         }
-        else {
-            DBG_ERROR("Select errored out. nready = %d, errno = %s", nready, strerror(errno));
+
+        // drain the socket, a dock cycle can queue several events
+        while (1) {
+            fromLen = sizeof(from);
+            status = recvfrom(ueventFd, msg, UEVENT_MSG_LEN, MSG_DONTWAIT,
+                              (struct sockaddr *) &from, &fromLen);
+            if (status < 0 && errno == EINTR) {
+                continue;
+            }
+            if (status <= 0) {
+                break;
+            }
+            // only the kernel sends uevents
+            if (from.nl_pid != 0) {
+                continue;
+            }
+            if (parseUevent(msg, status, &ev)) {
+                handleUevent(&ev);
+            }
         }
     }
 }
@@ -288,9 +444,10 @@ static void accyProtDaemon(void *arg) {
     unsigned int dockDetails;
     uint8_t dockType = NO_DOCK;
     int status;
-    struct timespec ts;
-    struct timeval tv;
-    uint8_t statusFuse[8], FSNo[8], RomSN[8], RomRNo[8];
+    AccyBackoff wakeBackoff, commBackoff;
+    uint8_t statusFuse[8], FSNo[8], RomSN[8];
+    SHA_DockIdentity identity;
+    uint8_t cached;
     char devInfo[32];
     char devProp[8];
 
@@ -314,14 +471,21 @@ static void accyProtDaemon(void *arg) {
     switchUser();
 
     while(1) {
+        struct pollfd pfd;
+
+        pfd.fd = startEventFd;
+        pfd.events = POLLIN;
         do {
-            status = sem_wait(&SigAccyProtStart);
+            status = poll(&pfd, 1, -1);
         } while (status < 0 && errno == EINTR);
 
-        if (status == -1) {
-            DBG_ERROR("SEM WAIT failed with -1. errno = %s", strerror(errno));
+        if (status < 0) {
+            DBG_ERROR("poll on the start event failed. errno = %s", strerror(errno));
             break;
         }
+        clearEvent(startEventFd);
+        // an undock before this point is already reflected in globalState
+        clearEvent(cancelEventFd);
 
         /* If already undocked, why do anything */
         if (globalState == GLOBAL_STATE_UNDOCKED)  {
@@ -335,11 +499,15 @@ static void accyProtDaemon(void *arg) {
 
         wakeLock = acquire_wake_lock(PARTIAL_WAKE_LOCK, wakeLockString);
         tryComm = 1;
+        backoffInit(&commBackoff, COMM_BACKOFF_US, COMM_BUDGET_US);
         while (tryComm && (globalState == GLOBAL_STATE_DOCKED)) {
+            // an undock that came and went before this attempt is not for it
+            clearEvent(cancelEventFd);
             if (globalProtocol == PROTOCOL_UART) {
                 if (SHA_SUCCESS == SHAP_OpenChannel()) {
                     tryWakeup = 1;
                     wakeupSuccess = 0;
+                    backoffInit(&wakeBackoff, WAKEUP_BACKOFF_US, WAKEUP_BUDGET_US);
                     while (tryWakeup) {
                         if (SHAC_Wakeup() == SHA_SUCCESS) {
                             DBG_TRACE("WAKEUP SUCCESS %d ", tryWakeup);
@@ -347,15 +515,12 @@ static void accyProtDaemon(void *arg) {
                             wakeupSuccess = 1;
                         }
                         else {
-                            if (tryWakeup == MAX_TRY_WAKEUP) {
+                            if (tryWakeup == MAX_TRY_WAKEUP || !backoffWait(&wakeBackoff)) {
                                 DBG_ERROR("GIVING UP WAKEUP after %d tries", tryWakeup);
                                 tryWakeup = 0;
                             }
                             else {
                                 DBG_TRACE("TRYING WAKEUP ONCE MORE");
-                                ts.tv_sec = 0;
-                                ts.tv_nsec = 10000000; // 10 ms
-                                nanosleep(&ts, NULL);
                                 tryWakeup++;
                             }
                         }
@@ -366,37 +531,20 @@ static void accyProtDaemon(void *arg) {
                     }
 
                     if ((wakeupSuccess)  && (globalState == GLOBAL_STATE_DOCKED)) {
-                        DBG_TRACE("Reading Status & MfgId");
-                        // Read Status fuses and MfgId fuses
-                        status = SHAC_Read(0x01, 0x0002);
-                        if (status == SHA_SUCCESS) {
-                            copyResults(8, statusFuse);
+                        DBG_TRACE("Reading Serial Number, Status & MfgId, ROM MfgId and ROM SN");
+                        status = SHAC_ReadDockIdentity(&identity, &cached);
+                        if (status == SHA_SUCCESS && globalState == GLOBAL_STATE_DOCKED) {
+                            memcpy(statusFuse, identity.StatusFuse, sizeof(statusFuse));
+                            memcpy(FSNo, identity.FuseSN, sizeof(FSNo));
+                            memcpy(RomSN, identity.RomSN, sizeof(RomSN));
                             // TODO: bytes in wrong order for some reason??
                             uint8_t temp[2];
                             temp[0] = statusFuse[1];
                             temp[1] = statusFuse[3];
                             statusFuse[1] = temp[1];
                             statusFuse[3] = temp[0];
-                        }
-
-                        if (globalState == GLOBAL_STATE_DOCKED && status == SHA_SUCCESS) {
-                            DBG_TRACE("Reading Serial Number");
-                            // Read Fuse Serial number value
-                            status = SHAC_Read(0x01, 0x0003); 
-                            if (status == SHA_SUCCESS) {
-                                copyResults(8, FSNo);
-                            }
-                        }
-
-                        if (globalState == GLOBAL_STATE_DOCKED && status == SHA_SUCCESS) {
-                            DBG_TRACE("Reading ROM MfgId and ROM SN");
-                            // ROM MfgId and ROM SN
-                            status = SHAC_Read(0x00, 0x0000); 
-                            if (status == SHA_SUCCESS) {
-                                copyResults(8, RomSN);
-				DBG_TRACE("Authentication succeed");
-                                globalState = GLOBAL_STATE_DOCKED_IDSUCC;
-                            }
+                            DBG_TRACE("Authentication succeed%s", cached ? " (known dock)" : "");
+                            globalState = GLOBAL_STATE_DOCKED_IDSUCC;
                         }
                     }
                 }
@@ -409,25 +557,16 @@ static void accyProtDaemon(void *arg) {
                 uint8_t displaybuff[65] = {0x0};
                 int hidStatus;
 
-                DBG_TRACE("HID: Sending status query");
-                hidStatus = HID_FAILURE;
-                memset(writebuff,0x00,sizeof(writebuff));
-                memcpy(writebuff, hidStatusQuery, sizeof(hidStatusQuery));
-
-                status = write(hidFd, writebuff, HID_STATUS_QUERY_LENGTH);
-                if (status != HID_STATUS_QUERY_LENGTH) {
-                    DBG_ERROR("Failed writing status query (errno = %s)", strerror(errno));
-                }
-                else {
-                    hidStatus = HID_SUCCESS;
-                }
+                hidStatus = hidDockOpen() < 0 ? HID_FAILURE : HID_SUCCESS;
 
                 if (globalState == GLOBAL_STATE_DOCKED && hidStatus == HID_SUCCESS) {
-                    DBG_TRACE("HID: Reading status query response");
-                    status = read(hidFd, readbuff, HID_STATUS_MSG_LENGTH);
+                    DBG_TRACE("HID: Sending status query");
+                    memset(writebuff,0x00,sizeof(writebuff));
+                    memcpy(writebuff, hidStatusQuery, sizeof(hidStatusQuery));
 
-                    if (status != HID_STATUS_MSG_LENGTH) {
-                        DBG_ERROR("HID: Failed reading status query response, errno = %s", strerror(errno));
+                    if (hidDockTransfer(writebuff, HID_STATUS_QUERY_LENGTH, readbuff, HID_STATUS_MSG_LENGTH,
+                                        HID_RESPONSE_TIMEOUT_MS, cancelEventFd) != 0) {
+                        DBG_ERROR("HID: Failed status query");
                         hidStatus = HID_FAILURE;
                     }
                     else {
@@ -444,19 +583,9 @@ static void accyProtDaemon(void *arg) {
                     memset(writebuff,0x00,sizeof(writebuff));
                     memcpy(writebuff, hidIdQuery, sizeof(hidIdQuery));
 
-                    status = write(hidFd, writebuff, HID_ID_QUERY_LENGTH);
-                    if (status != HID_ID_QUERY_LENGTH) {
-                        DBG_ERROR("HID: Error writing ID query, %d", status);
-                        hidStatus = HID_FAILURE;
-                    }
-                }
-
-                if (globalState == GLOBAL_STATE_DOCKED && hidStatus == HID_SUCCESS) {
-                    DBG_TRACE("Reading ID query response");
-                    status = read(hidFd, readbuff, HID_ID_MSG_LENGTH);
-
-                    if (status != HID_ID_MSG_LENGTH) {
-                        DBG_ERROR("HID: Error reading ID query response, errno = %s", strerror(errno));
+                    if (hidDockTransfer(writebuff, HID_ID_QUERY_LENGTH, readbuff, HID_ID_MSG_LENGTH,
+                                        HID_RESPONSE_TIMEOUT_MS, cancelEventFd) != 0) {
+                        DBG_ERROR("HID: Failed ID query");
                         hidStatus = HID_FAILURE;
                     }
                     else {
@@ -483,6 +612,11 @@ static void accyProtDaemon(void *arg) {
                         globalState = GLOBAL_STATE_DOCKED_IDSUCC;
                     }
                 }
+
+                // look the node up again next attempt, it may have gone stale
+                if (hidStatus == HID_FAILURE) {
+                    hidDockClose();
+                }
             }
 
             if (globalState == GLOBAL_STATE_DOCKED_IDSUCC) {
@@ -523,7 +657,7 @@ static void accyProtDaemon(void *arg) {
 
             /* if the global state is still docked, then increment the retry counter */
             if (globalState == GLOBAL_STATE_DOCKED) {
-                if (tryComm == MAX_TRY_COMM) {
+                if (tryComm == MAX_TRY_COMM || !backoffWait(&commBackoff)) {
                     DBG_ERROR("GIVING UP AFTER %d tries", tryComm);
                     tryComm = 0;
 
@@ -533,16 +667,18 @@ static void accyProtDaemon(void *arg) {
                     globalState = GLOBAL_STATE_DOCKED_IDFAIL;
                 }
                 else {
-                    ts.tv_sec = 0;
-                    ts.tv_nsec = 100000000; // 100 ms
-                    nanosleep(&ts, NULL);
-
                     tryComm++;
                     DBG_TRACE("Trying COMM %d time", tryComm);
                 }
             }
         }
 
+        // The tty and the hidraw node were kept open across the attempts
+        // of this attach
+        SHAP_CloseFile();
+        hidDockClose();
+        SHAP_LogDelayStats();
+
         if (wakeLock) {
             release_wake_lock(wakeLockString);
             wakeLock = 0;
@@ -573,8 +709,7 @@ static void accySigHandler(signed int signal) {
                 close(cpcapFd);
             if (ttyFd > 0)
                 close(ttyFd);
-            if (hidFd > 0)
-                close(hidFd);
+            hidDockClose();
             exit(0);
             break;
         default:
@@ -641,6 +776,14 @@ static int accyInit(void) {
 
     ueventFd = s;
 
+    startEventFd = eventfd(0, EFD_NONBLOCK);
+    cancelEventFd = eventfd(0, EFD_NONBLOCK);
+    if (startEventFd < 0 || cancelEventFd < 0) {
+        DBG_ERROR("eventfd failed. errno = %s", strerror(errno));
+        return 0;
+    }
+    SHAP_SetCancelFd(cancelEventFd);
+
     return (ueventFd > 0);
 }
 
@@ -648,7 +791,7 @@ static int accyInit(void) {
 
 void doIoctl(int cmd, unsigned int data, char *dev_id, char *dev_prop) {
     int i, status = -1;
-    struct timespec ts;
+    AccyBackoff backoff;
     struct cpcap_whisper_request req;
 
     memset(req.dock_id, 0, CPCAP_WHISPER_ID_SIZE);
@@ -658,6 +801,7 @@ void doIoctl(int cmd, unsigned int data, char *dev_id, char *dev_prop) {
     if(dev_prop != NULL)
       strcpy(req.dock_prop, dev_prop);
 
+    backoffInit(&backoff, IOCTL_BACKOFF_US, IOCTL_BUDGET_US);
     for (i = 0; i < MAX_TRY_IOCTL; i++) {
         DBG_TRACE("ioctl cmd %d: %d,", cmd, data);
         if(dev_id == NULL) {
@@ -671,11 +815,11 @@ void doIoctl(int cmd, unsigned int data, char *dev_id, char *dev_prop) {
 
         if (status != IOCTL_SUCCESS) {
             DBG_ERROR("ioctl returned %d with error: %d", status, errno);
-            ts.tv_sec = 0;
-            ts.tv_nsec = 50000000; // 50 ms
-            DBG_TRACE("Wait 50ms.");
-            nanosleep(&ts, NULL);
             globalState = GLOBAL_STATE_UNDOCKED;
+            if (!backoffWait(&backoff)) {
+                DBG_ERROR("ioctl retry budget spent after %d tries", i + 1);
+                break;
+            }
         }
         else {
             DBG_TRACE("ioctl success");
@@ -684,37 +828,10 @@ void doIoctl(int cmd, unsigned int data, char *dev_id, char *dev_prop) {
         }
     }
 
-    if (hidFd > 0) {
-        close(hidFd);
-        hidFd = -1;
-    }
-
     return;
 }
 
 
-static void copyResults(int8_t cmdSize, uint8_t *out) {
-    int i;
-    char charOut[128];
-
-    mainparms = SHAC_GetData();
-
-    createOutput(mainparms->txBuffer, charOut, cmdSize);
-    charOut[cmdSize*2] = '\0';
-
-    DBG_TRACE("Send Value: %s", charOut);
-
-    for(i = 0; i < mainparms->rxSize; i++) {
-            out[i] = mainparms->rxBuffer[i];
-    }
-
-    createOutput(mainparms->rxBuffer, charOut, cmdSize);
-    charOut[cmdSize*2] = '\0';
-    DBG_TRACE("Receive Value: = %s", charOut);
-}
-
-
-
 int main(int argc, char *argv[]) {
     int retVal;
 
@@ -724,8 +841,8 @@ int main(int argc, char *argv[]) {
        DBG_ERROR("accyInit failed");
     }
 
-    if (sem_init(&SigAccyProtStart, 0, 0) != 0) {
-        DBG_ERROR("Sem_init failed. errno = %d", errno);
+    if (SHAC_CrcInit() != SHA_SUCCESS) {
+        DBG_ERROR("CRC tables failed the self-test, using the bitwise CRC");
     }
 
     //TODO:  First time failure to set parameters
@@ -34,7 +34,9 @@
 #define MAX_IO_TIMEOUT     85   //85 ms
 #define LOG_SIZE_LIMIT 10000
 
+#if !defined(LOG_ACCY_FS) && !defined(LOG_ACCY_OFF)
 #define LOG_ACCY_ANDROID
+#endif
 
 #if defined(LOG_ACCY_ANDROID)
 #define DBG_TRACE(fmt,x...) \
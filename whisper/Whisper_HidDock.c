@@ -0,0 +1,236 @@
+// Copyright (c) 2010, Atmel Corporation.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Atmel nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/hidraw.h>
+
+#include "SHA_TimeUtils.h"
+#include "Whisper_AccyMain.h"
+#include "Whisper_HidDock.h"
+
+
+#define HIDRAW_SYSFS_PATH       "/sys/class/hidraw"
+#define HIDRAW_DEV_PATH         "/dev"
+#define HID_NODE_NAME_LEN       32
+
+
+/* The dock's hidraw node once found, tried first on the next attach */
+static char dockNode[HID_NODE_NAME_LEN];
+/* Open fd of dockNode, reused until the dock goes away */
+static int dockFd = -1;
+
+
+/* Returns whether fd is a hidraw node of the HD dock */
+static int isDock(int fd) {
+    struct hidraw_devinfo info;
+
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) != 0) {
+        return 0;
+    }
+    return (uint16_t) info.vendor == HID_DOCK_VENDOR &&
+           (uint16_t) info.product == HID_DOCK_PRODUCT;
+}
+
+
+/* Opens /dev/<node> if it is the dock, returns the fd or -1 */
+static int openNode(const char *node) {
+    char path[64];
+    int fd;
+
+    snprintf(path, sizeof(path), HIDRAW_DEV_PATH "/%s", node);
+    fd = open(path, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!isDock(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/* Returns whether the HID_ID in the uevent of a hidraw node names the dock,
+ * so other HID devices are skipped without being opened */
+static int sysfsMatches(const char *node) {
+    char path[128];
+    char buf[512];
+    char *line;
+    unsigned int bus, vendor, product;
+    int fd, count;
+
+    snprintf(path, sizeof(path), HIDRAW_SYSFS_PATH "/%s/device/uevent", node);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        // no metadata to go by, let the ioctl decide
+        return 1;
+    }
+    count = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (count <= 0) {
+        return 1;
+    }
+    buf[count] = '\0';
+
+    line = strstr(buf, "HID_ID=");
+    if (!line || sscanf(line + 7, "%x:%x:%x", &bus, &vendor, &product) != 3) {
+        return 1;
+    }
+    return vendor == HID_DOCK_VENDOR && product == HID_DOCK_PRODUCT;
+}
+
+
+/* Walks the hidraw class for the dock, caching its node name */
+static int discover(void) {
+    DIR *dir;
+    struct dirent *entry;
+    int fd = -1;
+
+    dir = opendir(HIDRAW_SYSFS_PATH);
+    if (!dir) {
+        DBG_ERROR("Failed opening %s, errno = %s", HIDRAW_SYSFS_PATH, strerror(errno));
+        return -1;
+    }
+
+    while (fd < 0 && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "hidraw", 6) || !sysfsMatches(entry->d_name)) {
+            continue;
+        }
+        fd = openNode(entry->d_name);
+        if (fd >= 0) {
+            strncpy(dockNode, entry->d_name, sizeof(dockNode) - 1);
+            dockNode[sizeof(dockNode) - 1] = '\0';
+        }
+    }
+    closedir(dir);
+
+    return fd;
+}
+
+
+/** Returns an fd on the HD dock's hidraw node, -1 if it isn't there (yet).
+ *  The fd is kept for later calls until hidDockClose(). */
+int hidDockOpen(void) {
+    if (dockFd >= 0) {
+        return dockFd;
+    }
+
+    if (dockNode[0]) {
+        dockFd = openNode(dockNode);
+    }
+    if (dockFd < 0) {
+        dockFd = discover();
+    }
+
+    if (dockFd >= 0) {
+        DBG_TRACE("Found HD Dock: %s", dockNode);
+    }
+    else {
+        DBG_ERROR("HD Dock not found");
+    }
+    return dockFd;
+}
+
+
+/** Closes the dock's fd, when it went away or stopped answering. The node
+ *  name stays cached. */
+void hidDockClose(void) {
+    if (dockFd >= 0) {
+        close(dockFd);
+        dockFd = -1;
+    }
+}
+
+
+/** Writes a query report and reads the response report, giving up after
+ *  timeoutMs or once cancelFd (-1 for none) becomes readable.
+ *  \return 0 on success, -1 on failure */
+int hidDockTransfer(const uint8_t *query, int queryLen, uint8_t *resp, int respLen,
+                    int timeoutMs, int cancelFd) {
+    struct pollfd pfd[2];
+    int64_t deadline, remaining;
+    int status;
+
+    if (dockFd < 0) {
+        return -1;
+    }
+
+    do {
+        status = write(dockFd, query, queryLen);
+    } while (status < 0 && errno == EINTR);
+    if (status != queryLen) {
+        DBG_ERROR("HID: write returned %d, errno = %s", status, strerror(errno));
+        return -1;
+    }
+
+    pfd[0].fd = dockFd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cancelFd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    deadline = SHAP_GetTimeUs() + timeoutMs * 1000LL;
+
+    while (1) {
+        do {
+            status = read(dockFd, resp, respLen);
+        } while (status < 0 && errno == EINTR);
+        if (status == respLen) {
+            return 0;
+        }
+        if (status >= 0 || errno != EAGAIN) {
+            DBG_ERROR("HID: read returned %d, errno = %s", status, strerror(errno));
+            return -1;
+        }
+
+        remaining = deadline - SHAP_GetTimeUs();
+        if (remaining <= 0) {
+            DBG_ERROR("HID: no response in %d ms", timeoutMs);
+            return -1;
+        }
+        status = poll(pfd, cancelFd < 0 ? 1 : 2, (int) ((remaining + 999) / 1000));
+        if (status < 0 && errno != EINTR) {
+            DBG_ERROR("HID: poll failed, errno = %s", strerror(errno));
+            return -1;
+        }
+        if (pfd[1].revents & POLLIN) {
+            DBG_TRACE("HID: transfer cancelled");
+            return -1;
+        }
+        if (pfd[0].revents & (POLLERR | POLLHUP)) {
+            DBG_ERROR("HID: device went away");
+            return -1;
+        }
+    }
+}
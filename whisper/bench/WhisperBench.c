@@ -0,0 +1,199 @@
+// Copyright (c) 2010, Atmel Corporation.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Atmel nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/*
+ * Host benchmark of the whisper UART path against the simulated device in
+ * WhisperSim.c. Each iteration is one attach the way accyProtDaemon runs
+ * it: open the channel, wake with retries, read the identity, put the
+ * device to sleep, with comm retries around all of it. Reports the
+ * wake-to-ID latency distribution, retries and CRC throughput.
+ *
+ *   whisper_bench [-n attaches] [-l latency_us] [-j jitter_us]
+ *                 [-b bit_error_rate] [-e echo_loss_rate] [-s] [-f]
+ *
+ * -s keeps presenting the same dock, so the identity cache is hit;
+ * -f doesn't hold characters back for their time on the wire.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "SA_Phys_Linux.h"
+#include "SHA_Comm.h"
+#include "SHA_CommMarshalling.h"
+#include "SHA_Status.h"
+#include "SHA_TimeUtils.h"
+#include "WhisperSim.h"
+
+
+// as in Whisper_AccyMain.c
+#define MAX_TRY_WAKEUP      4
+#define MAX_TRY_COMM        2
+#define WAKEUP_BACKOFF_US   1000
+#define CRC_ROUNDS          200000
+
+
+typedef struct {
+    uint32_t wakeRetries;
+    uint32_t commRetries;
+    uint32_t failures;
+    uint32_t cacheHits;
+} BenchCounts;
+
+
+static int compareLatency(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+
+/* One attach, returns whether the dock was identified */
+static int attach(BenchCounts *counts) {
+    SHA_DockIdentity identity;
+    uint8_t cached;
+    int tryComm, tryWakeup;
+
+    for (tryComm = 1; tryComm <= MAX_TRY_COMM; tryComm++) {
+        if (tryComm > 1)
+            counts->commRetries++;
+        if (SHAP_OpenChannel() != SHA_SUCCESS)
+            continue;
+
+        for (tryWakeup = 1; tryWakeup <= MAX_TRY_WAKEUP; tryWakeup++) {
+            if (SHAC_Wakeup() == SHA_SUCCESS)
+                break;
+            counts->wakeRetries++;
+            SHAP_Delay(WAKEUP_BACKOFF_US << (tryWakeup - 1));
+        }
+
+        if (tryWakeup <= MAX_TRY_WAKEUP &&
+                SHAC_ReadDockIdentity(&identity, &cached) == SHA_SUCCESS) {
+            SHAP_CloseChannel();
+            counts->cacheHits += cached;
+            return 1;
+        }
+        SHAP_CloseChannel();
+    }
+
+    counts->failures++;
+    return 0;
+}
+
+
+static void benchCrc(void) {
+    uint8_t buf[SHA_CRC_TEST_SIZE];
+    volatile uint16_t sink = 0;
+    int64_t start, elapsed;
+    int i;
+
+    for (i = 0; i < (int) sizeof(buf); i++)
+        buf[i] = i * 37 + 11;
+
+    start = SHAP_GetTimeUs();
+    for (i = 0; i < CRC_ROUNDS; i++)
+        sink ^= SHAC_CalculateCrc(buf, 35);
+    elapsed = SHAP_GetTimeUs() - start;
+
+    printf("crc:          %.1f ns per 35-byte response, %.1f MB/s\n",
+           elapsed * 1000.0 / CRC_ROUNDS,
+           elapsed ? 35.0 * CRC_ROUNDS / elapsed : 0.0);
+}
+
+
+int main(int argc, char *argv[]) {
+    WhisperSimConfig config;
+    WhisperSimStats stats;
+    BenchCounts counts;
+    int64_t *latency;
+    int64_t start;
+    int iterations = 200, sameDock = 0, n = 0, i, c;
+
+    memset(&config, 0, sizeof(config));
+    memset(&counts, 0, sizeof(counts));
+    config.paced = 1;
+    config.seed = 1;
+
+    while ((c = getopt(argc, argv, "n:l:j:b:e:sf")) != -1) {
+        switch (c) {
+        case 'n': iterations = atoi(optarg); break;
+        case 'l': config.latencyUs = atoi(optarg); break;
+        case 'j': config.jitterUs = atoi(optarg); break;
+        case 'b': config.bitErrorRate = atof(optarg); break;
+        case 'e': config.echoLossRate = atof(optarg); break;
+        case 's': sameDock = 1; break;
+        case 'f': config.paced = 0; break;
+        default:
+            fprintf(stderr, "usage: %s [-n attaches] [-l latency_us] [-j jitter_us] "
+                    "[-b bit_error_rate] [-e echo_loss_rate] [-s] [-f]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0)
+        iterations = 1;
+
+    if (SHAC_CrcInit() != SHA_SUCCESS)
+        printf("crc:          tables failed the self-test\n");
+    benchCrc();
+
+    if (whisperSimStart(&config) != 0) {
+        perror("whisper_bench: pty");
+        return 1;
+    }
+
+    latency = calloc(iterations, sizeof(*latency));
+    for (i = 0; i < iterations; i++) {
+        if (!sameDock)
+            whisperSimNextDock();
+        start = SHAP_GetTimeUs();
+        if (attach(&counts))
+            latency[n++] = SHAP_GetTimeUs() - start;
+        SHAP_CloseFile();
+    }
+
+    whisperSimGetStats(&stats);
+    whisperSimStop();
+
+    qsort(latency, n, sizeof(*latency), compareLatency);
+    printf("attaches:     %d, identified %d, %u from the identity cache\n",
+           iterations, n, counts.cacheHits);
+    if (n) {
+        printf("wake-to-ID:   p50 %lld us, p90 %lld us, p99 %lld us, max %lld us\n",
+               (long long) latency[n / 2], (long long) latency[n * 9 / 10],
+               (long long) latency[n * 99 / 100], (long long) latency[n - 1]);
+    }
+    printf("retries:      %u wakeup, %u comm, %u response (%u transmit tokens, %u commands)\n",
+           counts.wakeRetries, counts.commRetries,
+           stats.transmitTokens - stats.wakes - stats.commands,
+           stats.transmitTokens, stats.commands);
+    printf("faults:       %u bits flipped, %u echoes dropped, %u bad command CRCs\n",
+           stats.flippedBits, stats.droppedEchoes, stats.badCrcs);
+
+    SHAP_LogDelayStats();
+    free(latency);
+    return counts.failures ? 2 : 0;
+}
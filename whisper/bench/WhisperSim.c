@@ -0,0 +1,401 @@
+// Copyright (c) 2010, Atmel Corporation.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Atmel nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+/*
+ * A single-wire SHA204-style device behind a pty. The benchmark builds the
+ * physical layer with -Dopen=whisper_bench_open, so opening /dev/ttyHS0
+ * gets the pty slave while a thread here plays the device on the master:
+ * it echoes what the host sends, wakes on the wake pulse, answers READ
+ * from a small fuse map and everything else with a status packet, and
+ * sleeps on the sleep token. Latency, bit errors and lost echoes are
+ * injected as configured.
+ */
+#undef open
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SHA_Comm.h"
+#include "WhisperSim.h"
+
+
+#define SIM_TTY_PORT        "/dev/ttyHS0"
+
+// what the host sends per bit, see SA_Phys_Linux.c
+#define HOST_ONE            0x7F
+#define HOST_ZERO           0x7D
+// what the device's bits read as: a zero pulls the line low again in the
+// middle of the character, which shows in bits 2..6
+#define DEV_ONE             0x7F
+#define DEV_ZERO            0x6D
+
+#define TOKEN_WAKE          0x00
+#define TOKEN_COMMAND       0x77
+#define TOKEN_TRANSMIT      0x88
+#define TOKEN_SLEEP         0xCC
+
+#define CMD_READ            0x02
+#define STATUS_OK           0x00
+#define STATUS_COMM         0xFF
+
+#define CHAR_TIME_US        40
+#define MAX_PACKET          128
+
+
+static WhisperSimConfig config;
+static WhisperSimStats stats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static volatile int running;
+static int masterFd = -1;
+static char slavePath[64];
+
+// device state
+static int awake;
+static uint8_t response[MAX_PACKET];
+static int responseLen;
+static uint8_t packet[MAX_PACKET];
+static int packetLen;
+static int inCommand;
+static uint8_t bits, bitCount;
+static int dropEcho;
+static uint32_t dockSerial = 0x1000;
+
+
+int whisper_bench_open(const char *path, int flags, ...) {
+    va_list ap;
+    int mode;
+
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+
+    if (!strcmp(path, SIM_TTY_PORT) && slavePath[0])
+        path = slavePath;
+    return open(path, flags, mode);
+}
+
+
+static int chance(double p) {
+    return p > 0 && rand_r(&config.seed) < p * ((double) RAND_MAX + 1);
+}
+
+
+static void sleepUs(uint32_t us) {
+    struct timespec ts;
+
+    if (!us)
+        return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+
+static void sendChars(const uint8_t *chars, int len) {
+    int n;
+
+    if (config.paced)
+        sleepUs(len * CHAR_TIME_US);
+    while (len > 0) {
+        n = write(masterFd, chars, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        chars += n;
+        len -= n;
+    }
+}
+
+
+static void setResponse(const uint8_t *data, int len) {
+    uint16_t crc;
+
+    memcpy(response, data, len - 2);
+    response[0] = len;
+    crc = SHAC_CalculateCrc(response, len - 2);
+    memcpy(&response[len - 2], &crc, 2);
+    responseLen = len;
+}
+
+
+static void setStatus(uint8_t status) {
+    uint8_t p[4] = {4, status, 0, 0};
+
+    setResponse(p, sizeof(p));
+}
+
+
+/* Fuse map of the simulated Car Dock, one 4-byte word per address */
+static void readWord(uint8_t zone, uint16_t address, uint8_t *out) {
+    memset(out, 0, 4);
+    if (zone == 0x01 && address == 0x0002) {
+        // 0x12 0xC0 0x00 once the daemon swapped bytes 1 and 3 back
+        out[0] = 0x00; out[1] = 0xC0; out[2] = 0x12; out[3] = 0x00;
+    }
+    else if (zone == 0x01 && address == 0x0003) {
+        out[0] = 0x5A;
+        out[1] = dockSerial >> 16;
+        out[2] = dockSerial >> 8;
+        out[3] = dockSerial;
+    }
+    else if (zone == 0x00 && address == 0x0000) {
+        out[0] = 0x3B; out[1] = 0x03; out[2] = 0x47; out[3] = 0x11;
+    }
+}
+
+
+static void runCommand(void) {
+    uint8_t r[MAX_PACKET];
+    uint16_t crc, sent;
+    uint16_t address;
+    int count = packet[0];
+
+    pthread_mutex_lock(&statsLock);
+    stats.commands++;
+    pthread_mutex_unlock(&statsLock);
+
+    crc = SHAC_CalculateCrc(packet, count - 2);
+    memcpy(&sent, &packet[count - 2], 2);
+    if (count < 7 || crc != sent) {
+        pthread_mutex_lock(&statsLock);
+        stats.badCrcs++;
+        pthread_mutex_unlock(&statsLock);
+        setStatus(STATUS_COMM);
+        return;
+    }
+
+    if (packet[1] != CMD_READ) {
+        setStatus(STATUS_OK);
+        return;
+    }
+
+    memcpy(&address, &packet[3], 2);
+    if (packet[2] & 0x80) {
+        int i;
+        for (i = 0; i < 8; i++)
+            readWord(packet[2] & 0x7F, address * 8 + i, &r[1 + i * 4]);
+        setResponse(r, 35);
+    }
+    else {
+        readWord(packet[2], address, &r[1]);
+        setResponse(r, 7);
+    }
+}
+
+
+static void transmit(void) {
+    uint8_t chars[MAX_PACKET * 8];
+    int i, j, n = 0;
+
+    pthread_mutex_lock(&statsLock);
+    stats.transmitTokens++;
+    pthread_mutex_unlock(&statsLock);
+
+    if (!awake || !responseLen)
+        return;
+
+    for (i = 0; i < responseLen; i++) {
+        for (j = 0; j < 8; j++) {
+            int one = (response[i] >> j) & 1;
+            if (chance(config.bitErrorRate)) {
+                one = !one;
+                pthread_mutex_lock(&statsLock);
+                stats.flippedBits++;
+                pthread_mutex_unlock(&statsLock);
+            }
+            chars[n++] = one ? DEV_ONE : DEV_ZERO;
+        }
+    }
+
+    sleepUs(config.latencyUs + (config.jitterUs ? rand_r(&config.seed) % config.jitterUs : 0));
+    sendChars(chars, n);
+
+    pthread_mutex_lock(&statsLock);
+    stats.responses++;
+    pthread_mutex_unlock(&statsLock);
+}
+
+
+/* Takes one decoded byte from the host */
+static void hostByte(uint8_t b) {
+    if (inCommand) {
+        packet[packetLen++] = b;
+        if (packetLen == 1 && (b < 4 || b > MAX_PACKET)) {
+            inCommand = 0;
+            setStatus(STATUS_COMM);
+        }
+        else if (packetLen > 1 && packetLen == packet[0]) {
+            inCommand = 0;
+            if (awake)
+                runCommand();
+        }
+        return;
+    }
+
+    if (b == TOKEN_COMMAND) {
+        inCommand = 1;
+        packetLen = 0;
+    }
+}
+
+
+static void *deviceThread(void *arg __attribute__((unused))) {
+    uint8_t in[512], echo[512];
+    struct pollfd pfd;
+    int n, i, e;
+
+    pfd.fd = masterFd;
+    pfd.events = POLLIN;
+
+    while (running) {
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+        if (!(pfd.revents & POLLIN)) {
+            // hung up between attaches, until the host opens the slave again
+            sleepUs(1000);
+            continue;
+        }
+        n = read(masterFd, in, sizeof(in));
+        if (n <= 0)
+            continue;
+
+        e = 0;
+        for (i = 0; i < n; i++) {
+            uint8_t c = in[i];
+
+            if (c == TOKEN_WAKE || c == TOKEN_SLEEP) {
+                // The host never reads the sleep echo; on the wire it is
+                // back before the next flush, here it could land after it.
+                if (c == TOKEN_WAKE)
+                    echo[e++] = c;
+                bitCount = bits = 0;
+                inCommand = 0;
+                if (c == TOKEN_WAKE) {
+                    uint8_t status[4] = {4, 0x11, 0, 0};
+                    awake = 1;
+                    setResponse(status, sizeof(status));
+                    pthread_mutex_lock(&statsLock);
+                    stats.wakes++;
+                    pthread_mutex_unlock(&statsLock);
+                }
+                else {
+                    awake = 0;
+                    responseLen = 0;
+                }
+                continue;
+            }
+
+            if (c != HOST_ONE && c != HOST_ZERO)
+                continue;
+
+            if (!bitCount) {
+                dropEcho = chance(config.echoLossRate);
+                if (dropEcho) {
+                    pthread_mutex_lock(&statsLock);
+                    stats.droppedEchoes++;
+                    pthread_mutex_unlock(&statsLock);
+                }
+            }
+            if (!dropEcho)
+                echo[e++] = c;
+
+            bits |= (c == HOST_ONE) << bitCount;
+            if (++bitCount < 8)
+                continue;
+
+            bitCount = 0;
+            if (bits == TOKEN_TRANSMIT && !inCommand) {
+                // the echo of the token goes out before the response
+                sendChars(echo, e);
+                e = 0;
+                transmit();
+            }
+            else {
+                hostByte(bits);
+            }
+            bits = 0;
+        }
+        sendChars(echo, e);
+    }
+    return NULL;
+}
+
+
+/** Creates the pty and starts the device on it */
+int whisperSimStart(const WhisperSimConfig *c) {
+    const char *name;
+
+    config = *c;
+    memset(&stats, 0, sizeof(stats));
+
+    masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0 || grantpt(masterFd) < 0 || unlockpt(masterFd) < 0)
+        return -1;
+    name = ptsname(masterFd);
+    if (!name)
+        return -1;
+    strncpy(slavePath, name, sizeof(slavePath) - 1);
+
+    running = 1;
+    if (pthread_create(&thread, NULL, deviceThread, NULL) != 0)
+        return -1;
+    return 0;
+}
+
+
+void whisperSimStop(void) {
+    running = 0;
+    pthread_join(thread, NULL);
+    close(masterFd);
+    masterFd = -1;
+    slavePath[0] = '\0';
+}
+
+
+/** The next attach is a different dock (a new fuse serial number) */
+void whisperSimNextDock(void) {
+    dockSerial++;
+}
+
+
+void whisperSimGetStats(WhisperSimStats *out) {
+    pthread_mutex_lock(&statsLock);
+    *out = stats;
+    pthread_mutex_unlock(&statsLock);
+}
@@ -23,50 +23,36 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-#include <stdint.h>
-#include "SHA_TimeUtils.h"
-
-
-// The values below are valid for an AVR 8-bit processor running at 16 MHz.
-// Code is compiled with -O1.
-
-//!< Offsets time needed to prepare microseconds loop.
-#define SHA_TIME_OFFSET_US      (7)
-
-//!< Fill a while loop with these CPU instructions to achieve 1 us per iteration.
-#define SHA_TIME_LOOP_FILLER    asm volatile ("nop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop")
-
-
-extern void SA_Delay(uint32_t delay);
-
-
 
+#ifndef WHISPER_SIM_H
+#define WHISPER_SIM_H
 
+#include <stdint.h>
 
-
-/** \brief Delays for a certain amount of time.
- *
- * \param[in] delay Delay for this number of microseconds (us).
- */
-void SHAP_Delay(uint32_t delay) {
-    if (delay <= SHA_TIME_OFFSET_US)
-        // We spent already this much time entering this function.
-        // With other words: A value <= SHA_TIME_OFFSET_US will not produce the desired delay.
-        return;
-
-    delay -= SHA_TIME_OFFSET_US;
-
-
-    SA_Delay(delay);
-
-    return;
-}
-
-
-void loop_delay(int8_t multp) {
-    int i, base = 2000000 *multp;
-    for(i=0;i<base;i++) {
-        double value = 10.0; //((i * 33.3) - 12.1) / 10.0;
-        value += 1.0;
-    }
-}
+/** \brief how the simulated device misbehaves */
+typedef struct {
+    uint32_t latencyUs;         //!< added before every response
+    uint32_t jitterUs;          //!< up to this much more, uniformly
+    double bitErrorRate;        //!< chance of a response bit reading inverted
+    double echoLossRate;        //!< chance of a byte's echo never coming back
+    int paced;                  //!< hold characters back for their time on the wire
+    unsigned int seed;
+} WhisperSimConfig;
+
+/** \brief what the simulated device saw and did */
+typedef struct {
+    uint32_t wakes;
+    uint32_t transmitTokens;
+    uint32_t commands;
+    uint32_t badCrcs;
+    uint32_t responses;
+    uint32_t droppedEchoes;
+    uint32_t flippedBits;
+} WhisperSimStats;
+
+int  whisperSimStart(const WhisperSimConfig *config);
+void whisperSimStop(void);
+void whisperSimNextDock(void);
+void whisperSimGetStats(WhisperSimStats *stats);
+
+#endif